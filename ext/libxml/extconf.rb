@@ -48,6 +48,16 @@ EOL
 end
 
 have_func('rb_io_bufwrite', 'ruby/io.h')
+have_func('rb_io_descriptor', 'ruby/io.h')
+have_func('rb_thread_call_without_gvl', 'ruby/thread.h')
+have_header('ruby/thread_native.h')
+have_func('pthread_create', 'pthread.h')
+have_func('mmap', 'sys/mman.h')
+have_func('madvise', 'sys/mman.h')
+have_func('rb_gc_adjust_memory_usage', 'ruby.h')
+have_header('ruby/atomic.h')
+have_func('malloc_usable_size', 'malloc.h') || have_func('malloc_size', 'malloc/malloc.h')
+have_func('rb_enc_interned_str', 'ruby/encoding.h')
 
 # For FreeBSD add /usr/local/include
 $INCFLAGS << " -I/usr/local/include"
@@ -9,17 +9,113 @@
 
 VALUE mLibXML;
 
+#ifdef RXML_MEMORY_ACCOUNTING
+#include <ruby/atomic.h>
+
+#ifdef HAVE_MALLOC_USABLE_SIZE
+#include <malloc.h>
+#define RXML_MALLOC_SIZE(pointer) malloc_usable_size(pointer)
+#else
+#include <malloc/malloc.h>
+#define RXML_MALLOC_SIZE(pointer) malloc_size(pointer)
+#endif
+
+/* Documents, readers, schemas and so on live in libxml's heap, which
+   Ruby's garbage collector cannot see.  Without help it runs too rarely
+   when a program drops large documents, so libxml's allocations are
+   counted and reported to Ruby with rb_gc_adjust_memory_usage.  To keep
+   the overhead down changes are reported once they add up to
+   RXML_MEMORY_BATCH bytes.
+
+   The system allocator is still used, and sizes are looked up rather
+   than stored, so memory allocated before this is installed can safely
+   be released afterwards.  Libxml also allocates while the GVL is
+   released and on the worker threads of XML::Parser.parse_many, where
+   Ruby must not be called.  Changes are therefore added to an atomic
+   counter, and only a thread holding the GVL reports them, which
+   happens at its next allocation, for example once a parse returns. */
+#define RXML_MEMORY_BATCH (256 * 1024)
+
+static size_t rxml_memory_reported = 0;
+static size_t rxml_memory_pending = 0;
+
+size_t rxml_memory_allocated(void)
+{
+  return rxml_memory_reported + rxml_memory_pending;
+}
+
+/* Whether the current thread holds the GVL.  Code in the bindings only
+   releases it through rxml_without_gvl. */
+static int rxml_memory_reportable(void)
+{
+  return !rxml_gvl_released_p() && ruby_native_thread_p();
+}
+
+static void rxml_memory_account(ssize_t diff)
+{
+  ssize_t pending;
+
+  RUBY_ATOMIC_SIZE_ADD(rxml_memory_pending, (size_t)diff);
+
+  pending = (ssize_t)rxml_memory_pending;
+  if ((pending >= RXML_MEMORY_BATCH || pending <= -RXML_MEMORY_BATCH) && rxml_memory_reportable())
+  {
+    pending = (ssize_t)RUBY_ATOMIC_SIZE_EXCHANGE(rxml_memory_pending, 0);
+    RUBY_ATOMIC_SIZE_ADD(rxml_memory_reported, (size_t)pending);
+    rb_gc_adjust_memory_usage(pending);
+  }
+}
+
+static void *rxml_memory_malloc(size_t size)
+{
+  void *result = malloc(size);
+
+  if (result)
+    rxml_memory_account((ssize_t)RXML_MALLOC_SIZE(result));
+
+  return result;
+}
+
+static void *rxml_memory_realloc(void *pointer, size_t size)
+{
+  size_t old_size = pointer ? RXML_MALLOC_SIZE(pointer) : 0;
+  void *result = realloc(pointer, size);
+
+  if (result)
+    rxml_memory_account((ssize_t)RXML_MALLOC_SIZE(result) - (ssize_t)old_size);
+
+  return result;
+}
+
+static void rxml_memory_free(void *pointer)
+{
+  if (pointer)
+  {
+    rxml_memory_account(-(ssize_t)RXML_MALLOC_SIZE(pointer));
+    free(pointer);
+  }
+}
+
+static char *rxml_memory_strdup(const char *string)
+{
+  size_t length = strlen(string) + 1;
+  char *result = rxml_memory_malloc(length);
+
+  if (result)
+    memcpy(result, string, length);
+
+  return result;
+}
+
 static void rxml_init_memory(void)
 {
- /* Disable for now - broke attributes. 
-  xmlGcMemSetup(
-      (xmlFreeFunc)ruby_xfree,
-      (xmlMallocFunc)ruby_xmalloc,
-      (xmlMallocFunc)ruby_xmalloc,
-      (xmlReallocFunc)ruby_xrealloc,
-      (xmlStrdupFunc)ruby_strdup
-  );*/
+  xmlMemSetup(rxml_memory_free, rxml_memory_malloc, rxml_memory_realloc, rxml_memory_strdup);
 }
+#else
+static void rxml_init_memory(void)
+{
+}
+#endif
 
 void Init_libxml_ruby(void)
 {
@@ -40,16 +136,19 @@ void Init_libxml_ruby(void)
  * copyright and distribution information.
  */
 
+  // Install the allocator before libxml allocates anything
+  rxml_init_memory();
+
   // Seutp for threading. http://xmlsoft.org/threads.html
   xmlInitParser();
 
   mLibXML = rb_define_module("LibXML");
 
-  rxml_init_memory();
   rxml_init_xml();
   rxml_init_io();
   rxml_init_error();
   rxml_init_encoding();
+  rxml_init_dictionary();
   rxml_init_parser();
   rxml_init_parser_context();
   rxml_init_parser_options();
@@ -58,6 +157,7 @@ void Init_libxml_ruby(void)
   rxml_init_attr();
   rxml_init_attr_decl();
   rxml_init_document();
+  rxml_init_document_index();
   rxml_init_namespaces();
   rxml_init_namespace();
   rxml_init_sax_parser();
@@ -67,6 +167,7 @@ void Init_libxml_ruby(void)
   rxml_init_xpath_object();
   rxml_init_xpath_context();
   rxml_init_xpath_expression();
+  rxml_init_xpath_cache();
   rxml_init_xpointer();
   rxml_init_html_parser();
   rxml_init_html_parser_options();
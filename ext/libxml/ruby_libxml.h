@@ -35,16 +35,22 @@
 #ifdef LIBXML_XPTR_ENABLED
 #include <libxml/xpointer.h>
 #endif
+#ifdef LIBXML_PATTERN_ENABLED
+#include <libxml/pattern.h>
+#endif
 
 #include "ruby_xml_version.h"
 #include "ruby_xml.h"
+#include "ruby_xml_gvl.h"
 #include "ruby_xml_io.h"
 #include "ruby_xml_error.h"
 #include "ruby_xml_encoding.h"
 #include "ruby_xml_attributes.h"
 #include "ruby_xml_attr.h"
 #include "ruby_xml_attr_decl.h"
+#include "ruby_xml_dictionary.h"
 #include "ruby_xml_document.h"
+#include "ruby_xml_document_index.h"
 #include "ruby_xml_node.h"
 #include "ruby_xml_namespace.h"
 #include "ruby_xml_namespaces.h"
@@ -62,6 +68,7 @@
 #include "ruby_xml_xinclude.h"
 #include "ruby_xml_xpath.h"
 #include "ruby_xml_xpath_expression.h"
+#include "ruby_xml_xpath_cache.h"
 #include "ruby_xml_xpath_context.h"
 #include "ruby_xml_xpath_object.h"
 #include "ruby_xml_xpointer.h"
@@ -72,4 +79,10 @@
 
 extern VALUE mLibXML;
 
+#if defined(HAVE_RB_GC_ADJUST_MEMORY_USAGE) && defined(HAVE_RUBY_ATOMIC_H) && \
+    (defined(HAVE_MALLOC_USABLE_SIZE) || defined(HAVE_MALLOC_SIZE))
+#define RXML_MEMORY_ACCOUNTING
+size_t rxml_memory_allocated(void);
+#endif
+
 #endif
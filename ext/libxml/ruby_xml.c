@@ -852,13 +852,17 @@ static VALUE rxml_memory_dump(VALUE self)
  * call-seq:
  *    XML.memory_used -> num_bytes
  *
- * Perform a parser memory dump (requires memory debugging
- * support in libxml).
+ * Returns the number of bytes currently allocated by libxml, for
+ * example for documents, readers and schemas.  This memory is also
+ * reported to Ruby's garbage collector so it runs often enough
+ * when large documents are dropped.
  */
 static VALUE rxml_memory_used(VALUE self)
 {
 #ifdef DEBUG_MEMORY_LOCATION
   return(INT2NUM(xmlMemUsed()));
+#elif defined(RXML_MEMORY_ACCOUNTING)
+  return SIZET2NUM(rxml_memory_allocated());
 #else
   rb_warn("libxml was compiled without memory debugging support");
   return (Qfalse);
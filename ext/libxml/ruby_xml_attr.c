@@ -42,7 +42,9 @@ void rxml_attr_mark(xmlAttrPtr xattr)
 
 VALUE rxml_attr_wrap(xmlAttrPtr xattr)
 {
-  return Data_Wrap_Struct(cXMLAttr, rxml_attr_mark, NULL, xattr);
+  VALUE result = Data_Wrap_Struct(cXMLAttr, rxml_attr_mark, NULL, xattr);
+  rxml_node_own(result, (xmlNodePtr) xattr);
+  return result;
 }
 
 static VALUE rxml_attr_alloc(VALUE klass)
@@ -83,6 +85,8 @@ static VALUE rxml_attr_initialize(int argc, VALUE *argv, VALUE self)
   if (xnode->type != XML_ELEMENT_NODE)
     rb_raise(rb_eArgError, "Attributes can only be created on element nodes.");
 
+  rxml_document_modify(xnode->doc);
+
   if (NIL_P(ns))
   {
     xattr = xmlNewProp(xnode, (xmlChar*)StringValuePtr(name), (xmlChar*)StringValuePtr(value));
@@ -98,6 +102,7 @@ static VALUE rxml_attr_initialize(int argc, VALUE *argv, VALUE self)
     rb_raise(rb_eRuntimeError, "Could not create attribute.");
 
   DATA_PTR( self) = xattr;
+  rxml_node_own(self, (xmlNodePtr) xattr);
   return self;
 }
 
@@ -259,6 +264,7 @@ static VALUE rxml_attr_remove_ex(VALUE self)
 {
   xmlAttrPtr xattr;
   Data_Get_Struct(self, xmlAttr, xattr);
+  rxml_document_modify(xattr->doc);
   xmlRemoveProp(xattr);
 
   RDATA(self)->data = NULL;
@@ -303,6 +309,7 @@ VALUE rxml_attr_value_set(VALUE self, VALUE val)
 
   Check_Type(val, T_STRING);
   Data_Get_Struct(self, xmlAttr, xattr);
+  rxml_document_modify(xattr->doc);
 
   if (xattr->ns)
     xmlSetNsProp(xattr->parent, xattr->ns, xattr->name,
@@ -20,7 +20,9 @@ void rxml_attr_decl_mark(xmlAttributePtr xattr)
 
 VALUE rxml_attr_decl_wrap(xmlAttributePtr xattr)
 {
-  return Data_Wrap_Struct(cXMLAttrDecl, rxml_attr_decl_mark, NULL, xattr);
+  VALUE result = Data_Wrap_Struct(cXMLAttrDecl, rxml_attr_decl_mark, NULL, xattr);
+  rxml_node_own(result, (xmlNodePtr) xattr);
+  return result;
 }
 
 /*
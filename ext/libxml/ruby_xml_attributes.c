@@ -42,7 +42,9 @@ void rxml_attributes_mark(xmlNodePtr xnode)
  */
 VALUE rxml_attributes_new(xmlNodePtr xnode)
 {
-  return Data_Wrap_Struct(cXMLAttributes, rxml_attributes_mark, NULL, xnode);
+  VALUE result = Data_Wrap_Struct(cXMLAttributes, rxml_attributes_mark, NULL, xnode);
+  rxml_node_own(result, xnode);
+  return result;
 }
 
 /*
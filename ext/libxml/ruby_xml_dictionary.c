@@ -0,0 +1,95 @@
+/* Please see the LICENSE file for copyright and distribution information */
+
+#include "ruby_libxml.h"
+#include "ruby_xml_dictionary.h"
+
+VALUE cXMLDictionary;
+
+/*
+ * Document-class: LibXML::XML::Dictionary
+ *
+ * The XML::Dictionary class wraps a libxml string dictionary, which
+ * libxml uses to intern element and attribute names.  Normally each
+ * parse creates its own dictionary.  When many documents with the
+ * same vocabulary are kept in memory, parsing them with a shared
+ * dictionary stores each name only once:
+ *
+ *   dict = XML::Dictionary.new
+ *   docs = messages.map do |message|
+ *     XML::Parser.string(message, :dictionary => dict).parse
+ *   end
+ *
+ * A dictionary can be given to XML::Parser::Context#dictionary=,
+ * XML::Parser, XML::HTMLParser and XML::Parser::Pool.  It stays alive
+ * for as long as any document that uses it.
+ *
+ * Libxml dictionaries are not thread safe, so contexts that use a
+ * shared dictionary are parsed while holding Ruby's global VM lock.
+ */
+
+static void rxml_dictionary_free(xmlDictPtr dict)
+{
+  xmlDictFree(dict);
+}
+
+static VALUE rxml_dictionary_alloc(VALUE klass)
+{
+  xmlDictPtr dict = xmlDictCreate();
+
+  if (!dict)
+    rxml_raise(&xmlLastError);
+
+  return Data_Wrap_Struct(klass, NULL, rxml_dictionary_free, dict);
+}
+
+xmlDictPtr rxml_dictionary_get(VALUE dictionary)
+{
+  xmlDictPtr dict;
+
+  if (!rb_obj_is_kind_of(dictionary, cXMLDictionary))
+    rb_raise(rb_eTypeError, "Must pass in an XML::Dictionary");
+
+  Data_Get_Struct(dictionary, xmlDict, dict);
+  return dict;
+}
+
+/*
+ * call-seq:
+ *    dictionary.size -> num
+ *
+ * Returns the number of strings in the dictionary.
+ */
+static VALUE rxml_dictionary_size(VALUE self)
+{
+  xmlDictPtr dict;
+  Data_Get_Struct(self, xmlDict, dict);
+
+  return INT2NUM(xmlDictSize(dict));
+}
+
+/*
+ * call-seq:
+ *    dictionary.include?(name) -> (true|false)
+ *
+ * Determines whether the dictionary contains the specified string.
+ */
+static VALUE rxml_dictionary_include_q(VALUE self, VALUE name)
+{
+  xmlDictPtr dict;
+  Data_Get_Struct(self, xmlDict, dict);
+  StringValue(name);
+
+  if (xmlDictExists(dict, (const xmlChar*)RSTRING_PTR(name), (int)RSTRING_LEN(name)))
+    return Qtrue;
+  else
+    return Qfalse;
+}
+
+void rxml_init_dictionary(void)
+{
+  cXMLDictionary = rb_define_class_under(mXML, "Dictionary", rb_cObject);
+  rb_define_alloc_func(cXMLDictionary, rxml_dictionary_alloc);
+
+  rb_define_method(cXMLDictionary, "size", rxml_dictionary_size, 0);
+  rb_define_method(cXMLDictionary, "include?", rxml_dictionary_include_q, 1);
+}
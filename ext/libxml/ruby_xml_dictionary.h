@@ -0,0 +1,11 @@
+/* Please see the LICENSE file for copyright and distribution information */
+
+#ifndef __RXML_DICTIONARY__
+#define __RXML_DICTIONARY__
+
+extern VALUE cXMLDictionary;
+
+xmlDictPtr rxml_dictionary_get(VALUE dictionary);
+void rxml_init_dictionary(void);
+
+#endif
@@ -54,12 +54,156 @@
 
 VALUE cXMLDocument;
 
+static ID NODE_CACHE_ATTR;
+static ID XPATH_CONTEXT_ATTR;
+static ID XPATH_SERIAL_ATTR;
+static ID XPATH_FUNCTIONS_ATTR;
+static ID READ_ONLY_ATTR;
+static ID TREE_BYTES_ATTR;
+
+/* Number of XPath evaluations running without the GVL per document, see
+   rxml_document_evaluation_begin.  Kept out of the document's ivars so
+   frozen documents can be counted too.  Only used with the GVL held. */
+static st_table *rxml_document_evaluations;
+
 void rxml_document_free(xmlDocPtr xdoc)
 {
   xdoc->_private = NULL;
   xmlFreeDoc(xdoc);
 }
 
+typedef struct
+{
+  size_t nodes;
+  size_t text_bytes;
+  size_t attribute_bytes;
+  size_t dict_bytes;
+  size_t total_bytes;
+} rxml_document_stats;
+
+/* Size of a string, unless it is shared through the document's
+   dictionary or stored inside the node itself. */
+static size_t rxml_document_string_size(xmlDocPtr xdoc, xmlNodePtr xnode, const xmlChar *string)
+{
+  if (!string || string == (const xmlChar *)&xnode->properties)
+    return 0;
+  if (xdoc->dict && xmlDictOwns(xdoc->dict, string))
+    return 0;
+  return xmlStrlen(string) + 1;
+}
+
+static void rxml_document_node_stats(xmlDocPtr xdoc, xmlNodePtr xnode, rxml_document_stats *stats)
+{
+  xmlAttrPtr xattr;
+  xmlNsPtr xns;
+  xmlNodePtr xchild;
+
+  stats->nodes++;
+  stats->total_bytes += sizeof(xmlNode);
+
+  switch (xnode->type)
+  {
+    case XML_ELEMENT_NODE:
+      stats->total_bytes += rxml_document_string_size(xdoc, xnode, xnode->name);
+
+      for (xns = xnode->nsDef; xns; xns = xns->next)
+      {
+        stats->total_bytes += sizeof(xmlNs);
+        stats->total_bytes += xns->href ? xmlStrlen(xns->href) + 1 : 0;
+        stats->total_bytes += xns->prefix ? xmlStrlen(xns->prefix) + 1 : 0;
+      }
+
+      for (xattr = xnode->properties; xattr; xattr = xattr->next)
+      {
+        size_t size = sizeof(xmlAttr) + rxml_document_string_size(xdoc, (xmlNodePtr)xattr, xattr->name);
+
+        for (xchild = xattr->children; xchild; xchild = xchild->next)
+          size += sizeof(xmlNode) + rxml_document_string_size(xdoc, xchild, xchild->content);
+
+        stats->attribute_bytes += size;
+        stats->total_bytes += size;
+      }
+      break;
+    case XML_TEXT_NODE:
+    case XML_CDATA_SECTION_NODE:
+    case XML_COMMENT_NODE:
+    case XML_PI_NODE:
+      if (xnode->content)
+        stats->text_bytes += xmlStrlen(xnode->content);
+      stats->total_bytes += rxml_document_string_size(xdoc, xnode, xnode->content);
+      if (xnode->type == XML_PI_NODE)
+        stats->total_bytes += rxml_document_string_size(xdoc, xnode, xnode->name);
+      break;
+    default:
+      break;
+  }
+}
+
+static void rxml_document_stats_collect(xmlDocPtr xdoc, rxml_document_stats *stats)
+{
+  xmlNodePtr xnode = xdoc->children;
+
+  memset(stats, 0, sizeof(rxml_document_stats));
+  stats->total_bytes = sizeof(xmlDoc);
+
+  if (xdoc->dict)
+  {
+    stats->dict_bytes = xmlDictGetUsage(xdoc->dict);
+    stats->total_bytes += stats->dict_bytes;
+  }
+
+  /* Walk the tree without recursing, declarations inside the DTD are
+     not counted. */
+  while (xnode)
+  {
+    rxml_document_node_stats(xdoc, xnode, stats);
+
+    if (xnode->children && xnode->type != XML_DTD_NODE && xnode->type != XML_ENTITY_REF_NODE)
+    {
+      xnode = xnode->children;
+      continue;
+    }
+
+    while (xnode && !xnode->next)
+    {
+      xnode = xnode->parent;
+      if (xnode == (xmlNodePtr)xdoc)
+        xnode = NULL;
+    }
+
+    if (xnode)
+      xnode = xnode->next;
+  }
+}
+
+/* ObjectSpace.memsize_of and ObjectSpace.dump_all call this for every
+   document, so it must not walk the tree.  The size of the tree is only
+   known once memory_stats walked it, which remembers the result until
+   the tree is changed through rxml_document_modify. */
+static size_t rxml_document_memsize(const void *data)
+{
+  xmlDocPtr xdoc = (xmlDocPtr)data;
+  size_t size = sizeof(xmlDoc);
+  VALUE tree_bytes = Qnil;
+
+  if (xdoc->dict)
+    size += xmlDictGetUsage(xdoc->dict);
+
+  if (xdoc->_private)
+    tree_bytes = rb_attr_get((VALUE)xdoc->_private, TREE_BYTES_ATTR);
+
+  if (!NIL_P(tree_bytes))
+    size += NUM2SIZET(tree_bytes);
+
+  return size;
+}
+
+const rb_data_type_t rxml_document_data_type = {
+  "LibXML::XML::Document",
+  {NULL, (RUBY_DATA_FUNC)rxml_document_free, rxml_document_memsize},
+  NULL, NULL, RUBY_TYPED_FREE_IMMEDIATELY
+};
+
 VALUE rxml_document_wrap(xmlDocPtr xdoc)
 {
   VALUE result = Qnil;
@@ -71,7 +215,7 @@ VALUE rxml_document_wrap(xmlDocPtr xdoc)
   }
   else
   {
-    result = Data_Wrap_Struct(cXMLDocument, NULL, rxml_document_free, xdoc);
+    result = TypedData_Wrap_Struct(cXMLDocument, &rxml_document_data_type, xdoc);
     xdoc->_private = (void*)result;
   }
 
@@ -87,7 +231,7 @@ VALUE rxml_document_wrap(xmlDocPtr xdoc)
  */
 static VALUE rxml_document_alloc(VALUE klass)
 {
-  return Data_Wrap_Struct(klass, NULL, rxml_document_free, NULL);
+  return TypedData_Wrap_Struct(klass, &rxml_document_data_type, NULL);
 }
 
 /*
@@ -118,7 +262,7 @@ static VALUE rxml_document_initialize(int argc, VALUE *argv, VALUE self)
   xdoc = xmlNewDoc((xmlChar*) StringValuePtr(xmlver));
 
   // Link the ruby object to the document and the document to the ruby object
-  RDATA(self)->data = xdoc;
+  DATA_PTR(self) = xdoc;
   xdoc->_private = (void*)self;
 
   return self;
@@ -303,7 +447,7 @@ rxml_document_canonicalize(int argc, VALUE *argv, VALUE self)
     }
   }//option_hash
 
-  Data_Get_Struct(self, xmlDoc, xdoc);
+  TypedData_Get_Struct(self, xmlDoc, &rxml_document_data_type, xdoc);
   xmlC14NDocDumpMemory(xdoc,
                        (nodeset.nodeNr == 0 ? NULL : &nodeset),
                        c14n_mode,
@@ -333,7 +477,7 @@ static VALUE rxml_document_compression_get(VALUE self)
   xmlDocPtr xdoc;
 
   int compmode;
-  Data_Get_Struct(self, xmlDoc, xdoc);
+  TypedData_Get_Struct(self, xmlDoc, &rxml_document_data_type, xdoc);
 
   compmode = xmlGetDocCompressMode(xdoc);
   if (compmode == -1)
@@ -359,7 +503,7 @@ static VALUE rxml_document_compression_set(VALUE self, VALUE num)
 
   int compmode;
   Check_Type(num, T_FIXNUM);
-  Data_Get_Struct(self, xmlDoc, xdoc);
+  TypedData_Get_Struct(self, xmlDoc, &rxml_document_data_type, xdoc);
 
   if (xdoc == NULL)
   {
@@ -392,7 +536,7 @@ static VALUE rxml_document_compression_q(VALUE self)
 #ifdef HAVE_ZLIB_H
   xmlDocPtr xdoc;
 
-  Data_Get_Struct(self, xmlDoc, xdoc);
+  TypedData_Get_Struct(self, xmlDoc, &rxml_document_data_type, xdoc);
 
   if (xdoc->compression != -1)
   return(Qtrue);
@@ -413,7 +557,7 @@ static VALUE rxml_document_compression_q(VALUE self)
 static VALUE rxml_document_child_get(VALUE self)
 {
   xmlDocPtr xdoc;
-  Data_Get_Struct(self, xmlDoc, xdoc);
+  TypedData_Get_Struct(self, xmlDoc, &rxml_document_data_type, xdoc);
 
   if (xdoc->children == NULL)
     return (Qnil);
@@ -430,7 +574,7 @@ static VALUE rxml_document_child_get(VALUE self)
 static VALUE rxml_document_child_q(VALUE self)
 {
   xmlDocPtr xdoc;
-  Data_Get_Struct(self, xmlDoc, xdoc);
+  TypedData_Get_Struct(self, xmlDoc, &rxml_document_data_type, xdoc);
 
   if (xdoc->children == NULL)
     return (Qfalse);
@@ -450,7 +594,7 @@ static VALUE rxml_document_debug(VALUE self)
 {
 #ifdef LIBXML_DEBUG_ENABLED
   xmlDocPtr xdoc;
-  Data_Get_Struct(self, xmlDoc, xdoc);
+  TypedData_Get_Struct(self, xmlDoc, &rxml_document_data_type, xdoc);
   xmlDebugDumpDocument(NULL, xdoc);
   return Qtrue;
 #else
@@ -469,7 +613,7 @@ static VALUE rxml_document_encoding_get(VALUE self)
 {
   xmlDocPtr xdoc;
   const char *xencoding;
-  Data_Get_Struct(self, xmlDoc, xdoc);
+  TypedData_Get_Struct(self, xmlDoc, &rxml_document_data_type, xdoc);
 
   xencoding = (const char*)xdoc->encoding;
   return INT2NUM(xmlParseCharEncoding(xencoding));
@@ -488,7 +632,7 @@ static VALUE rxml_document_rb_encoding_get(VALUE self)
 {
   xmlDocPtr xdoc;
   rb_encoding* rbencoding;
-  Data_Get_Struct(self, xmlDoc, xdoc);
+  TypedData_Get_Struct(self, xmlDoc, &rxml_document_data_type, xdoc);
 
   rbencoding = rxml_xml_encoding_to_rb_encoding(mXMLEncoding, xmlParseCharEncoding((const char*)xdoc->encoding));
   return rb_enc_from_encoding(rbencoding);
@@ -506,7 +650,7 @@ static VALUE rxml_document_encoding_set(VALUE self, VALUE encoding)
   xmlDocPtr xdoc;
   const char* xencoding = xmlGetCharEncodingName((xmlCharEncoding)NUM2INT(encoding));
 
-  Data_Get_Struct(self, xmlDoc, xdoc);
+  TypedData_Get_Struct(self, xmlDoc, &rxml_document_data_type, xdoc);
 
   if (xdoc->encoding != NULL)
     xmlFree((xmlChar *) xdoc->encoding);
@@ -532,7 +676,7 @@ static VALUE rxml_document_import(VALUE self, VALUE node)
   xmlDocPtr xdoc;
   xmlNodePtr xnode, xresult;
 
-  Data_Get_Struct(self, xmlDoc, xdoc);
+  TypedData_Get_Struct(self, xmlDoc, &rxml_document_data_type, xdoc);
   Data_Get_Struct(node, xmlNode, xnode);
 
   xresult = xmlDocCopyNode(xnode, xdoc, 1);
@@ -553,7 +697,7 @@ static VALUE rxml_document_last_get(VALUE self)
 {
   xmlDocPtr xdoc;
 
-  Data_Get_Struct(self, xmlDoc, xdoc);
+  TypedData_Get_Struct(self, xmlDoc, &rxml_document_data_type, xdoc);
 
   if (xdoc->last == NULL)
     return (Qnil);
@@ -571,7 +715,7 @@ static VALUE rxml_document_last_q(VALUE self)
 {
   xmlDocPtr xdoc;
 
-  Data_Get_Struct(self, xmlDoc, xdoc);
+  TypedData_Get_Struct(self, xmlDoc, &rxml_document_data_type, xdoc);
 
   if (xdoc->last == NULL)
     return (Qfalse);
@@ -589,7 +733,7 @@ static VALUE rxml_document_next_get(VALUE self)
 {
   xmlDocPtr xdoc;
 
-  Data_Get_Struct(self, xmlDoc, xdoc);
+  TypedData_Get_Struct(self, xmlDoc, &rxml_document_data_type, xdoc);
 
   if (xdoc->next == NULL)
     return (Qnil);
@@ -607,7 +751,7 @@ static VALUE rxml_document_next_q(VALUE self)
 {
   xmlDocPtr xdoc;
 
-  Data_Get_Struct(self, xmlDoc, xdoc);
+  TypedData_Get_Struct(self, xmlDoc, &rxml_document_data_type, xdoc);
 
   if (xdoc->next == NULL)
     return (Qfalse);
@@ -615,6 +759,342 @@ static VALUE rxml_document_next_q(VALUE self)
     return (Qtrue);
 }
 
+VALUE rxml_document_node_cache(xmlDocPtr xdoc)
+{
+  VALUE document = (VALUE)xdoc->_private;
+
+  if (!document)
+    return Qnil;
+
+  return rb_attr_get(document, NODE_CACHE_ATTR);
+}
+
+/*
+ * call-seq:
+ *    document.node_cache? -> (true|false)
+ *
+ * Determine whether the document caches its node objects, see
+ * XML::Document#node_cache=.
+ */
+static VALUE rxml_document_node_cache_q(VALUE self)
+{
+  return NIL_P(rb_attr_get(self, NODE_CACHE_ATTR)) ? Qfalse : Qtrue;
+}
+
+/*
+ * call-seq:
+ *    document.node_cache = true|false
+ *
+ * Enables or disables caching of node objects.  By default every
+ * access to a node, such as node.first, node.each or an XPath result,
+ * creates a new Ruby object for it.  With the cache enabled the
+ * document keeps the first object created for each element, text,
+ * cdata, comment, processing instruction or entity reference node
+ * and returns it again, so repeated traversals allocate nothing and
+ * nodes can be compared with equal? or used as hash keys.
+ *
+ * Cached objects live as long as the document, or until the cache is
+ * disabled, so only enable it for documents that are traversed more
+ * than once.
+ */
+static VALUE rxml_document_node_cache_set(VALUE self, VALUE value)
+{
+  VALUE cache = rb_attr_get(self, NODE_CACHE_ATTR);
+
+  if (RTEST(value) && NIL_P(cache))
+    rb_ivar_set(self, NODE_CACHE_ATTR, rb_ary_new());
+  else if (!RTEST(value) && !NIL_P(cache))
+  {
+    rxml_node_uncache_all(cache);
+    rb_ivar_set(self, NODE_CACHE_ATTR, Qnil);
+  }
+
+  return value;
+}
+
+/*
+ * call-seq:
+ *    document.read_only? -> (true|false)
+ *
+ * Determine whether the document is read only, see
+ * XML::Document#read_only=.
+ */
+static VALUE rxml_document_read_only_q(VALUE self)
+{
+  return RTEST(rb_attr_get(self, READ_ONLY_ATTR)) ? Qtrue : Qfalse;
+}
+
+/*
+ * call-seq:
+ *    document.read_only = true|false
+ *
+ * Marks the document as read only.  Changing the tree of a read only
+ * document, for example with Node#<<, Node#content=, Node#remove! or
+ * Attr#value=, raises a FrozenError.
+ *
+ * XPath expressions on a read only document are evaluated without
+ * holding Ruby's global VM lock, so other threads keep running during
+ * a long query and several threads can query the document at the
+ * same time.  Each thread must use its own XPath::Context, which
+ * Document#find and Node#find take care of.  Evaluating with a context
+ * that is already evaluating an expression raises a RuntimeError.  Nodes are only wrapped
+ * once the evaluation has finished.
+ *
+ * Extensions that change the libxml tree directly must not do so
+ * while other threads query the document.  For the same reason, a
+ * document can not be made writable again while such a query is
+ * running, that raises a RuntimeError.
+ */
+static VALUE rxml_document_read_only_set(VALUE self, VALUE value)
+{
+  xmlDocPtr xdoc;
+  st_data_t evaluations = 0;
+
+  TypedData_Get_Struct(self, xmlDoc, &rxml_document_data_type, xdoc);
+
+  if (!RTEST(value) && st_lookup(rxml_document_evaluations, (st_data_t)xdoc, &evaluations))
+    rb_raise(rb_eRuntimeError, "can't clear read only while %ld XPath evaluations are running",
+             (long)evaluations);
+
+  rb_ivar_set(self, READ_ONLY_ATTR, RTEST(value) ? Qtrue : Qfalse);
+  return value;
+}
+
+int rxml_document_read_only_p(xmlDocPtr xdoc)
+{
+  if (!xdoc || !xdoc->_private)
+    return 0;
+
+  return RTEST(rb_attr_get((VALUE)xdoc->_private, READ_ONLY_ATTR));
+}
+
+/* Called with the GVL held before, and after, an XPath expression is
+   evaluated on a read only document without the GVL.  The document can
+   not be made writable in between. */
+void rxml_document_evaluation_begin(xmlDocPtr xdoc)
+{
+  st_data_t evaluations = 0;
+
+  st_lookup(rxml_document_evaluations, (st_data_t)xdoc, &evaluations);
+  st_insert(rxml_document_evaluations, (st_data_t)xdoc, evaluations + 1);
+}
+
+void rxml_document_evaluation_end(xmlDocPtr xdoc)
+{
+  st_data_t key = (st_data_t)xdoc;
+  st_data_t evaluations = 0;
+
+  st_lookup(rxml_document_evaluations, key, &evaluations);
+  if (evaluations > 1)
+    st_insert(rxml_document_evaluations, key, evaluations - 1);
+  else
+    st_delete(rxml_document_evaluations, &key, NULL);
+}
+
+/* Called before the tree of a document is changed */
+void rxml_document_modify(xmlDocPtr xdoc)
+{
+  VALUE document;
+
+  if (rxml_document_read_only_p(xdoc))
+    rb_raise(rb_eFrozenError, "can't modify read only document");
+
+  rxml_document_index_invalidate(xdoc);
+
+  /* The size remembered by memory_stats no longer matches the tree */
+  document = (xdoc && xdoc->_private) ? (VALUE)xdoc->_private : Qnil;
+  if (!NIL_P(document) && !OBJ_FROZEN(document) &&
+      !NIL_P(rb_attr_get(document, TREE_BYTES_ATTR)))
+    rb_ivar_set(document, TREE_BYTES_ATTR, Qnil);
+}
+
+/* The document keeps one XPath context, with the root's namespaces
+   registered, for Document#find and Node#find.  A find checks it out,
+   so nested or concurrent finds create their own, and checks it back
+   in afterwards.  Defining a namespace or replacing the root bumps the
+   document's serial, and contexts built before that are dropped.
+   Frozen documents can not record that, so they do not use the cache. */
+void rxml_document_xpath_invalidate(xmlDocPtr xdoc)
+{
+  VALUE document;
+  VALUE serial;
+
+  if (!xdoc || !xdoc->_private)
+    return;
+
+  document = (VALUE)xdoc->_private;
+  if (OBJ_FROZEN(document))
+    return;
+
+  serial = rb_attr_get(document, XPATH_SERIAL_ATTR);
+  rb_ivar_set(document, XPATH_SERIAL_ATTR, NIL_P(serial) ? INT2FIX(1) : LONG2FIX(FIX2LONG(serial) + 1));
+  rb_ivar_set(document, XPATH_CONTEXT_ATTR, Qnil);
+}
+
+/*
+ * call-seq:
+ *    document.checkout_xpath_context(node) -> XPath::Context
+ *
+ * Returns the document's cached XPath context positioned at node, or
+ * nil if namespaces declared below the root are in scope at node so
+ * the context can not be shared, or if the document is frozen.  Return
+ * it with checkin_xpath_context.
+ */
+static VALUE rxml_document_checkout_xpath_context(VALUE self, VALUE node)
+{
+  xmlDocPtr xdoc;
+  xmlNodePtr xroot;
+  xmlNodePtr xnode;
+  xmlNodePtr xcurrent;
+  xmlXPathContextPtr xctxt;
+  VALUE context;
+
+  if (OBJ_FROZEN(self))
+    return Qnil;
+
+  TypedData_Get_Struct(self, xmlDoc, &rxml_document_data_type, xdoc);
+  xroot = xmlDocGetRootElement(xdoc);
+  if (!xroot || rb_obj_is_kind_of(node, cXMLNode) != Qtrue)
+    return Qnil;
+
+  Data_Get_Struct(node, xmlNode, xnode);
+  if (xnode->doc != xdoc)
+    return Qnil;
+
+  for (xcurrent = xnode; xcurrent && xcurrent != xroot; xcurrent = xcurrent->parent)
+  {
+    if (xcurrent->type == XML_ELEMENT_NODE && xcurrent->nsDef)
+      return Qnil;
+  }
+
+  if (xcurrent != xroot)
+    return Qnil;
+
+  context = rb_attr_get(self, XPATH_CONTEXT_ATTR);
+  if (NIL_P(context))
+  {
+    context = rb_funcall(self, rb_intern("context"), 0);
+    rb_ivar_set(context, XPATH_SERIAL_ATTR, rb_attr_get(self, XPATH_SERIAL_ATTR));
+  }
+  else
+  {
+    rb_ivar_set(self, XPATH_CONTEXT_ATTR, Qnil);
+  }
+
+  Data_Get_Struct(context, xmlXPathContext, xctxt);
+  xctxt->node = xnode;
+
+  return context;
+}
+
+/*
+ * call-seq:
+ *    document.checkin_xpath_context(context) -> nil
+ *
+ * Returns a context obtained from checkout_xpath_context to the document.
+ */
+static VALUE rxml_document_checkin_xpath_context(VALUE self, VALUE context)
+{
+  if (!OBJ_FROZEN(self) && NIL_P(rb_attr_get(self, XPATH_CONTEXT_ATTR)) &&
+      rb_attr_get(context, XPATH_SERIAL_ATTR) == rb_attr_get(self, XPATH_SERIAL_ATTR))
+    rb_ivar_set(self, XPATH_CONTEXT_ATTR, context);
+
+  return Qnil;
+}
+
+VALUE rxml_document_xpath_functions(VALUE document)
+{
+  return rb_attr_get(document, XPATH_FUNCTIONS_ATTR);
+}
+
+/*
+ * call-seq:
+ *    document.register_xpath_function(name) {|*args| ... } -> self
+ *    document.register_xpath_function(name, ns_uri) {|*args| ... } -> self
+ *
+ * Registers an XPath extension function that is available to every
+ * XPath context created for this document afterwards, including the
+ * ones used by Document#find and Node#find.  See
+ * XPath::Context#register_function.
+ *
+ *  doc.register_xpath_function('upper-case') {|string| string.upcase}
+ *  doc.find("//book[upper-case(string(author)) = 'RALLS, KIM']")
+ */
+static VALUE rxml_document_register_xpath_function(int argc, VALUE *argv, VALUE self)
+{
+  VALUE name, ns_uri, block, functions;
+  xmlDocPtr xdoc;
+
+  rb_scan_args(argc, argv, "11&", &name, &ns_uri, &block);
+  if (NIL_P(block))
+    rb_raise(rb_eArgError, "A block is required");
+
+  /* The functions are configuration, not a cache, so a frozen document
+     refuses them up front instead of half registering them */
+  rb_check_frozen(self);
+
+  name = rb_obj_as_string(name);
+  if (!NIL_P(ns_uri))
+    StringValue(ns_uri);
+
+  functions = rb_attr_get(self, XPATH_FUNCTIONS_ATTR);
+  if (NIL_P(functions))
+  {
+    functions = rb_hash_new();
+    rb_ivar_set(self, XPATH_FUNCTIONS_ATTR, functions);
+  }
+  rb_hash_aset(functions, rb_assoc_new(name, ns_uri), block);
+
+  /* The cached context does not know the function yet */
+  TypedData_Get_Struct(self, xmlDoc, &rxml_document_data_type, xdoc);
+  rxml_document_xpath_invalidate(xdoc);
+
+  return self;
+}
+
+/*
+ * call-seq:
+ *    document.memory_stats -> Hash
+ *
+ * Returns an estimate of the memory used by the document, to help
+ * find what is filling the heap.  The hash contains:
+ *
+ * :nodes - The number of nodes, not counting attributes.
+ * :text_bytes - The length of the content of text, cdata, comment and
+ *               processing instruction nodes.
+ * :attribute_bytes - The memory used by attributes and their values.
+ * :dict_bytes - The memory used by the dictionary of interned names,
+ *               which may be shared with other documents.
+ * :total_bytes - The memory used by the document, including all of the
+ *                above.
+ *
+ * Computing the statistics walks the whole tree.  ObjectSpace.memsize_of
+ * does not, it reports the size of the dictionary plus the size of the
+ * tree as of the last call to this method.  Changing the tree forgets
+ * that size, so until this method is called again the tree is not
+ * counted.  A frozen document does not remember the size at all.
+ */
+static VALUE rxml_document_memory_stats(VALUE self)
+{
+  xmlDocPtr xdoc;
+  rxml_document_stats stats;
+  VALUE result = rb_hash_new();
+
+  TypedData_Get_Struct(self, xmlDoc, &rxml_document_data_type, xdoc);
+  rxml_document_stats_collect(xdoc, &stats);
+
+  if (!OBJ_FROZEN(self))
+    rb_ivar_set(self, TREE_BYTES_ATTR, SIZET2NUM(stats.total_bytes - stats.dict_bytes - sizeof(xmlDoc)));
+
+  rb_hash_aset(result, ID2SYM(rb_intern("nodes")), SIZET2NUM(stats.nodes));
+  rb_hash_aset(result, ID2SYM(rb_intern("text_bytes")), SIZET2NUM(stats.text_bytes));
+  rb_hash_aset(result, ID2SYM(rb_intern("attribute_bytes")), SIZET2NUM(stats.attribute_bytes));
+  rb_hash_aset(result, ID2SYM(rb_intern("dict_bytes")), SIZET2NUM(stats.dict_bytes));
+  rb_hash_aset(result, ID2SYM(rb_intern("total_bytes")), SIZET2NUM(stats.total_bytes));
+
+  return result;
+}
+
 /*
  * call-seq:
  *    node.type -> num
@@ -623,9 +1103,9 @@ static VALUE rxml_document_next_q(VALUE self)
  */
 static VALUE rxml_document_node_type(VALUE self)
 {
-  xmlNodePtr xnode;
-  Data_Get_Struct(self, xmlNode, xnode);
-  return (INT2NUM(xnode->type));
+  xmlDocPtr xdoc;
+  TypedData_Get_Struct(self, xmlDoc, &rxml_document_data_type, xdoc);
+  return (INT2NUM(xdoc->type));
 }
 
 /*
@@ -638,7 +1118,7 @@ static VALUE rxml_document_parent_get(VALUE self)
 {
   xmlDocPtr xdoc;
 
-  Data_Get_Struct(self, xmlDoc, xdoc);
+  TypedData_Get_Struct(self, xmlDoc, &rxml_document_data_type, xdoc);
 
   if (xdoc->parent == NULL)
     return (Qnil);
@@ -656,7 +1136,7 @@ static VALUE rxml_document_parent_q(VALUE self)
 {
   xmlDocPtr xdoc;
 
-  Data_Get_Struct(self, xmlDoc, xdoc);
+  TypedData_Get_Struct(self, xmlDoc, &rxml_document_data_type, xdoc);
 
   if (xdoc->parent == NULL)
     return (Qfalse);
@@ -674,7 +1154,7 @@ static VALUE rxml_document_prev_get(VALUE self)
 {
   xmlDocPtr xdoc;
 
-  Data_Get_Struct(self, xmlDoc, xdoc);
+  TypedData_Get_Struct(self, xmlDoc, &rxml_document_data_type, xdoc);
 
   if (xdoc->prev == NULL)
     return (Qnil);
@@ -692,7 +1172,7 @@ static VALUE rxml_document_prev_q(VALUE self)
 {
   xmlDocPtr xdoc;
 
-  Data_Get_Struct(self, xmlDoc, xdoc);
+  TypedData_Get_Struct(self, xmlDoc, &rxml_document_data_type, xdoc);
 
   if (xdoc->prev == NULL)
     return (Qfalse);
@@ -711,7 +1191,7 @@ static VALUE rxml_document_root_get(VALUE self)
   xmlDocPtr xdoc;
   xmlNodePtr root;
 
-  Data_Get_Struct(self, xmlDoc, xdoc);
+  TypedData_Get_Struct(self, xmlDoc, &rxml_document_data_type, xdoc);
   root = xmlDocGetRootElement(xdoc);
 
   if (root == NULL)
@@ -734,16 +1214,19 @@ static VALUE rxml_document_root_set(VALUE self, VALUE node)
   if (rb_obj_is_kind_of(node, cXMLNode) == Qfalse)
     rb_raise(rb_eTypeError, "must pass an XML::Node type object");
 
-  Data_Get_Struct(self, xmlDoc, xdoc);
+  TypedData_Get_Struct(self, xmlDoc, &rxml_document_data_type, xdoc);
   Data_Get_Struct(node, xmlNode, xnode);
 
   if (xnode->doc != NULL && xnode->doc != xdoc)
     rb_raise(eXMLError, "Nodes belong to different documents.  You must first import the node by calling XML::Document.import");
 
+  rxml_document_modify(xdoc);
   xmlDocSetRootElement(xdoc, xnode);
+  rxml_document_xpath_invalidate(xdoc);
 
   // Ruby no longer manages this nodes memory
   rxml_node_unmanage(xnode, node);
+  rxml_node_cache(xnode, node);
 
   return node;
 }
@@ -780,7 +1263,7 @@ static VALUE rxml_document_save(int argc, VALUE *argv, VALUE self)
   Check_Type(filename, T_STRING);
   xfilename = StringValuePtr(filename);
 
-  Data_Get_Struct(self, xmlDoc, xdoc);
+  TypedData_Get_Struct(self, xmlDoc, &rxml_document_data_type, xdoc);
   xencoding = xdoc->encoding;
 
   if (!NIL_P(options))
@@ -819,7 +1302,7 @@ static VALUE rxml_document_standalone_q(VALUE self)
 {
   xmlDocPtr xdoc;
 
-  Data_Get_Struct(self, xmlDoc, xdoc);
+  TypedData_Get_Struct(self, xmlDoc, &rxml_document_data_type, xdoc);
   if (xdoc->standalone)
     return (Qtrue);
   else
@@ -873,7 +1356,7 @@ static VALUE rxml_document_to_s(int argc, VALUE *argv, VALUE self)
     }
   }
 
-  Data_Get_Struct(self, xmlDoc, xdoc);
+  TypedData_Get_Struct(self, xmlDoc, &rxml_document_data_type, xdoc);
   xmlDocDumpFormatMemoryEnc(xdoc, &buffer, &length, (const char*)xencoding, indent);
 
   result = rxml_new_cstr(buffer, xencoding);
@@ -891,7 +1374,7 @@ static VALUE rxml_document_url_get(VALUE self)
 {
   xmlDocPtr xdoc;
 
-  Data_Get_Struct(self, xmlDoc, xdoc);
+  TypedData_Get_Struct(self, xmlDoc, &rxml_document_data_type, xdoc);
   if (xdoc->URL == NULL)
     return (Qnil);
   else
@@ -908,7 +1391,7 @@ static VALUE rxml_document_version_get(VALUE self)
 {
   xmlDocPtr xdoc;
 
-  Data_Get_Struct(self, xmlDoc, xdoc);
+  TypedData_Get_Struct(self, xmlDoc, &rxml_document_data_type, xdoc);
   if (xdoc->version == NULL)
     return (Qnil);
   else
@@ -925,7 +1408,7 @@ static VALUE rxml_document_xhtml_q(VALUE self)
 {
   xmlDocPtr xdoc;
 	xmlDtdPtr xdtd;
-  Data_Get_Struct(self, xmlDoc, xdoc);
+  TypedData_Get_Struct(self, xmlDoc, &rxml_document_data_type, xdoc);
 	xdtd = xmlGetIntSubset(xdoc);
   if (xdtd != NULL && xmlIsXHTML(xdtd->SystemID, xdtd->ExternalID) > 0)
     return (Qtrue);
@@ -946,7 +1429,8 @@ static VALUE rxml_document_xinclude(VALUE self)
 
   int ret;
 
-  Data_Get_Struct(self, xmlDoc, xdoc);
+  TypedData_Get_Struct(self, xmlDoc, &rxml_document_data_type, xdoc);
+  rxml_document_modify(xdoc);
   ret = xmlXIncludeProcess(xdoc);
   if (ret >= 0)
   {
@@ -975,7 +1459,8 @@ static VALUE rxml_document_order_elements(VALUE self)
 {
   xmlDocPtr xdoc;
 
-  Data_Get_Struct(self, xmlDoc, xdoc);
+  TypedData_Get_Struct(self, xmlDoc, &rxml_document_data_type, xdoc);
+  rxml_document_modify(xdoc);
   return LONG2FIX(xmlXPathOrderDocElems(xdoc));
 }
 
@@ -994,8 +1479,8 @@ static VALUE rxml_document_validate_schema(VALUE self, VALUE schema)
   xmlSchemaPtr xschema;
   int is_invalid;
 
-  Data_Get_Struct(self, xmlDoc, xdoc);
-  Data_Get_Struct(schema, xmlSchema, xschema);
+  TypedData_Get_Struct(self, xmlDoc, &rxml_document_data_type, xdoc);
+  TypedData_Get_Struct(schema, xmlSchema, &rxml_schema_data_type, xschema);
 
   vptr = xmlSchemaNewValidCtxt(xschema);
 
@@ -1027,8 +1512,8 @@ static VALUE rxml_document_validate_relaxng(VALUE self, VALUE relaxng)
   xmlRelaxNGPtr xrelaxng;
   int is_invalid;
 
-  Data_Get_Struct(self, xmlDoc, xdoc);
-  Data_Get_Struct(relaxng, xmlRelaxNG, xrelaxng);
+  TypedData_Get_Struct(self, xmlDoc, &rxml_document_data_type, xdoc);
+  TypedData_Get_Struct(relaxng, xmlRelaxNG, &rxml_relaxng_data_type, xrelaxng);
 
   vptr = xmlRelaxNGNewValidCtxt(xrelaxng);
 
@@ -1052,20 +1537,32 @@ static VALUE rxml_document_validate_relaxng(VALUE self, VALUE relaxng)
  * Validate this document against the specified XML::DTD.
  * If the document is valid the method returns true.  Otherwise an
  * exception is raised with validation information.
+ *
+ * Validation rebuilds the document's ID table, so it raises a
+ * FrozenError on read only documents.  IDs registered before, for
+ * example xml:id attributes or ones registered with the :id_attribute
+ * parser option, are kept.
  */
 static VALUE rxml_document_validate_dtd(VALUE self, VALUE dtd)
 {
   xmlValidCtxt ctxt;
   xmlDocPtr xdoc;
   xmlDtdPtr xdtd;
+  void *ids;
+  int valid;
 
-  Data_Get_Struct(self, xmlDoc, xdoc);
+  TypedData_Get_Struct(self, xmlDoc, &rxml_document_data_type, xdoc);
   Data_Get_Struct(dtd, xmlDtd, xdtd);
+  rxml_document_modify(xdoc);
 
   /* Setup context */
   memset(&ctxt, 0, sizeof(xmlValidCtxt));
 
-  if (xmlValidateDtd(&ctxt, xdoc, xdtd))
+  ids = rxml_document_index_save_ids(xdoc);
+  valid = xmlValidateDtd(&ctxt, xdoc, xdtd);
+  rxml_document_index_restore_ids(xdoc, ids);
+
+  if (valid)
   {
     return Qtrue;
   }
@@ -1078,6 +1575,15 @@ static VALUE rxml_document_validate_dtd(VALUE self, VALUE dtd)
 
 void rxml_init_document(void)
 {
+  /* Not prefixed with @ so the cache is hidden from inspect */
+  NODE_CACHE_ATTR = rb_intern("node_cache");
+  XPATH_CONTEXT_ATTR = rb_intern("xpath_context");
+  XPATH_SERIAL_ATTR = rb_intern("xpath_serial");
+  READ_ONLY_ATTR = rb_intern("read_only");
+  XPATH_FUNCTIONS_ATTR = rb_intern("xpath_functions");
+  TREE_BYTES_ATTR = rb_intern("tree_bytes");
+  rxml_document_evaluations = st_init_numtable();
+
   cXMLDocument = rb_define_class_under(mXML, "Document", rb_cObject);
   rb_define_alloc_func(cXMLDocument, rxml_document_alloc);
 
@@ -1106,14 +1612,22 @@ void rxml_init_document(void)
   rb_define_method(cXMLDocument, "last?", rxml_document_last_q, 0);
   rb_define_method(cXMLDocument, "next", rxml_document_next_get, 0);
   rb_define_method(cXMLDocument, "next?", rxml_document_next_q, 0);
+  rb_define_method(cXMLDocument, "memory_stats", rxml_document_memory_stats, 0);
+  rb_define_method(cXMLDocument, "node_cache?", rxml_document_node_cache_q, 0);
+  rb_define_method(cXMLDocument, "node_cache=", rxml_document_node_cache_set, 1);
   rb_define_method(cXMLDocument, "node_type", rxml_document_node_type, 0);
   rb_define_method(cXMLDocument, "order_elements!", rxml_document_order_elements, 0);
+  rb_define_method(cXMLDocument, "read_only?", rxml_document_read_only_q, 0);
+  rb_define_method(cXMLDocument, "read_only=", rxml_document_read_only_set, 1);
   rb_define_method(cXMLDocument, "parent", rxml_document_parent_get, 0);
   rb_define_method(cXMLDocument, "parent?", rxml_document_parent_q, 0);
   rb_define_method(cXMLDocument, "prev", rxml_document_prev_get, 0);
   rb_define_method(cXMLDocument, "prev?", rxml_document_prev_q, 0);
   rb_define_method(cXMLDocument, "root", rxml_document_root_get, 0);
   rb_define_method(cXMLDocument, "root=", rxml_document_root_set, 1);
+  rb_define_method(cXMLDocument, "register_xpath_function", rxml_document_register_xpath_function, -1);
+  rb_define_private_method(cXMLDocument, "checkout_xpath_context", rxml_document_checkout_xpath_context, 1);
+  rb_define_private_method(cXMLDocument, "checkin_xpath_context", rxml_document_checkin_xpath_context, 1);
   rb_define_method(cXMLDocument, "save", rxml_document_save, -1);
   rb_define_method(cXMLDocument, "standalone?", rxml_document_standalone_q, 0);
   rb_define_method(cXMLDocument, "to_s", rxml_document_to_s, -1);
@@ -4,8 +4,16 @@
 #define __RXML_DOCUMENT__
 
 extern VALUE cXMLDocument;
+extern const rb_data_type_t rxml_document_data_type;
 void rxml_init_document();
 VALUE rxml_document_wrap(xmlDocPtr xnode);
+VALUE rxml_document_node_cache(xmlDocPtr xdoc);
+void rxml_document_xpath_invalidate(xmlDocPtr xdoc);
+VALUE rxml_document_xpath_functions(VALUE document);
+int rxml_document_read_only_p(xmlDocPtr xdoc);
+void rxml_document_evaluation_begin(xmlDocPtr xdoc);
+void rxml_document_evaluation_end(xmlDocPtr xdoc);
+void rxml_document_modify(xmlDocPtr xdoc);
 
 typedef xmlChar * xmlCharPtr;
 #endif
@@ -0,0 +1,436 @@
+/* Please see the LICENSE file for copyright and distribution information */
+
+#include "ruby_libxml.h"
+#include "ruby_xml_document_index.h"
+
+/* Element name index for documents.
+ *
+ * Document#build_index(:names) records every element of the document
+ * by local name and namespace href, in document order.  The index is
+ * used by Document#elements_named and by XPath::Context#find for
+ * expressions of the form //name or //prefix:name, which otherwise
+ * scan the whole tree on every evaluation.
+ *
+ * Any change to the tree through the bindings goes through
+ * rxml_document_modify, which discards the index.  It is rebuilt the
+ * next time it is needed until Document#drop_index is called.  The
+ * document's hidden index attribute is nil when the document is not
+ * indexed and the index object otherwise.  The object's table is NULL
+ * when it has to be rebuilt.  Discarding and rebuilding only change
+ * the object, so they work on frozen documents too.
+ *
+ * IDs are looked up in libxml's own ID table instead, which the parser
+ * fills from xml:id attributes and attributes the DTD declares as IDs,
+ * and libxml keeps up to date when attributes change. */
+
+static ID NAME_INDEX_ATTR;
+
+static void rxml_document_index_free_entry(void *payload, const xmlChar *name)
+{
+  xmlXPathFreeNodeSet((xmlNodeSetPtr)payload);
+}
+
+static void rxml_document_index_free(void *data)
+{
+  if (data)
+    xmlHashFree((xmlHashTablePtr)data, rxml_document_index_free_entry);
+}
+
+static const rb_data_type_t rxml_document_index_data_type = {
+  "LibXML::XML::Document::Index",
+  {NULL, rxml_document_index_free, NULL},
+  NULL, NULL, RUBY_TYPED_FREE_IMMEDIATELY
+};
+
+typedef void (*rxml_document_index_func)(xmlNodePtr xnode, void *data);
+
+/* Calls func for each element of the document in document order */
+static void rxml_document_index_walk(xmlDocPtr xdoc, rxml_document_index_func func, void *data)
+{
+  xmlNodePtr xcurrent = xdoc->children;
+
+  while (xcurrent)
+  {
+    if (xcurrent->type == XML_ELEMENT_NODE)
+    {
+      func(xcurrent, data);
+
+      if (xcurrent->children)
+      {
+        xcurrent = xcurrent->children;
+        continue;
+      }
+    }
+
+    while (xcurrent && !xcurrent->next)
+    {
+      xcurrent = xcurrent->parent;
+      if (xcurrent == (xmlNodePtr)xdoc)
+        xcurrent = NULL;
+    }
+
+    if (xcurrent)
+      xcurrent = xcurrent->next;
+  }
+}
+
+static const xmlChar *rxml_document_index_href(xmlNodePtr xnode)
+{
+  return xnode->ns ? xnode->ns->href : NULL;
+}
+
+static void rxml_document_index_add(xmlNodePtr xnode, void *data)
+{
+  xmlHashTablePtr table = (xmlHashTablePtr)data;
+  const xmlChar *href = rxml_document_index_href(xnode);
+  xmlNodeSetPtr nodes = xmlHashLookup2(table, xnode->name, href);
+
+  if (!nodes)
+  {
+    nodes = xmlXPathNodeSetCreate(NULL);
+    xmlHashAddEntry2(table, xnode->name, href, nodes);
+  }
+
+  xmlXPathNodeSetAddUnique(nodes, xnode);
+}
+
+/* Returns the document's index object, or nil if it is not indexed */
+static VALUE rxml_document_index_object(xmlDocPtr xdoc)
+{
+  if (!xdoc || !xdoc->_private)
+    return Qnil;
+
+  return rb_attr_get((VALUE)xdoc->_private, NAME_INDEX_ATTR);
+}
+
+/* Returns the document's index, building it if needed, or NULL if the
+   document is not indexed */
+static xmlHashTablePtr rxml_document_index_get(xmlDocPtr xdoc)
+{
+  VALUE index = rxml_document_index_object(xdoc);
+  xmlHashTablePtr table;
+
+  if (NIL_P(index))
+    return NULL;
+
+  table = (xmlHashTablePtr)RTYPEDDATA_DATA(index);
+  if (!table)
+  {
+    table = xmlHashCreate(0);
+    rxml_document_index_walk(xdoc, rxml_document_index_add, table);
+    RTYPEDDATA_DATA(index) = table;
+  }
+
+  return table;
+}
+
+/* Discards the document's index, called before its tree is changed */
+void rxml_document_index_invalidate(xmlDocPtr xdoc)
+{
+  VALUE index = rxml_document_index_object(xdoc);
+
+  if (!NIL_P(index) && RTYPEDDATA_DATA(index))
+  {
+    rxml_document_index_free(RTYPEDDATA_DATA(index));
+    RTYPEDDATA_DATA(index) = NULL;
+  }
+}
+
+/* Looks up the elements with the given local name and namespace href,
+   NULL for none, in the document's index.  Returns 0 if the document is
+   not indexed.  Otherwise sets nodes to the indexed node set, or NULL if
+   there are no such elements, and returns 1.  The node set belongs to
+   the index and is only valid until the document is changed. */
+int rxml_document_index_lookup(xmlDocPtr xdoc, const xmlChar *name, const xmlChar *href,
+                               xmlNodeSetPtr *nodes)
+{
+  xmlHashTablePtr table = rxml_document_index_get(xdoc);
+
+  if (!table)
+    return 0;
+
+  *nodes = xmlHashLookup2(table, name, href);
+  return 1;
+}
+
+typedef struct
+{
+  const xmlChar *name;
+  const xmlChar *href;
+  int any_href;
+  xmlNodeSetPtr nodes;
+} rxml_document_index_query;
+
+static void rxml_document_index_match(xmlNodePtr xnode, void *data)
+{
+  rxml_document_index_query *query = (rxml_document_index_query*)data;
+  const xmlChar *href = rxml_document_index_href(xnode);
+
+  if (xmlStrEqual(xnode->name, query->name) &&
+      (query->any_href || xmlStrEqual(href, query->href)))
+    xmlXPathNodeSetAddUnique(query->nodes, xnode);
+}
+
+static void rxml_document_index_merge(void *payload, void *data, const xmlChar *name)
+{
+  rxml_document_index_query *query = (rxml_document_index_query*)data;
+  query->nodes = xmlXPathNodeSetMerge(query->nodes, (xmlNodeSetPtr)payload);
+}
+
+static VALUE rxml_document_index_wrap_nodes(xmlNodeSetPtr nodes)
+{
+  VALUE result = rb_ary_new2(nodes ? nodes->nodeNr : 0);
+  int i;
+
+  for (i = 0; nodes && i < nodes->nodeNr; i++)
+    rb_ary_push(result, rxml_node_wrap(nodes->nodeTab[i]));
+
+  return result;
+}
+
+static VALUE rxml_document_index_query_nodes(VALUE data)
+{
+  return rxml_document_index_wrap_nodes(((rxml_document_index_query*)data)->nodes);
+}
+
+static VALUE rxml_document_index_query_free(VALUE data)
+{
+  xmlXPathFreeNodeSet(((rxml_document_index_query*)data)->nodes);
+  return Qnil;
+}
+
+/*
+ * call-seq:
+ *    document.build_index(:names) -> document
+ *
+ * Builds an index of the document's elements by local name and
+ * namespace.  The index is used by #elements_named and by XPath
+ * expressions of the form //name or //prefix:name, which then no longer
+ * scan the whole document.
+ *
+ * Changing the document discards the index, and it is rebuilt the next
+ * time it is used.  So only index documents that are queried much more
+ * often than they are changed.
+ *
+ *  doc.build_index(:names)
+ *  doc.find('//book')         # uses the index
+ *  doc.elements_named('book') # uses the index
+ */
+static VALUE rxml_document_build_index(VALUE self, VALUE kind)
+{
+  xmlDocPtr xdoc;
+
+  if (kind != ID2SYM(rb_intern("names")))
+    rb_raise(rb_eArgError, "Unsupported index type, only :names is supported");
+
+  TypedData_Get_Struct(self, xmlDoc, &rxml_document_data_type, xdoc);
+  rb_check_frozen(self);
+
+  if (NIL_P(rb_attr_get(self, NAME_INDEX_ATTR)))
+    rb_ivar_set(self, NAME_INDEX_ATTR,
+                TypedData_Wrap_Struct(rb_cObject, &rxml_document_index_data_type, NULL));
+  rxml_document_index_get(xdoc);
+
+  return self;
+}
+
+/*
+ * call-seq:
+ *    document.drop_index -> document
+ *
+ * Discards the document's element index, see #build_index.
+ */
+static VALUE rxml_document_drop_index(VALUE self)
+{
+  rb_check_frozen(self);
+  rb_ivar_set(self, NAME_INDEX_ATTR, Qnil);
+  return self;
+}
+
+/*
+ * call-seq:
+ *    document.elements_named(name) -> [XML::Node, ...]
+ *    document.elements_named(name, ns) -> [XML::Node, ...]
+ *
+ * Returns the document's elements with the given local name in document
+ * order.  If a namespace is given, as an href or an XML::Namespace, only
+ * elements in that namespace are returned.  Uses the document's index
+ * if it has one, see #build_index, and otherwise walks the document.
+ *
+ *  doc.elements_named('book').length
+ *  doc.elements_named('Envelope', 'http://schemas.xmlsoap.org/soap/envelope/')
+ */
+static VALUE rxml_document_elements_named(int argc, VALUE *argv, VALUE self)
+{
+  rxml_document_index_query query;
+  xmlHashTablePtr table;
+  xmlDocPtr xdoc;
+  VALUE name, ns;
+
+  rb_scan_args(argc, argv, "11", &name, &ns);
+  TypedData_Get_Struct(self, xmlDoc, &rxml_document_data_type, xdoc);
+
+  name = rb_obj_as_string(name);
+  query.name = (const xmlChar*)StringValueCStr(name);
+  query.href = NULL;
+  query.any_href = NIL_P(ns);
+
+  if (rb_obj_is_kind_of(ns, cXMLNamespace))
+  {
+    xmlNsPtr xns;
+    Data_Get_Struct(ns, xmlNs, xns);
+    query.href = xns->href;
+  }
+  else if (!NIL_P(ns))
+  {
+    query.href = (const xmlChar*)StringValueCStr(ns);
+  }
+
+  table = rxml_document_index_get(xdoc);
+
+  if (table && !query.any_href)
+    return rxml_document_index_wrap_nodes(xmlHashLookup2(table, query.name, query.href));
+
+  query.nodes = xmlXPathNodeSetCreate(NULL);
+
+  if (table)
+  {
+    /* Combine the entries for every namespace */
+    xmlHashScan3(table, query.name, NULL, NULL, rxml_document_index_merge, &query);
+    xmlXPathNodeSetSort(query.nodes);
+  }
+  else
+  {
+    rxml_document_index_walk(xdoc, rxml_document_index_match, &query);
+  }
+
+  return rb_ensure(rxml_document_index_query_nodes, (VALUE)&query,
+                   rxml_document_index_query_free, (VALUE)&query);
+}
+
+static void rxml_document_index_add_ids(xmlNodePtr xnode, void *data)
+{
+  const xmlChar *name = (const xmlChar*)data;
+  xmlAttrPtr xattr;
+
+  for (xattr = xnode->properties; xattr; xattr = xattr->next)
+  {
+    xmlChar *value;
+
+    if (xattr->ns || xattr->atype == XML_ATTRIBUTE_ID || !xmlStrEqual(xattr->name, name))
+      continue;
+
+    /* Like the parser, keep the first element with a given ID */
+    value = xmlNodeListGetString(xnode->doc, xattr->children, 1);
+    if (value && !xmlGetID(xnode->doc, value))
+      xmlAddID(NULL, xnode->doc, value, xattr);
+    xmlFree(value);
+  }
+}
+
+/* Registers the attributes without a namespace called name as IDs, see
+   XML::Parser::Context#id_attribute= */
+void rxml_document_index_ids(xmlDocPtr xdoc, const xmlChar *name)
+{
+  rxml_document_index_walk(xdoc, rxml_document_index_add_ids, (void*)name);
+}
+
+typedef struct
+{
+  xmlAttrPtr *attrs;
+  int count;
+} rxml_document_index_saved_ids;
+
+static void rxml_document_index_save_id(void *payload, void *data, const xmlChar *name)
+{
+  xmlIDPtr xid = (xmlIDPtr)payload;
+  rxml_document_index_saved_ids *saved = (rxml_document_index_saved_ids*)data;
+
+  if (xid->attr)
+    saved->attrs[saved->count++] = xid->attr;
+}
+
+/* Returns the attributes registered as IDs in the document, to be passed
+   to rxml_document_index_restore_ids.  DTD validation replaces the ID
+   table with the IDs the DTD declares, which loses xml:id attributes and
+   the ones registered with XML::Parser::Context#id_attribute=. */
+void *rxml_document_index_save_ids(xmlDocPtr xdoc)
+{
+  rxml_document_index_saved_ids *saved = xmlMalloc(sizeof(rxml_document_index_saved_ids));
+  int size = xdoc->ids ? xmlHashSize((xmlHashTablePtr)xdoc->ids) : 0;
+
+  saved->attrs = size > 0 ? xmlMalloc(size * sizeof(xmlAttrPtr)) : NULL;
+  saved->count = 0;
+
+  if (size > 0)
+    xmlHashScan((xmlHashTablePtr)xdoc->ids, rxml_document_index_save_id, saved);
+
+  return saved;
+}
+
+/* Registers the saved attributes as IDs again, unless their value is
+   registered already, and frees the saved list */
+void rxml_document_index_restore_ids(xmlDocPtr xdoc, void *data)
+{
+  rxml_document_index_saved_ids *saved = (rxml_document_index_saved_ids*)data;
+  int i;
+
+  for (i = 0; i < saved->count; i++)
+  {
+    xmlAttrPtr xattr = saved->attrs[i];
+    xmlChar *value = xmlNodeListGetString(xdoc, xattr->children, 1);
+
+    if (value && !xmlGetID(xdoc, value))
+      xmlAddID(NULL, xdoc, value, xattr);
+    xmlFree(value);
+  }
+
+  xmlFree(saved->attrs);
+  xmlFree(saved);
+}
+
+/*
+ * call-seq:
+ *    document.element_by_id(id) -> XML::Node
+ *
+ * Returns the element with the given ID, or nil if there is none.
+ * IDs are xml:id attributes, attributes declared as IDs by the
+ * document's DTD and attributes registered with the :id_attribute
+ * parser option (see XML::Parser::Context#id_attribute=).  The lookup
+ * uses libxml's ID table so it does not scan the document.
+ *
+ *  doc = XML::Document.string('<doc><a id="x"/></doc>', :id_attribute => 'id')
+ *  doc.element_by_id('x') # => <a id="x"/>
+ */
+static VALUE rxml_document_element_by_id(VALUE self, VALUE id)
+{
+  xmlDocPtr xdoc;
+  xmlAttrPtr xattr;
+  xmlNodePtr xnode;
+
+  TypedData_Get_Struct(self, xmlDoc, &rxml_document_data_type, xdoc);
+  id = rb_obj_as_string(id);
+
+  xattr = xmlGetID(xdoc, (const xmlChar*)StringValueCStr(id));
+
+  /* Streaming parsers record IDs without their attribute */
+  if (!xattr || xattr == (xmlAttrPtr)xdoc || !xattr->parent)
+    return Qnil;
+
+  /* Elements removed from the document keep their IDs registered */
+  for (xnode = xattr->parent; xnode->parent; xnode = xnode->parent);
+  if (xnode != (xmlNodePtr)xdoc)
+    return Qnil;
+
+  return rxml_node_wrap(xattr->parent);
+}
+
+void rxml_init_document_index(void)
+{
+  NAME_INDEX_ATTR = rb_intern("name_index");
+
+  rb_define_method(cXMLDocument, "build_index", rxml_document_build_index, 1);
+  rb_define_method(cXMLDocument, "drop_index", rxml_document_drop_index, 0);
+  rb_define_method(cXMLDocument, "elements_named", rxml_document_elements_named, -1);
+  rb_define_method(cXMLDocument, "element_by_id", rxml_document_element_by_id, 1);
+}
@@ -0,0 +1,14 @@
+/* Please see the LICENSE file for copyright and distribution information */
+
+#ifndef __RXML_DOCUMENT_INDEX__
+#define __RXML_DOCUMENT_INDEX__
+
+void rxml_init_document_index(void);
+void rxml_document_index_invalidate(xmlDocPtr xdoc);
+void rxml_document_index_ids(xmlDocPtr xdoc, const xmlChar *name);
+void *rxml_document_index_save_ids(xmlDocPtr xdoc);
+void rxml_document_index_restore_ids(xmlDocPtr xdoc, void *data);
+int rxml_document_index_lookup(xmlDocPtr xdoc, const xmlChar *name, const xmlChar *href,
+                               xmlNodeSetPtr *nodes);
+
+#endif
@@ -174,7 +174,8 @@ static VALUE rxml_dtd_initialize(int argc, VALUE *argv, VALUE self)
       if (doc != Qnil) {
         if (rb_obj_is_kind_of(doc, cXMLDocument) == Qfalse)
           rb_raise(rb_eTypeError, "Must pass an XML::Document object");
-        Data_Get_Struct(doc, xmlDoc, xdoc);
+        TypedData_Get_Struct(doc, xmlDoc, &rxml_document_data_type, xdoc);
+        rxml_document_modify(xdoc);
       }
 
       if (internal == Qnil || internal == Qfalse)
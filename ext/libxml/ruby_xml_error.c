@@ -96,9 +96,9 @@ VALUE rxml_error_wrap(xmlErrorPtr xerror)
   return result;
 }
 
-/* Hook that receives xml error message */
-static void structuredErrorFunc(void *userData, xmlErrorPtr xerror)
+static void *rxml_error_dispatch(void *data)
 {
+  xmlErrorPtr xerror = (xmlErrorPtr)data;
   VALUE error = rxml_error_wrap(xerror);
 
   /* Wrap error up as Ruby object and send it off to ruby */
@@ -109,6 +109,14 @@ static void structuredErrorFunc(void *userData, xmlErrorPtr xerror)
   {
     rb_funcall(block, CALL_METHOD, 1, error);
   }
+  return NULL;
+}
+
+/* Hook that receives xml error message.  This may be called while a
+   parse runs without the GVL, so reacquire it before touching Ruby. */
+static void structuredErrorFunc(void *userData, xmlErrorPtr xerror)
+{
+  rxml_with_gvl(rxml_error_dispatch, xerror);
 }
 
 static void rxml_set_handler(VALUE self, VALUE block)
@@ -0,0 +1,124 @@
+/* Please see the LICENSE file for copyright and distribution information */
+
+#include "ruby_libxml.h"
+
+#ifdef HAVE_RB_THREAD_CALL_WITHOUT_GVL
+#include <ruby/thread.h>
+#endif
+
+/* Support for running libxml code without holding Ruby's global VM lock.
+ *
+ * While the lock is released libxml may still call back into the bindings,
+ * for example to report errors to XML::Error's handler or to open
+ * XML::InputCallbacks schemes.  Those callbacks go through rxml_with_gvl,
+ * which reacquires the lock if the current thread gave it up via
+ * rxml_without_gvl and otherwise just calls the function.
+ *
+ * Ruby exceptions must not unwind through libxml while it runs without
+ * the lock.  So rxml_with_gvl catches them and remembers the first one.
+ * Code running without the lock can check for it with rxml_gvl_pending_p
+ * and stop early.  Once the lock is held again, the caller cleans up and
+ * then calls rxml_gvl_raise_pending to rethrow it.
+ *
+ * Threads that Ruby does not know about, such as the workers of
+ * XML::Parser.parse_many, can not call Ruby at all.  Neither can code
+ * that detached itself with rxml_gvl_detach so that it behaves the same
+ * on any thread.  There rxml_with_gvl skips the function and returns
+ * NULL, as if a Ruby input callback failed to open its input.
+ *
+ * The state is kept per native thread since that is where libxml invokes
+ * the callbacks. */
+
+static RXML_THREAD_LOCAL int rxml_gvl_released = 0;
+static RXML_THREAD_LOCAL int rxml_gvl_pending = 0;
+static RXML_THREAD_LOCAL int rxml_gvl_detached = 0;
+
+typedef struct
+{
+  rxml_gvl_func func;
+  void *data;
+  void *result;
+} rxml_gvl_call;
+
+static VALUE rxml_gvl_call_func(VALUE value)
+{
+  rxml_gvl_call *call = (rxml_gvl_call*)value;
+  call->result = call->func(call->data);
+  return Qnil;
+}
+
+static void *rxml_gvl_protect(void *data)
+{
+  int state = 0;
+
+  rb_protect(rxml_gvl_call_func, (VALUE)data, &state);
+
+  if (state && !rxml_gvl_pending)
+    rxml_gvl_pending = state;
+
+  return NULL;
+}
+
+void *rxml_without_gvl(rxml_gvl_func func, void *data, rxml_gvl_unblock_func ubf, void *ubf_data)
+{
+#ifdef HAVE_RB_THREAD_CALL_WITHOUT_GVL
+  void *result;
+  int released = rxml_gvl_released;
+
+  rxml_gvl_released = 1;
+  result = rb_thread_call_without_gvl(func, data, ubf, ubf_data);
+  rxml_gvl_released = released;
+
+  return result;
+#else
+  return func(data);
+#endif
+}
+
+void *rxml_with_gvl(rxml_gvl_func func, void *data)
+{
+  if (rxml_gvl_detached || !ruby_native_thread_p())
+    return NULL;
+
+#ifdef HAVE_RB_THREAD_CALL_WITHOUT_GVL
+  if (rxml_gvl_released)
+  {
+    rxml_gvl_call call = {func, data, NULL};
+
+    rxml_gvl_released = 0;
+    rb_thread_call_with_gvl(rxml_gvl_protect, &call);
+    rxml_gvl_released = 1;
+
+    return call.result;
+  }
+#endif
+  return func(data);
+}
+
+/* Stops, or with a detached of 0 resumes, calling Ruby from the current
+   thread.  Returns the previous setting. */
+int rxml_gvl_detach(int detached)
+{
+  int previous = rxml_gvl_detached;
+  rxml_gvl_detached = detached;
+  return previous;
+}
+
+int rxml_gvl_released_p(void)
+{
+  return rxml_gvl_released;
+}
+
+int rxml_gvl_pending_p(void)
+{
+  return rxml_gvl_pending != 0;
+}
+
+void rxml_gvl_raise_pending(void)
+{
+  int state = rxml_gvl_pending;
+  rxml_gvl_pending = 0;
+
+  if (state)
+    rb_jump_tag(state);
+}
@@ -0,0 +1,22 @@
+/* Please see the LICENSE file for copyright and distribution information */
+
+#ifndef __RXML_GVL__
+#define __RXML_GVL__
+
+#if defined(_MSC_VER)
+#define RXML_THREAD_LOCAL __declspec(thread)
+#else
+#define RXML_THREAD_LOCAL __thread
+#endif
+
+typedef void *(*rxml_gvl_func)(void *data);
+typedef void (*rxml_gvl_unblock_func)(void *data);
+
+void *rxml_without_gvl(rxml_gvl_func func, void *data, rxml_gvl_unblock_func ubf, void *ubf_data);
+void *rxml_with_gvl(rxml_gvl_func func, void *data);
+int rxml_gvl_detach(int detached);
+int rxml_gvl_released_p(void);
+int rxml_gvl_pending_p(void);
+void rxml_gvl_raise_pending(void);
+
+#endif
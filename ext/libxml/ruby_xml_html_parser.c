@@ -60,9 +60,10 @@ static VALUE rxml_html_parser_initialize(int argc, VALUE *argv, VALUE self)
 static VALUE rxml_html_parser_parse(VALUE self)
 {
   xmlParserCtxtPtr ctxt;
+  xmlDocPtr xdoc;
   VALUE context = rb_ivar_get(self, CONTEXT_ATTR);
   
-  Data_Get_Struct(context, xmlParserCtxt, ctxt);
+  TypedData_Get_Struct(context, xmlParserCtxt, &rxml_parser_context_data_type, ctxt);
 
   if (htmlParseDocument(ctxt) == -1 && ! ctxt->recovery)
   {
@@ -71,7 +72,11 @@ static VALUE rxml_html_parser_parse(VALUE self)
 
   rb_funcall(context, rb_intern("close"), 0);
 
-  return rxml_document_wrap(ctxt->myDoc);
+  /* The document now belongs to Ruby, see rxml_parser_result */
+  xdoc = ctxt->myDoc;
+  ctxt->myDoc = NULL;
+
+  return rxml_document_wrap(xdoc);
 }
 
 void rxml_init_html_parser(void)
@@ -133,9 +133,15 @@ static void rxml_html_parser_context_free(htmlParserCtxtPtr ctxt)
   htmlFreeParserCtxt(ctxt);
 }
 
+static const rb_data_type_t rxml_html_parser_context_data_type = {
+  "LibXML::XML::HTMLParser::Context",
+  {NULL, (RUBY_DATA_FUNC)rxml_html_parser_context_free, rxml_parser_context_memsize},
+  &rxml_parser_context_data_type, NULL, 0
+};
+
 static VALUE rxml_html_parser_context_wrap(htmlParserCtxtPtr ctxt)
 {
-  return Data_Wrap_Struct(cXMLHtmlParserContext, NULL, rxml_html_parser_context_free, ctxt);
+  return TypedData_Wrap_Struct(cXMLHtmlParserContext, &rxml_html_parser_context_data_type, ctxt);
 }
 
 /* call-seq:
@@ -164,25 +170,44 @@ static VALUE rxml_html_parser_context_file(VALUE klass, VALUE file)
 
 /* call-seq:
  *    XML::HTMLParser::Context.io(io) -> XML::HTMLParser::Context
+ *    XML::HTMLParser::Context.io(io, :chunk_size => 1048576) -> XML::HTMLParser::Context
  *
  * Creates a new parser context based on the specified io object.
  *
+ * The io object is read in chunks with readpartial, reusing a single
+ * buffer.  Regular files are read directly from their file descriptor
+ * without holding the GVL.
+ *
  * Parameters:
  *
  *  io - A ruby IO object.
+ *  chunk_size - The number of bytes to read from the io object at a
+ *               time, defaults to 65536.
 */
-static VALUE rxml_html_parser_context_io(VALUE klass, VALUE io)
+static VALUE rxml_html_parser_context_io(int argc, VALUE *argv, VALUE klass)
 {
+  VALUE io;
+  VALUE options;
   VALUE result;
   htmlParserCtxtPtr ctxt;
   xmlParserInputBufferPtr input;
   xmlParserInputPtr stream;
+  void *reader;
+
+  rb_scan_args(argc, argv, "11", &io, &options);
 
   if (NIL_P(io))
     rb_raise(rb_eTypeError, "Must pass in an IO object");
 
-  input = xmlParserInputBufferCreateIO((xmlInputReadCallback) rxml_read_callback, NULL,
-                                     (void*)io, XML_CHAR_ENCODING_NONE);
+  reader = rxml_io_input_open(io, rxml_io_chunk_size(options));
+  input = xmlParserInputBufferCreateIO(rxml_io_input_callback(reader), rxml_io_input_close,
+                                       reader, XML_CHAR_ENCODING_NONE);
+
+  if (!input)
+  {
+    rxml_io_input_close(reader);
+    rxml_raise(&xmlLastError);
+  }
 
   ctxt = htmlNewParserCtxt();
   if (!ctxt)
@@ -261,7 +286,7 @@ static VALUE rxml_html_parser_context_close(VALUE self)
 {
   htmlParserCtxtPtr ctxt;
   xmlParserInputPtr xinput;
-  Data_Get_Struct(self, htmlParserCtxt, ctxt);
+  TypedData_Get_Struct(self, htmlParserCtxt, &rxml_parser_context_data_type, ctxt);
 
   while ((xinput = inputPop(ctxt)) != NULL)
   {
@@ -279,7 +304,7 @@ static VALUE rxml_html_parser_context_close(VALUE self)
 static VALUE rxml_html_parser_context_disable_cdata_set(VALUE self, VALUE value)
 {
   htmlParserCtxtPtr ctxt;
-  Data_Get_Struct(self, htmlParserCtxt, ctxt);
+  TypedData_Get_Struct(self, htmlParserCtxt, &rxml_parser_context_data_type, ctxt);
 
   if (ctxt->sax == NULL)
     rb_raise(rb_eRuntimeError, "Sax handler is not yet set");
@@ -308,7 +333,7 @@ static VALUE rxml_html_parser_context_options_set(VALUE self, VALUE options)
   htmlParserCtxtPtr ctxt;
   Check_Type(options, T_FIXNUM);
 
-  Data_Get_Struct(self, htmlParserCtxt, ctxt);
+  TypedData_Get_Struct(self, htmlParserCtxt, &rxml_parser_context_data_type, ctxt);
   htmlCtxtUseOptions(ctxt, xml_options);
 
 #if LIBXML_VERSION >= 20707
@@ -329,7 +354,7 @@ void rxml_init_html_parser_context(void)
   cXMLHtmlParserContext = rb_define_class_under(cXMLHtmlParser, "Context", cXMLParserContext);
 
   rb_define_singleton_method(cXMLHtmlParserContext, "file", rxml_html_parser_context_file, 1);
-  rb_define_singleton_method(cXMLHtmlParserContext, "io", rxml_html_parser_context_io, 1);
+  rb_define_singleton_method(cXMLHtmlParserContext, "io", rxml_html_parser_context_io, -1);
   rb_define_singleton_method(cXMLHtmlParserContext, "string", rxml_html_parser_context_string, 1);
   rb_define_method(cXMLHtmlParserContext, "close", rxml_html_parser_context_close, 0);
   rb_define_method(cXMLHtmlParserContext, "disable_cdata=", rxml_html_parser_context_disable_cdata_set, 1);
@@ -27,8 +27,9 @@ int ic_match(char const *filename)
   return 0;
 }
 
-void* ic_open(char const *filename)
+static void* ic_open_scheme(void *data)
 {
+  char const *filename = (char const *)data;
   ic_doc_context *ic_doc;
   ic_scheme *scheme;
   VALUE res;
@@ -54,6 +55,13 @@ void* ic_open(char const *filename)
   return 0;
 }
 
+/* Libxml may open entities while a parse runs without the GVL, so make
+   sure it is held before calling the scheme's Ruby class. */
+void* ic_open(char const *filename)
+{
+  return rxml_with_gvl(ic_open_scheme, (void*)filename);
+}
+
 int ic_read(void *context, char *buffer, int len)
 {
   ic_doc_context *ic_doc;
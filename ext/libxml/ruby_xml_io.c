@@ -2,31 +2,461 @@
 
 #include "ruby_libxml.h"
 
-static ID READ_METHOD;
-#ifdef HAVE_RB_IO_BUFWRITE
 #include <ruby/io.h>
-#else
+
+static ID READ_METHOD;
+static ID READPARTIAL_METHOD;
+#ifndef HAVE_RB_IO_BUFWRITE
 static ID WRITE_METHOD;
 #endif /* !HAVE_RB_IO_BUFWRITE */
 
+#if defined(HAVE_UNISTD_H) && !defined(_WIN32)
+#define RXML_IO_FD 1
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef HAVE_MMAP
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif /* HAVE_MMAP */
+
+#define RXML_IO_CHUNK_SIZE 65536
+
+/* State for reading from a Ruby io object.  Calling io.read(len) for
+ every chunk libxml asks for would allocate a new string each time.
+ Instead the io is read chunk_size bytes at a time into one reused
+ string with io.readpartial(chunk_size, buffer), and libxml's requests
+ are served from that string.  Objects that do not implement readpartial
+ fall back to read.
+
+ Regular files are read straight from their file descriptor into a
+ staging buffer, which does not need the GVL at all.  The io object must
+ then not be read by other code while libxml reads from it.
+
+ The io and buffer are registered with the garbage collector until
+ libxml closes the input. */
+typedef struct
+{
+  VALUE io;
+  VALUE buffer;
+  char *data;
+  int fd;
+  int readpartial;
+  size_t chunk_size;
+  size_t length;
+  size_t offset;
+} rxml_io_reader;
+
+/* Returns the :chunk_size option from an options hash, which may be nil */
+size_t rxml_io_chunk_size(VALUE options)
+{
+  VALUE value;
+  long size;
+
+  if (NIL_P(options))
+    return RXML_IO_CHUNK_SIZE;
+
+  Check_Type(options, T_HASH);
+  value = rb_hash_aref(options, ID2SYM(rb_intern("chunk_size")));
+
+  if (NIL_P(value))
+    return RXML_IO_CHUNK_SIZE;
+
+  size = NUM2LONG(value);
+  if (size <= 0 || size > INT_MAX)
+    rb_raise(rb_eArgError, "chunk_size must be between 1 and %d", INT_MAX);
+
+  return (size_t)size;
+}
+
+#ifdef RXML_IO_FD
+/* Returns the file descriptor of io if it is a readable regular file */
+static int rxml_io_file_descriptor(VALUE io)
+{
+  struct stat st;
+  off_t offset;
+  int flags;
+  int fd;
+
+  if (!RB_TYPE_P(io, T_FILE))
+    return -1;
+
+#ifdef HAVE_RB_IO_DESCRIPTOR
+  fd = rb_io_descriptor(io);
+#else
+  {
+    rb_io_t *fptr;
+    GetOpenFile(io, fptr);
+    fd = fptr->fd;
+  }
+#endif
+
+  flags = fcntl(fd, F_GETFL);
+  if (flags < 0 || (flags & O_ACCMODE) == O_WRONLY)
+    return -1;
+
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+    return -1;
+
+  /* Data the io object has already buffered, for example after a call
+     to io.gets, has to be read through it */
+  offset = lseek(fd, 0, SEEK_CUR);
+  if (offset < 0 || NUM2OFFT(rb_funcall(io, rb_intern("pos"), 0)) != offset)
+    return -1;
+
+  return fd;
+}
+#endif /* RXML_IO_FD */
+
+void *rxml_io_input_open(VALUE io, size_t chunk_size)
+{
+  rxml_io_reader *result;
+  VALUE buffer = rb_str_buf_new(0);
+  int readpartial = rb_respond_to(io, READPARTIAL_METHOD);
+  int fd = -1;
+  size_t size = sizeof(rxml_io_reader);
+
+#ifdef RXML_IO_FD
+  fd = rxml_io_file_descriptor(io);
+  if (fd >= 0)
+    size += chunk_size;
+#endif
+
+  /* The staging buffer for file descriptors shares the reader's
+     allocation, so nothing leaks if allocating it raises */
+  result = (rxml_io_reader*) ruby_xmalloc(size);
+  result->io = io;
+  result->buffer = buffer;
+  result->data = (fd >= 0) ? (char*)(result + 1) : NULL;
+  result->fd = fd;
+  result->readpartial = readpartial;
+  result->chunk_size = chunk_size;
+  result->length = 0;
+  result->offset = 0;
+
+  rb_gc_register_address(&result->io);
+  rb_gc_register_address(&result->buffer);
+
+  return result;
+}
+
+static void *rxml_io_input_free(void *context)
+{
+  rxml_io_reader *reader = (rxml_io_reader*) context;
+
+  rb_gc_unregister_address(&reader->io);
+  rb_gc_unregister_address(&reader->buffer);
+  xfree(reader);
+
+  return NULL;
+}
+
+/* Like string inputs, the input of a File may be closed while the GVL
+ is released, see rxml_string_input_close */
+int rxml_io_input_close(void *context)
+{
+  rxml_with_gvl(rxml_io_input_free, context);
+  return 0;
+}
+
+static int rxml_io_copy(rxml_io_reader *reader, char *buffer, int len)
+{
+  const char *data = reader->data ? reader->data : RSTRING_PTR(reader->buffer);
+  size_t size = reader->length - reader->offset;
+
+  if (size > (size_t)len)
+    size = (size_t)len;
+
+  memcpy(buffer, data + reader->offset, size);
+  reader->offset += size;
+
+  return (int)size;
+}
+
+static VALUE rxml_io_read(VALUE data)
+{
+  rxml_io_reader *reader = (rxml_io_reader*) data;
+  VALUE size = SIZET2NUM(reader->chunk_size);
+
+  if (reader->readpartial)
+    return rb_funcall(reader->io, READPARTIAL_METHOD, 2, size, reader->buffer);
+  else
+    return rb_funcall(reader->io, READ_METHOD, 1, size);
+}
+
+static VALUE rxml_io_eof(VALUE data, VALUE error)
+{
+  return Qnil;
+}
+
+/* Reads the next chunk from the io object into the reader's buffer */
+static void *rxml_io_fill(void *data)
+{
+  rxml_io_reader *reader = (rxml_io_reader*) data;
+  VALUE string = rb_rescue2(rxml_io_read, (VALUE)reader, rxml_io_eof, Qnil, rb_eEOFError, (VALUE)0);
+
+  reader->length = 0;
+  reader->offset = 0;
+
+  if (NIL_P(string))
+    return NULL;
+
+  StringValue(string);
+
+  if (string != reader->buffer)
+  {
+    rb_str_resize(reader->buffer, RSTRING_LEN(string));
+    memcpy(RSTRING_PTR(reader->buffer), RSTRING_PTR(string), RSTRING_LEN(string));
+  }
+
+  reader->length = RSTRING_LEN(reader->buffer);
+  return NULL;
+}
+
 /* This method is called by libxml when it wants to read
  more data from a stream. We go with the duck typing
- solution to support StringIO objects. */
+ solution to support StringIO objects.  Like io.read(len), it only
+ returns less than libxml asked for at the end of the stream, since
+ libxml does not cope well with short reads. */
 int rxml_read_callback(void *context, char *buffer, int len)
 {
-  VALUE io = (VALUE) context;
-  VALUE string = rb_funcall(io, READ_METHOD, 1, INT2NUM(len));
+  rxml_io_reader *reader = (rxml_io_reader*) context;
+  int result = 0;
+
+  while (result < len)
+  {
+    if (reader->offset == reader->length)
+    {
+      rxml_with_gvl(rxml_io_fill, reader);
+
+      if (rxml_gvl_pending_p())
+        return -1;
+      if (reader->length == 0)
+        break;
+    }
+
+    result += rxml_io_copy(reader, buffer + result, len - result);
+  }
+
+  return result;
+}
+
+#ifdef RXML_IO_FD
+typedef struct
+{
+  int fd;
+  char *data;
   size_t size;
+  ssize_t result;
+  int error;
+} rxml_io_fd_read;
+
+static void *rxml_io_fd_read_func(void *data)
+{
+  rxml_io_fd_read *args = (rxml_io_fd_read*) data;
+
+  do
+  {
+    args->result = read(args->fd, args->data, args->size);
+  }
+  while (args->result < 0 && errno == EINTR);
+
+  args->error = errno;
+  return NULL;
+}
+
+static void *rxml_io_fd_error(void *data)
+{
+  rb_syserr_fail(*(int*)data, NULL);
+  return NULL;
+}
+
+/* Reads a regular file directly from its file descriptor.  This runs
+ without the GVL, releasing it for the read if the caller holds it. */
+static int rxml_fd_read_callback(void *context, char *buffer, int len)
+{
+  rxml_io_reader *reader = (rxml_io_reader*) context;
+  int result = 0;
+
+  while (result < len)
+  {
+    if (reader->offset == reader->length)
+    {
+      rxml_io_fd_read args = {reader->fd, reader->data, reader->chunk_size, 0, 0};
+
+      if (rxml_gvl_released_p())
+        rxml_io_fd_read_func(&args);
+      else
+        rxml_without_gvl(rxml_io_fd_read_func, &args, NULL, NULL);
+
+      if (args.result < 0)
+      {
+        rxml_with_gvl(rxml_io_fd_error, &args.error);
+        return -1;
+      }
+
+      reader->length = (size_t)args.result;
+      reader->offset = 0;
+
+      if (reader->length == 0)
+        break;
+    }
+
+    result += rxml_io_copy(reader, buffer + result, len - result);
+  }
+
+  return result;
+}
+#endif /* RXML_IO_FD */
+
+/* Returns the read callback to use with a reader created by rxml_io_input_open */
+xmlInputReadCallback rxml_io_input_callback(void *context)
+{
+#ifdef RXML_IO_FD
+  if (((rxml_io_reader*) context)->data)
+    return rxml_fd_read_callback;
+#endif
+  return rxml_read_callback;
+}
+
+/* Reads from a block of memory owned by the bindings.  Unlike an
+ input buffer created with xmlParserInputBufferCreateMem, libxml does
+ not copy the whole block up front.  Instead it reads it in chunks,
+ keeping only a small window of the input in its own buffers. */
+int rxml_memory_read_callback(void *context, char *buffer, int len)
+{
+  rxml_memory_reader *reader = (rxml_memory_reader*) context;
+  size_t size = reader->length - reader->offset;
 
-  if (string == Qnil)
-    return 0;
+  if (size > (size_t)len)
+    size = (size_t)len;
 
-  size = RSTRING_LEN(string);
-  memcpy(buffer, StringValuePtr(string), size);
+  memcpy(buffer, reader->data + reader->offset, size);
+  reader->offset += size;
 
   return (int)size;
 }
 
+/* Reads directly from the bytes of a Ruby string.  Frozen strings are
+ used as is.  Other strings are replaced by a frozen, copy-on-write view,
+ so later changes to the original do not affect what libxml reads.
+ The string is registered with the garbage collector, which keeps it
+ alive and in place until libxml closes the input. */
+typedef struct
+{
+  rxml_memory_reader reader;
+  VALUE string;
+} rxml_string_reader;
+
+void *rxml_string_input_open(VALUE string)
+{
+  rxml_string_reader *result = ALLOC(rxml_string_reader);
+
+  result->string = rb_str_new_frozen(string);
+  result->reader.data = RSTRING_PTR(result->string);
+  result->reader.length = RSTRING_LEN(result->string);
+  result->reader.offset = 0;
+  rb_gc_register_address(&result->string);
+
+  return result;
+}
+
+static void *rxml_string_input_free(void *context)
+{
+  rxml_string_reader *reader = (rxml_string_reader*) context;
+
+  rb_gc_unregister_address(&reader->string);
+  xfree(reader);
+
+  return NULL;
+}
+
+/* libxml also closes the input when it halts the parser, for example
+ because the document is nested too deeply.  That can happen while the
+ GVL is released, so reacquire it to unregister the string. */
+int rxml_string_input_close(void *context)
+{
+  rxml_with_gvl(rxml_string_input_free, context);
+  return 0;
+}
+
+#ifdef HAVE_MMAP
+/* Maps a file into memory so libxml can read it directly from the
+ page cache.  The mapping is read sequentially, so tell the kernel to
+ read ahead aggressively and to drop pages once they have been read.
+ Returns NULL and sets errno on failure. */
+void *rxml_mmap_input_open(const char *path)
+{
+  rxml_memory_reader *result;
+  struct stat st;
+  void *data = NULL;
+  int error;
+  int fd = open(path, O_RDONLY);
+
+  if (fd < 0)
+    return NULL;
+
+  if (fstat(fd, &st) != 0)
+    goto fail;
+
+  if (!S_ISREG(st.st_mode))
+  {
+    errno = S_ISDIR(st.st_mode) ? EISDIR : EINVAL;
+    goto fail;
+  }
+
+  /* An empty file can not be mapped, libxml will report it as empty instead */
+  if (st.st_size > 0)
+  {
+    data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED)
+      goto fail;
+
+#ifdef HAVE_MADVISE
+    madvise(data, (size_t)st.st_size, MADV_SEQUENTIAL);
+#endif
+  }
+  close(fd);
+
+  result = xmlMalloc(sizeof(rxml_memory_reader));
+  if (!result)
+  {
+    if (data)
+      munmap(data, (size_t)st.st_size);
+    errno = ENOMEM;
+    return NULL;
+  }
+
+  result->data = data;
+  result->length = (size_t)st.st_size;
+  result->offset = 0;
+  return result;
+
+fail:
+  error = errno;
+  close(fd);
+  errno = error;
+  return NULL;
+}
+
+int rxml_mmap_input_close(void *context)
+{
+  rxml_memory_reader *reader = (rxml_memory_reader*) context;
+
+  if (reader->data)
+    munmap((void*)reader->data, reader->length);
+  xmlFree(reader);
+
+  return 0;
+}
+#endif /* HAVE_MMAP */
+
 int rxml_write_callback(void *context, const char *buffer, int len)
 {
 #ifndef HAVE_RB_IO_BUFWRITE
@@ -45,6 +475,7 @@ int rxml_write_callback(void *context, const char *buffer, int len)
 void rxml_init_io(void)
 {
   READ_METHOD = rb_intern("read");
+  READPARTIAL_METHOD = rb_intern("readpartial");
 #ifndef HAVE_RB_IO_BUFWRITE
   WRITE_METHOD = rb_intern("write");
 #endif /* !HAVE_RB_IO_BUFWRITE */
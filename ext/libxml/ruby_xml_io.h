@@ -3,7 +3,25 @@
 #ifndef __RXML_IO__
 #define __RXML_IO__
 
+typedef struct
+{
+  const char *data;
+  size_t length;
+  size_t offset;
+} rxml_memory_reader;
+
 int rxml_read_callback(void *context, char *buffer, int len);
+size_t rxml_io_chunk_size(VALUE options);
+void *rxml_io_input_open(VALUE io, size_t chunk_size);
+int rxml_io_input_close(void *context);
+xmlInputReadCallback rxml_io_input_callback(void *context);
+int rxml_memory_read_callback(void *context, char *buffer, int len);
+void *rxml_string_input_open(VALUE string);
+int rxml_string_input_close(void *context);
+#ifdef HAVE_MMAP
+void *rxml_mmap_input_open(const char *path);
+int rxml_mmap_input_close(void *context);
+#endif
 int rxml_write_callback(void *context, const char *buffer, int len);
 void rxml_init_io(void);
 
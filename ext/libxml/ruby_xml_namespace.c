@@ -52,6 +52,7 @@ static VALUE rxml_namespace_initialize(VALUE self, VALUE node, VALUE prefix,
 
   Check_Type(node, T_DATA);
   Data_Get_Struct(node, xmlNode, xnode);
+  rxml_document_modify(xnode->doc);
 
   /* Prefix can be null - that means its the default namespace */
   xmlPrefix = NIL_P(prefix) ? NULL : (xmlChar *)StringValuePtr(prefix);
@@ -60,6 +61,8 @@ static VALUE rxml_namespace_initialize(VALUE self, VALUE node, VALUE prefix,
   if (!xns)
     rxml_raise(&xmlLastError);
 
+  rxml_document_xpath_invalidate(xnode->doc);
+
   DATA_PTR(self) = xns;
   return self;
 }
@@ -258,6 +258,7 @@ static VALUE rxml_namespaces_namespace_set(VALUE self, VALUE ns)
   Check_Type(ns, T_DATA);
   Data_Get_Struct(ns, xmlNs, xns);
 
+  rxml_document_modify(xnode->doc);
   xmlSetNs(xnode, xns);
   return self;
 }
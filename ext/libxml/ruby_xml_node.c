@@ -4,6 +4,12 @@
 
 VALUE cXMLNode;
 
+static ID OWNER_ATTR;
+
+/* Detached nodes up to this many levels below the root of their tree find
+   the root when they are marked, see rxml_node_own */
+#define RXML_NODE_OWNER_DEPTH 32
+
 /* Document-class: LibXML::XML::Node
  *
  * Nodes are the primary objects that make up an XML document.
@@ -35,11 +41,29 @@ VALUE cXMLNode;
  * objects marks its owning document, thereby keeping the Ruby document object
  * alive and thus the xmldoc tree.
  *
+ * Nodes of a tree that does not belong to a document are kept alive by the
+ * Ruby object wrapping the tree's root, which objects wrapping such nodes
+ * find by walking up the tree when they are marked.  So that marking deep
+ * trees does not walk up to the root on every garbage collection, objects
+ * wrapping deeply nested nodes instead store the root's object as their
+ * owner when they are created, and stop walking (see rxml_node_own).
+ * Moving a node from one tree to another, or removing it from its tree,
+ * adds owners rather than replacing them - objects created before the move
+ * still reach the old owner, and from there the new one.
+ *
  * In the sweep phase of the garbage collector, or when a program ends, 
  * there is no order to how Ruby objects are freed. In fact, the ruby document
  * object is almost always freed before any ruby objects that wrap child nodes.
  * However, this is ok because those ruby objects do not have a free function
  * and are no longer in scope (since if they were the document would not be freed).
+ *
+ * A document can also opt into caching its node wrappers (see
+ * XML::Document#node_cache=).  Then the first wrapper created for a node is
+ * stored in the node's _private member, and kept alive by the document, and
+ * returned by later calls so repeated traversals do not allocate.  When the
+ * wrapper is collected its free function clears the back pointer.  When libxml
+ * frees the node first, rxml_node_deregister detaches the wrapper so it is
+ * neither used nor swept against freed memory.
  */
 
 static void rxml_node_free(xmlNodePtr xnode)
@@ -55,18 +79,104 @@ static void rxml_node_free(xmlNodePtr xnode)
   }
 }
 
+static void rxml_node_uncache(xmlNodePtr xnode)
+{
+  // The cached wrapper was collected, remove the back linkage
+  xnode->_private = NULL;
+}
+
+static int rxml_node_cached_p(VALUE node)
+{
+  return RDATA(node)->dfree == (RUBY_DATA_FUNC)rxml_node_uncache;
+}
+
+/* Called by libxml for every node it frees. */
+static void rxml_node_deregister(xmlNodePtr xnode)
+{
+  VALUE node = (VALUE)xnode->_private;
+
+  if (node && xnode->type != XML_DOCUMENT_NODE && xnode->type != XML_HTML_DOCUMENT_NODE &&
+      rxml_node_cached_p(node))
+  {
+    RDATA(node)->dfree = NULL;
+    RDATA(node)->data = NULL;
+  }
+}
+
+static void rxml_node_detach(xmlNodePtr xnode, VALUE node)
+{
+  VALUE current = (VALUE)xnode->_private;
+
+  // Stop a different, cached wrapper from clearing the back linkage
+  if (current && current != node && rxml_node_cached_p(current))
+    RDATA(current)->dfree = NULL;
+}
+
 void rxml_node_manage(xmlNodePtr xnode, VALUE node)
 {
+  rxml_node_detach(xnode, node);
   RDATA(node)->dfree = (RUBY_DATA_FUNC)rxml_node_free;
   xnode->_private = (void*)node;
 }
 
 void rxml_node_unmanage(xmlNodePtr xnode, VALUE node)
 {
+  rxml_node_detach(xnode, node);
   RDATA(node)->dfree = NULL;
   xnode->_private = NULL;
 }
 
+void rxml_node_cache(xmlNodePtr xnode, VALUE node)
+{
+  VALUE cache;
+
+  if (xnode->_private || !xnode->doc)
+    return;
+
+  cache = rxml_document_node_cache(xnode->doc);
+  if (NIL_P(cache))
+    return;
+
+  /* Only cache nodes that libxml reports freeing, declarations inside a
+     DTD are released from hash tables without notification. */
+  switch (xnode->type)
+  {
+    case XML_ELEMENT_NODE:
+    case XML_TEXT_NODE:
+    case XML_CDATA_SECTION_NODE:
+    case XML_ENTITY_REF_NODE:
+    case XML_PI_NODE:
+    case XML_COMMENT_NODE:
+      RDATA(node)->dfree = (RUBY_DATA_FUNC)rxml_node_uncache;
+      xnode->_private = (void*)node;
+      rb_ary_push(cache, node);
+      break;
+    default:
+      break;
+  }
+}
+
+/* Called before a document drops its node cache.  Nothing keeps the cached
+   wrappers alive afterwards, so unlink them from their nodes to stop a
+   collected wrapper from being returned again. */
+void rxml_node_uncache_all(VALUE cache)
+{
+  long i;
+
+  for (i = 0; i < RARRAY_LEN(cache); i++)
+  {
+    VALUE node = rb_ary_entry(cache, i);
+    xmlNodePtr xnode = (xmlNodePtr)DATA_PTR(node);
+
+    if (!rxml_node_cached_p(node))
+      continue;
+
+    if (xnode && xnode->_private == (void*)node)
+      xnode->_private = NULL;
+    RDATA(node)->dfree = NULL;
+  }
+}
+
 xmlNodePtr rxml_node_root(xmlNodePtr xnode)
 {
   xmlNodePtr current = xnode;
@@ -79,8 +189,39 @@ xmlNodePtr rxml_node_root(xmlNodePtr xnode)
   return current;
 }
 
-void rxml_node_mark(xmlNodePtr xnode)
+static void rxml_node_add_owner(VALUE object, VALUE owner)
+{
+  VALUE owners = rb_attr_get(object, OWNER_ATTR);
+
+  if (object == owner || owners == owner)
+    return;
+  else if (NIL_P(owners))
+    rb_ivar_set(object, OWNER_ATTR, owner);
+  else if (TYPE(owners) != T_ARRAY)
+    rb_ivar_set(object, OWNER_ATTR, rb_ary_new3(2, owners, owner));
+  else if (!RTEST(rb_ary_includes(owners, owner)))
+    rb_ary_push(owners, owner);
+}
+
+static VALUE rxml_node_root_object(xmlNodePtr xnode)
+{
+  xmlNodePtr root;
+
+  if (xnode->doc)
+    return Qnil;
+
+  root = rxml_node_root(xnode);
+  return root->_private ? (VALUE)root->_private : Qnil;
+}
+
+/* Marks the wrappers of the node itself and of its document */
+static void rxml_node_mark_owned(xmlNodePtr xnode)
 {
+   /* A wrapper referenced from _private must not be moved by compaction, so
+      it marks (and thereby pins) itself. */
+   if (xnode->_private && xnode->type != XML_DOCUMENT_NODE && xnode->type != XML_HTML_DOCUMENT_NODE)
+     rb_gc_mark((VALUE)xnode->_private);
+
    if (xnode->doc)
    {
      if (xnode->doc->_private)
@@ -89,7 +230,38 @@ void rxml_node_mark(xmlNodePtr xnode)
 	   rb_gc_mark(doc);
 	 }
    }
-   else if (xnode->parent)
+}
+
+/* Makes the Ruby object wrapping xnode keep alive the object wrapping
+   the root of the document-less tree xnode belongs to, if xnode is deep
+   enough that walking up to the root on every mark would be slow.  The
+   object then marks its owner instead of walking. */
+void rxml_node_own(VALUE object, xmlNodePtr xnode)
+{
+  xmlNodePtr root = xnode;
+  int depth = 0;
+
+  if (xnode->doc)
+    return;
+
+  while (root->parent)
+  {
+    root = root->parent;
+    depth++;
+  }
+
+  if (depth <= RXML_NODE_OWNER_DEPTH || !root->_private)
+    return;
+
+  rxml_node_add_owner(object, (VALUE)root->_private);
+  RDATA(object)->dmark = (RUBY_DATA_FUNC)rxml_node_mark_owned;
+}
+
+void rxml_node_mark(xmlNodePtr xnode)
+{
+   rxml_node_mark_owned(xnode);
+
+   if (!xnode->doc && xnode->parent)
    {
      xmlNodePtr root = rxml_node_root(xnode);
      if (root->_private)
@@ -112,12 +284,17 @@ VALUE rxml_node_wrap(xmlNodePtr xnode)
   else
   {
     result = Data_Wrap_Struct(cXMLNode, rxml_node_mark, NULL, xnode);
+    rxml_node_own(result, xnode);
   }
 
   if (!xnode->doc && !xnode->parent)
   {
     rxml_node_manage(xnode, result);
   }
+  else
+  {
+    rxml_node_cache(xnode, result);
+  }
   return result;
 }
 
@@ -302,16 +479,19 @@ static VALUE rxml_node_modify_dom(VALUE self, VALUE target,
                                   xmlNodePtr (*xmlFunc)(xmlNodePtr, xmlNodePtr))
 {
   xmlNodePtr xnode, xtarget, xresult;
+  VALUE root, new_root;
 
   if (rb_obj_is_kind_of(target, cXMLNode) == Qfalse)
     rb_raise(rb_eTypeError, "Must pass an XML::Node object");
 
   xnode = rxml_get_xnode(self);
   xtarget = rxml_get_xnode(target);
+  rxml_document_modify(xnode->doc);
 
   if (xtarget->doc != NULL && xtarget->doc != xnode->doc)
     rb_raise(eXMLError, "Nodes belong to different documents.  You must first import the node by calling XML::Document.import");
 
+  root = rxml_node_root_object(xtarget);
   xmlUnlinkNode(xtarget);
 
   // Target is about to have a parent, so stop having ruby manage it.
@@ -326,6 +506,15 @@ static VALUE rxml_node_modify_dom(VALUE self, VALUE target,
   /* Assume the target was freed, we need to fix up the ruby object to point to the
      newly returned node. */
   RDATA(target)->data = xresult;
+  rxml_node_cache(xresult, target);
+
+  /* Objects created for nodes below the target reach the target's old
+     tree, from there they must now reach its new tree. */
+  new_root = rxml_node_root_object(xresult);
+  if (!NIL_P(root) && root != new_root)
+    rxml_node_add_owner(root, target);
+  if (!NIL_P(new_root) && root != new_root)
+    rxml_node_add_owner(target, new_root);
 
   return target;
 }
@@ -374,6 +563,7 @@ static VALUE rxml_node_base_uri_set(VALUE self, VALUE uri)
   if (xnode->doc == NULL)
     return (Qnil);
 
+  rxml_document_modify(xnode->doc);
   xmlNodeSetBase(xnode, (xmlChar*) StringValuePtr(uri));
   return (Qtrue);
 }
@@ -414,6 +604,7 @@ static VALUE rxml_node_content_set(VALUE self, VALUE content)
 
   Check_Type(content, T_STRING);
   xnode = rxml_get_xnode(self);
+  rxml_document_modify(xnode->doc);
   encoded_content = xmlEncodeSpecialChars(xnode->doc, (xmlChar*) StringValuePtr(content));
   xmlNodeSetContent(xnode, encoded_content);
   xmlFree(encoded_content);
@@ -494,6 +685,7 @@ static VALUE rxml_node_content_add(VALUE self, VALUE obj)
     if (NIL_P(str) || TYPE(str) != T_STRING)
       rb_raise(rb_eTypeError, "invalid argument: must be string or XML::Node");
 
+    rxml_document_modify(xnode->doc);
     xmlNodeAddContent(xnode, (xmlChar*) StringValuePtr(str));
   }
   return self;
@@ -651,6 +843,171 @@ static VALUE rxml_node_each(VALUE self)
   return Qnil;
 }
 
+/* Filter used by the element iterators.  Elements of a parsed
+   document have their names interned in the document's dictionary,
+   so the name is looked up there once and most comparisons become
+   a pointer compare. */
+typedef struct
+{
+  const xmlChar *name;
+  const xmlChar *interned;
+  const xmlChar *href;
+} rxml_element_filter;
+
+/* Sets up the filter.  Name and ns are replaced by frozen strings the
+   filter points into, which the caller must keep alive with RB_GC_GUARD
+   while the filter is used.  They are copies so the block can not free
+   them, for example by changing the strings it passed in. */
+static void rxml_element_filter_init(rxml_element_filter *filter, xmlNodePtr xnode,
+                                     VALUE *name, VALUE *ns)
+{
+  filter->name = NULL;
+  filter->interned = NULL;
+  filter->href = NULL;
+
+  if (!NIL_P(*name))
+  {
+    *name = rb_str_new_frozen(rb_obj_as_string(*name));
+    filter->name = (const xmlChar*)StringValueCStr(*name);
+    if (xnode->doc && xnode->doc->dict)
+      filter->interned = xmlDictExists(xnode->doc->dict, filter->name, -1);
+  }
+
+  if (rb_obj_is_kind_of(*ns, cXMLNamespace))
+  {
+    xmlNsPtr xns;
+    Data_Get_Struct(*ns, xmlNs, xns);
+    filter->href = xns->href;
+  }
+  else if (!NIL_P(*ns))
+  {
+    *ns = rb_str_new_frozen(StringValue(*ns));
+    filter->href = (const xmlChar*)StringValueCStr(*ns);
+  }
+}
+
+static int rxml_element_filter_match(rxml_element_filter *filter, xmlNodePtr xnode)
+{
+  if (xnode->type != XML_ELEMENT_NODE)
+    return 0;
+
+  if (filter->name && xnode->name != filter->interned &&
+      !xmlStrEqual(xnode->name, filter->name))
+    return 0;
+
+  if (filter->href && (!xnode->ns || !xmlStrEqual(xnode->ns->href, filter->href)))
+    return 0;
+
+  return 1;
+}
+
+static VALUE rxml_node_elements(xmlNodePtr xnode, rxml_element_filter *filter)
+{
+  VALUE result = rb_ary_new();
+  xmlNodePtr xcurrent;
+
+  for (xcurrent = xnode->children; xcurrent; xcurrent = xcurrent->next)
+  {
+    if (rxml_element_filter_match(filter, xcurrent))
+      rb_ary_push(result, rxml_node_wrap(xcurrent));
+  }
+  return result;
+}
+
+/*
+ * call-seq:
+ *    node.each_element {|element| ... } -> nil
+ *    node.each_element(name) {|element| ... } -> nil
+ *    node.each_element(name, :ns => href) {|element| ... } -> nil
+ *
+ * Iterates over this node's child elements (nodes
+ * that have a node_type == ELEMENT_NODE).  If a name is given
+ * only elements with that local name are yielded, and the :ns
+ * option restricts them to a namespace (given as an href or an
+ * XML::Namespace).  Other nodes are skipped without being
+ * wrapped.  Returns an Enumerator if no block is given.
+ *
+ *  doc = XML::Document.new('model/books.xml')
+ *  doc.root.each_element {|element| puts element}
+ *  doc.root.each_element('book') {|book| puts book}
+ */
+static VALUE rxml_node_each_element(int argc, VALUE *argv, VALUE self)
+{
+  VALUE name, options, ns = Qnil;
+  rxml_element_filter filter;
+  xmlNodePtr xnode;
+  xmlNodePtr xcurrent;
+
+  RETURN_ENUMERATOR(self, argc, argv);
+
+  rb_scan_args(argc, argv, "02", &name, &options);
+  if (!NIL_P(options))
+  {
+    Check_Type(options, T_HASH);
+    ns = rb_hash_aref(options, ID2SYM(rb_intern("ns")));
+  }
+
+  xnode = rxml_get_xnode(self);
+  rxml_element_filter_init(&filter, xnode, &name, &ns);
+
+  xcurrent = xnode->children;
+  while (xcurrent)
+  {
+    /* The user could remove this node, so first stash
+       away the next node. */
+    xmlNodePtr xnext = xcurrent->next;
+
+    if (rxml_element_filter_match(&filter, xcurrent))
+      rb_yield(rxml_node_wrap(xcurrent));
+    xcurrent = xnext;
+  }
+
+  RB_GC_GUARD(name);
+  RB_GC_GUARD(ns);
+  return Qnil;
+}
+
+/*
+ * call-seq:
+ *    node.element_children -> [XML::Node]
+ *
+ * Returns this node's child elements, skipping text, comment
+ * and other non-element nodes.
+ */
+static VALUE rxml_node_element_children(VALUE self)
+{
+  rxml_element_filter filter;
+  xmlNodePtr xnode = rxml_get_xnode(self);
+  VALUE name = Qnil, ns = Qnil;
+
+  rxml_element_filter_init(&filter, xnode, &name, &ns);
+  return rxml_node_elements(xnode, &filter);
+}
+
+/*
+ * call-seq:
+ *    node.children_named(name) -> [XML::Node]
+ *
+ * Returns this node's child elements with the given local name.
+ *
+ *  doc = XML::Document.new('model/books.xml')
+ *  doc.root.children_named('book')
+ */
+static VALUE rxml_node_children_named(VALUE self, VALUE name)
+{
+  rxml_element_filter filter;
+  xmlNodePtr xnode = rxml_get_xnode(self);
+  VALUE ns = Qnil;
+  VALUE result;
+
+  Check_Type(name, T_STRING);
+  rxml_element_filter_init(&filter, xnode, &name, &ns);
+  result = rxml_node_elements(xnode, &filter);
+
+  RB_GC_GUARD(name);
+  return result;
+}
+
 /*
  * call-seq:
  *    node.empty? -> (true|false)
@@ -732,6 +1089,7 @@ static VALUE rxml_node_lang_set(VALUE self, VALUE lang)
 
   Check_Type(lang, T_STRING);
   xnode = rxml_get_xnode(self);
+  rxml_document_modify(xnode->doc);
   xmlNodeSetLang(xnode, (xmlChar*) StringValuePtr(lang));
 
   return (Qtrue);
@@ -914,6 +1272,7 @@ static VALUE rxml_node_name_set(VALUE self, VALUE name)
 
   Check_Type(name, T_STRING);
   xnode = rxml_get_xnode(self);
+  rxml_document_modify(xnode->doc);
   xname = (const xmlChar*)StringValuePtr(name);
 
 	/* Note: calling xmlNodeSetName() for a text node is ignored by libXML. */
@@ -1109,6 +1468,14 @@ static VALUE rxml_node_property_set(VALUE self, VALUE name, VALUE value)
 static VALUE rxml_node_remove_ex(VALUE self)
 {
   xmlNodePtr xnode = rxml_get_xnode(self);
+  VALUE root;
+
+  rxml_document_modify(xnode->doc);
+  root = rxml_node_root_object(xnode);
+
+  // Objects wrapping nodes below this one must keep it alive
+  if (!NIL_P(root))
+    rxml_node_add_owner(root, self);
  
   // Now unlink the node from its parent
   xmlUnlinkNode(xnode);
@@ -1206,6 +1573,7 @@ static VALUE rxml_node_output_escaping_set(VALUE self, VALUE value)
 
   switch (xnode->type) {
   case XML_TEXT_NODE:
+    rxml_document_modify(xnode->doc);
     xnode->name = (value != Qfalse && value != Qnil) ? xmlStringText : xmlStringTextNoenc;
     break;
   case XML_ELEMENT_NODE:
@@ -1213,6 +1581,7 @@ static VALUE rxml_node_output_escaping_set(VALUE self, VALUE value)
     {
       const xmlChar *name = (value != Qfalse && value != Qnil) ? xmlStringText : xmlStringTextNoenc;
       xmlNodePtr tmp;
+      rxml_document_modify(xnode->doc);
       for (tmp = xnode->children; tmp; tmp = tmp->next)
         if (tmp->type == XML_TEXT_NODE)
           tmp->name = name;
@@ -1249,6 +1618,7 @@ static VALUE rxml_node_space_preserve_set(VALUE self, VALUE value)
 {
   xmlNodePtr xnode;
   xnode = rxml_get_xnode(self);
+  rxml_document_modify(xnode->doc);
 
   if (value == Qfalse)
     xmlNodeSetSpacePreserve(xnode, 0);
@@ -1298,6 +1668,14 @@ static VALUE rxml_node_copy(VALUE self, VALUE deep)
 
 void rxml_init_node(void)
 {
+  /* Libxml keeps these per thread, set both the default for new threads
+     and the value for this one. */
+  xmlThrDefDeregisterNodeDefault((xmlDeregisterNodeFunc)rxml_node_deregister);
+  xmlDeregisterNodeDefault((xmlDeregisterNodeFunc)rxml_node_deregister);
+
+  /* Not prefixed with @ so owners are hidden from inspect */
+  OWNER_ATTR = rb_intern("owner");
+
   cXMLNode = rb_define_class_under(mXML, "Node", rb_cObject);
 
   rb_define_const(cXMLNode, "SPACE_DEFAULT", INT2NUM(0));
@@ -1355,6 +1733,9 @@ void rxml_init_node(void)
   rb_include_module(cXMLNode, rb_mEnumerable);
   rb_define_method(cXMLNode, "[]", rxml_node_attribute_get, 1);
   rb_define_method(cXMLNode, "each", rxml_node_each, 0);
+  rb_define_method(cXMLNode, "each_element", rxml_node_each_element, -1);
+  rb_define_method(cXMLNode, "element_children", rxml_node_element_children, 0);
+  rb_define_method(cXMLNode, "children_named", rxml_node_children_named, 1);
   rb_define_method(cXMLNode, "first", rxml_node_first_get, 0);
   rb_define_method(cXMLNode, "last", rxml_node_last_get, 0);
   rb_define_method(cXMLNode, "next", rxml_node_next_get, 0);
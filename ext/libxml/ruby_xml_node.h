@@ -7,7 +7,10 @@ extern VALUE cXMLNode;
 
 void rxml_init_node(void);
 void rxml_node_mark(xmlNodePtr xnode);
+void rxml_node_own(VALUE object, xmlNodePtr xnode);
 VALUE rxml_node_wrap(xmlNodePtr xnode);
 void rxml_node_manage(xmlNodePtr xnode, VALUE node);
 void rxml_node_unmanage(xmlNodePtr xnode, VALUE node);
+void rxml_node_cache(xmlNodePtr xnode, VALUE node);
+void rxml_node_uncache_all(VALUE cache);
 #endif
@@ -3,6 +3,13 @@
 #include <stdarg.h>
 #include "ruby_libxml.h"
 
+#ifdef HAVE_PTHREAD_CREATE
+#include <pthread.h>
+#endif
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
 /*
  * Document-class: LibXML::XML::Parser
  *
@@ -23,11 +30,14 @@
  *
  * You can also parse documents (see XML::Parser.document), 
  * strings (see XML::Parser.string) and io objects (see
- * XML::Parser.io).
+ * XML::Parser.io).  Data that arrives in pieces, for example
+ * from a socket, can be fed to the parser as it is received
+ * (see XML::Parser.push).
  */
 
 VALUE cXMLParser;
 static ID CONTEXT_ATTR;
+static ID DICTIONARY_ATTR;
 
 /*
  * call-seq:
@@ -51,6 +61,378 @@ static VALUE rxml_parser_initialize(int argc, VALUE *argv, VALUE self)
   return self;
 }
 
+/* Parsing without the GVL.
+ *
+ * Contexts created from strings, files and documents do not call back into
+ * Ruby to read their input, so they are parsed with the GVL released.  That
+ * lets other Ruby threads run, including other threads that are parsing.
+ * The same is true for chunks fed to push contexts.
+ *
+ * To support Thread#raise, Thread#kill and signal handlers, pending
+ * interrupts are checked each time the parser reads more input.  Input
+ * that is already in memory is not read in pieces, so they are also
+ * checked each time an element or text is reported.  For that the input's
+ * read callback and the context's SAX handler are temporarily wrapped.
+ * The wrappers find the parse in a thread local variable, so they work
+ * whatever user data the SAX handler is called with.  If an interrupt
+ * raises, the parser is stopped, the partial document is freed and the
+ * exception is rethrown once the GVL is held again.
+ *
+ * While a context is parsed it is marked busy, see
+ * rxml_parser_context_busy_p, and parsing it from another thread at the
+ * same time raises instead of corrupting the context. */
+
+typedef struct rxml_parser_parse_data
+{
+  xmlParserCtxtPtr ctxt;
+  int status;
+  /* Input for push contexts */
+  int push;
+  const char *chunk;
+  size_t size;
+  int terminate;
+  /* Set by the unblocking function.  Batches share one flag between
+     their workers and simply stop parsing when it is set. */
+  volatile int *interrupted;
+  volatile int interrupt;
+  int cancel;
+  int stopped;
+  int hooked;
+  startElementNsSAX2Func startElementNs;
+  startElementSAXFunc startElement;
+  charactersSAXFunc characters;
+  xmlStructuredErrorFunc serror;
+  xmlParserInputBufferPtr buffer;
+  xmlInputReadCallback readcallback;
+  struct rxml_parser_parse_data *previous;
+} rxml_parser_parse_data;
+
+static RXML_THREAD_LOCAL rxml_parser_parse_data *rxml_parser_current = NULL;
+
+static void *rxml_parser_check_ints(void *data)
+{
+  rb_thread_check_ints();
+  return NULL;
+}
+
+/* Returns 1 if the parse must stop */
+static int rxml_parser_interrupted(rxml_parser_parse_data *data)
+{
+  if (*data->interrupted)
+  {
+    if (data->cancel)
+    {
+      data->stopped = 1;
+      return 1;
+    }
+
+    *data->interrupted = 0;
+    rxml_with_gvl(rxml_parser_check_ints, NULL);
+  }
+
+  return rxml_gvl_pending_p();
+}
+
+static void rxml_parser_ignore_error(void *data, xmlErrorPtr xerror)
+{
+}
+
+/* Stops the parser without calling xmlStopParser.  That frees the input,
+   which runs its close callback without the GVL and, from the read
+   callback, frees the buffer being read.  The parser only checks these
+   flags instead, and the input is freed later when the context is closed
+   or freed.  Errors reported on the way out are of no interest. */
+static void rxml_parser_halt(rxml_parser_parse_data *data)
+{
+  data->ctxt->instate = XML_PARSER_EOF;
+  data->ctxt->disableSAX = 2;
+  if (data->hooked)
+    data->ctxt->sax->serror = rxml_parser_ignore_error;
+}
+
+static void rxml_parser_check_interrupts(rxml_parser_parse_data *data)
+{
+  if (rxml_parser_interrupted(data))
+    rxml_parser_halt(data);
+}
+
+static int rxml_parser_read(void *context, char *buffer, int len)
+{
+  rxml_parser_parse_data *data = rxml_parser_current;
+
+  if (rxml_parser_interrupted(data))
+  {
+    /* The parser then reports the input as truncated */
+    rxml_parser_halt(data);
+    return -1;
+  }
+
+  return data->readcallback(context, buffer, len);
+}
+
+static void rxml_parser_start_element_ns(void *ctx, const xmlChar *localname, const xmlChar *prefix,
+                                         const xmlChar *URI, int nb_namespaces, const xmlChar **namespaces,
+                                         int nb_attributes, int nb_defaulted, const xmlChar **attributes)
+{
+  rxml_parser_parse_data *data = rxml_parser_current;
+
+  data->startElementNs(ctx, localname, prefix, URI, nb_namespaces, namespaces,
+                       nb_attributes, nb_defaulted, attributes);
+  rxml_parser_check_interrupts(data);
+}
+
+static void rxml_parser_start_element(void *ctx, const xmlChar *name, const xmlChar **atts)
+{
+  rxml_parser_parse_data *data = rxml_parser_current;
+
+  data->startElement(ctx, name, atts);
+  rxml_parser_check_interrupts(data);
+}
+
+static void rxml_parser_characters(void *ctx, const xmlChar *ch, int len)
+{
+  rxml_parser_parse_data *data = rxml_parser_current;
+
+  data->characters(ctx, ch, len);
+  rxml_parser_check_interrupts(data);
+}
+
+static void rxml_parser_parse_chunks(rxml_parser_parse_data *parse)
+{
+  const char *chunk = parse->chunk;
+  size_t size = parse->size;
+
+  /* xmlParseChunk takes an int length */
+  do
+  {
+    int length = (size > INT_MAX) ? INT_MAX : (int)size;
+    size -= length;
+
+    parse->status = xmlParseChunk(parse->ctxt, chunk, length, parse->terminate && size == 0);
+    chunk += length;
+  }
+  while (size > 0 && parse->ctxt->instate != XML_PARSER_EOF);
+}
+
+static void *rxml_parser_parse_document(void *data)
+{
+  rxml_parser_parse_data *parse = (rxml_parser_parse_data*)data;
+
+  if (parse->push)
+    rxml_parser_parse_chunks(parse);
+  else
+    parse->status = xmlParseDocument(parse->ctxt);
+
+  return NULL;
+}
+
+static void rxml_parser_interrupt(void *data)
+{
+  *((rxml_parser_parse_data*)data)->interrupted = 1;
+}
+
+/* Contexts created by XML::Parser::Context.io read their input by calling
+   the io object's readpartial method and therefore need the GVL.  Regular
+   files are read by file descriptor instead and do not. */
+static int rxml_parser_ruby_input_p(xmlParserCtxtPtr ctxt)
+{
+  return (ctxt->input && ctxt->input->buf &&
+          ctxt->input->buf->readcallback == (xmlInputReadCallback)rxml_read_callback);
+}
+
+/* Dictionaries shared through XML::Dictionary are not thread safe, so
+   contexts that use one are parsed holding the GVL as well. */
+static int rxml_parser_shared_dict_p(VALUE context)
+{
+  return rb_ivar_get(context, DICTIONARY_ATTR) != Qnil;
+}
+
+static void rxml_parser_hook(rxml_parser_parse_data *data)
+{
+  xmlParserCtxtPtr ctxt = data->ctxt;
+  xmlSAXHandlerPtr sax = ctxt->sax;
+  xmlParserInputBufferPtr buffer = ctxt->input ? ctxt->input->buf : NULL;
+
+  /* Parses may nest, for example in an XML::InputCallbacks scheme */
+  data->previous = rxml_parser_current;
+  rxml_parser_current = data;
+
+  if (buffer && buffer->readcallback)
+  {
+    data->buffer = buffer;
+    data->readcallback = buffer->readcallback;
+    buffer->readcallback = rxml_parser_read;
+  }
+
+  /* Never modify libxml's shared default handler */
+  if (!sax || sax == (xmlSAXHandlerPtr)&xmlDefaultSAXHandler)
+    return;
+
+  data->startElementNs = sax->startElementNs;
+  data->startElement = sax->startElement;
+  data->characters = sax->characters;
+  data->serror = sax->serror;
+
+  if (sax->startElementNs)
+    sax->startElementNs = rxml_parser_start_element_ns;
+  if (sax->startElement)
+    sax->startElement = rxml_parser_start_element;
+  if (sax->characters)
+    sax->characters = rxml_parser_characters;
+
+  data->hooked = 1;
+}
+
+static void rxml_parser_unhook(rxml_parser_parse_data *data)
+{
+  xmlParserCtxtPtr ctxt = data->ctxt;
+  xmlSAXHandlerPtr sax = ctxt->sax;
+
+  rxml_parser_current = data->previous;
+
+  /* The buffer is gone if libxml halted the parser, and libxml replaces
+     the callback once the input is exhausted */
+  if (data->buffer && ctxt->input && ctxt->input->buf == data->buffer &&
+      data->buffer->readcallback == rxml_parser_read)
+    data->buffer->readcallback = data->readcallback;
+  data->buffer = NULL;
+
+  if (!data->hooked)
+    return;
+
+  sax->startElementNs = data->startElementNs;
+  sax->startElement = data->startElement;
+  sax->characters = data->characters;
+  sax->serror = data->serror;
+
+  data->hooked = 0;
+}
+
+static int rxml_parser_run_without_gvl(rxml_parser_parse_data *data)
+{
+  data->interrupted = &data->interrupt;
+
+  rxml_parser_hook(data);
+  rxml_without_gvl(rxml_parser_parse_document, data, rxml_parser_interrupt, data);
+  rxml_parser_unhook(data);
+
+  return data->status;
+}
+
+static int rxml_parser_parse_without_gvl(xmlParserCtxtPtr ctxt)
+{
+  rxml_parser_parse_data data;
+
+  memset(&data, 0, sizeof(data));
+  data.ctxt = ctxt;
+
+  return rxml_parser_run_without_gvl(&data);
+}
+
+static int rxml_parser_push(VALUE context, xmlParserCtxtPtr ctxt, const char *chunk, size_t size, int terminate)
+{
+  rxml_parser_parse_data data;
+
+  memset(&data, 0, sizeof(data));
+  data.ctxt = ctxt;
+  data.push = 1;
+  data.chunk = chunk;
+  data.size = size;
+  data.terminate = terminate;
+
+  if (rxml_parser_shared_dict_p(context))
+  {
+    rxml_parser_parse_chunks(&data);
+    return data.status;
+  }
+
+  return rxml_parser_run_without_gvl(&data);
+}
+
+/* Frees the partial document and rethrows the exception raised
+   by an interrupt or callback while the GVL was released. */
+static void rxml_parser_raise_pending(VALUE context, xmlParserCtxtPtr ctxt)
+{
+  if (rxml_gvl_pending_p())
+  {
+    xmlFreeDoc(ctxt->myDoc);
+    ctxt->myDoc = NULL;
+    rb_funcall(context, rb_intern("close"), 0);
+    rxml_gvl_raise_pending();
+  }
+}
+
+static void rxml_parser_register_ids(xmlDocPtr xdoc, VALUE id_attribute)
+{
+  if (!NIL_P(id_attribute))
+    rxml_document_index_ids(xdoc, (const xmlChar*)StringValueCStr(id_attribute));
+}
+
+static VALUE rxml_parser_result(VALUE context, xmlParserCtxtPtr ctxt, int status)
+{
+  xmlDocPtr xdoc;
+  VALUE document;
+
+  rxml_parser_raise_pending(context, ctxt);
+
+  if ((status == -1 || !ctxt->wellFormed) && ! ctxt->recovery)
+  {
+    rxml_raise(&ctxt->lastError);
+  }
+
+  rb_funcall(context, rb_intern("close"), 0);
+
+  /* The document now belongs to Ruby, so make sure the context does not
+     free it if it is reset */
+  xdoc = ctxt->myDoc;
+  ctxt->myDoc = NULL;
+
+  document = rxml_document_wrap(xdoc);
+  rxml_parser_register_ids(xdoc, rb_funcall(context, rb_intern("id_attribute"), 0));
+
+  return document;
+}
+
+static VALUE rxml_parser_release(VALUE value)
+{
+  xmlParserCtxtPtr ctxt = (xmlParserCtxtPtr)value;
+  ctxt->_private = NULL;
+  return Qnil;
+}
+
+/* Calls func with the parser's context marked busy.  Parsing releases the
+   GVL, or calls Ruby to read an io, so another thread could otherwise
+   start parsing the same context in the meantime. */
+static VALUE rxml_parser_exclusive(VALUE self, VALUE (*func)(VALUE), VALUE arg)
+{
+  xmlParserCtxtPtr ctxt;
+  VALUE context = rb_ivar_get(self, CONTEXT_ATTR);
+
+  TypedData_Get_Struct(context, xmlParserCtxt, &rxml_parser_context_data_type, ctxt);
+
+  if (rxml_parser_context_busy_p(ctxt))
+    rb_raise(rb_eRuntimeError, "The parser context is already being parsed");
+
+  ctxt->_private = ctxt;
+  return rb_ensure(func, arg, rxml_parser_release, (VALUE)ctxt);
+}
+
+static VALUE rxml_parser_parse_exclusive(VALUE self)
+{
+  xmlParserCtxtPtr ctxt;
+  int status;
+  VALUE context = rb_ivar_get(self, CONTEXT_ATTR);
+  
+  TypedData_Get_Struct(context, xmlParserCtxt, &rxml_parser_context_data_type, ctxt);
+
+  if (rxml_parser_ruby_input_p(ctxt) || rxml_parser_shared_dict_p(context))
+    status = xmlParseDocument(ctxt);
+  else
+    status = rxml_parser_parse_without_gvl(ctxt);
+
+  return rxml_parser_result(context, ctxt, status);
+}
+
 /*
  * call-seq:
  *    parser.parse -> XML::Document
@@ -58,22 +440,483 @@ static VALUE rxml_parser_initialize(int argc, VALUE *argv, VALUE self)
  * Parse the input XML and create an XML::Document with
  * it's content. If an error occurs, XML::Parser::ParseError
  * is thrown.
+ *
+ * Unless the parser reads from a Ruby io object or uses a
+ * shared XML::Dictionary, parsing happens without holding
+ * Ruby's global VM lock so other threads continue to run
+ * while a document is parsed.  A context can only be parsed
+ * by one thread at a time, parsing it while another thread
+ * does raises a RuntimeError.
  */
 static VALUE rxml_parser_parse(VALUE self)
 {
+  return rxml_parser_exclusive(self, rxml_parser_parse_exclusive, self);
+}
+
+static VALUE rxml_parser_feed_exclusive(VALUE value)
+{
+  VALUE *args = (VALUE*)value;
+  VALUE self = args[0];
+  VALUE chunk = args[1];
   xmlParserCtxtPtr ctxt;
   VALUE context = rb_ivar_get(self, CONTEXT_ATTR);
-  
-  Data_Get_Struct(context, xmlParserCtxt, ctxt);
 
-  if ((xmlParseDocument(ctxt) == -1 || !ctxt->wellFormed) && ! ctxt->recovery)
+  TypedData_Get_Struct(context, xmlParserCtxt, &rxml_parser_context_data_type, ctxt);
+
+  /* Keep other threads from modifying the chunk while it is parsed */
+  rb_str_locktmp(chunk);
+  rxml_parser_push(context, ctxt, RSTRING_PTR(chunk), RSTRING_LEN(chunk), 0);
+  rb_str_unlocktmp(chunk);
+
+  rxml_parser_raise_pending(context, ctxt);
+
+  if (!ctxt->wellFormed && !ctxt->recovery)
   {
     rxml_raise(&ctxt->lastError);
   }
 
-  rb_funcall(context, rb_intern("close"), 0);
+  return self;
+}
+
+/*
+ * call-seq:
+ *    parser.feed(chunk) -> XML::Parser
+ *
+ * Parses the next chunk of xml for a parser created from a
+ * push context (see XML::Parser::Context.push).  Chunks may
+ * be split anywhere, including in the middle of a tag or a
+ * multibyte character.  Once all the input has been fed,
+ * call XML::Parser#finish to obtain the document.
+ *
+ * Raises an XML::Error as soon as the input is known to be
+ * malformed, unless the context is in recovery mode.
+ */
+static VALUE rxml_parser_feed(VALUE self, VALUE chunk)
+{
+  VALUE args[2];
 
-  return rxml_document_wrap(ctxt->myDoc);
+  StringValue(chunk);
+  args[0] = self;
+  args[1] = chunk;
+
+  return rxml_parser_exclusive(self, rxml_parser_feed_exclusive, (VALUE)args);
+}
+
+static VALUE rxml_parser_finish_exclusive(VALUE self)
+{
+  xmlParserCtxtPtr ctxt;
+  int status;
+  VALUE context = rb_ivar_get(self, CONTEXT_ATTR);
+
+  TypedData_Get_Struct(context, xmlParserCtxt, &rxml_parser_context_data_type, ctxt);
+  status = rxml_parser_push(context, ctxt, NULL, 0, 1);
+
+  return rxml_parser_result(context, ctxt, status);
+}
+
+/*
+ * call-seq:
+ *    parser.finish -> XML::Document
+ *
+ * Tells a parser created from a push context that all
+ * the input has been fed (see XML::Parser#feed) and returns
+ * the parsed XML::Document.  If the document is incomplete
+ * or malformed, an XML::Error is raised.
+ */
+static VALUE rxml_parser_finish(VALUE self)
+{
+  return rxml_parser_exclusive(self, rxml_parser_finish_exclusive, self);
+}
+
+/* Batch parsing.
+ *
+ * XML::Parser.parse_many parses a list of sources on a pool of native
+ * threads while the GVL is released, with the calling thread working
+ * alongside the pool.  Ruby may move or modify strings once the GVL is
+ * released, so string sources are copied up front.  Libxml then reads them
+ * in chunks rather than copying them again, so memory use stays close to
+ * that of XML::Parser.string.  Documents are
+ * wrapped, and errors turned into XML::Error objects, only after every
+ * parse has finished and the GVL is held again.
+ *
+ * Workers are not Ruby threads, so nothing may call back into Ruby while
+ * a batch is parsed.  Errors are collected instead of reported, and
+ * XML::InputCallbacks schemes are not consulted when loading external
+ * entities or DTDs, on the calling thread as well so that the result does
+ * not depend on which thread parsed a source.
+ *
+ * If the calling thread is interrupted, the workers abandon the documents
+ * they are parsing.  Should the interrupt not raise (for example a signal
+ * handler ran), the abandoned sources are parsed again. */
+
+typedef struct
+{
+  char *path;
+  char *data;
+  rxml_memory_reader reader;
+  int done;
+  xmlDocPtr doc;
+  xmlError error;
+} rxml_parser_batch_item;
+
+typedef struct
+{
+  rxml_parser_batch_item *items;
+  long count;
+  long next;
+  int threads;
+  int options;
+  volatile int cancelled;
+  xmlMutexPtr mutex;
+} rxml_parser_batch;
+
+static void rxml_parser_batch_error(void *data, xmlErrorPtr xerror)
+{
+  /* Errors are returned by parse_many instead of being reported
+     to XML::Error's handler, which would need the GVL. */
+}
+
+static xmlParserCtxtPtr rxml_parser_batch_context(rxml_parser_batch *batch, rxml_parser_batch_item *item)
+{
+  xmlParserCtxtPtr ctxt = xmlNewParserCtxt();
+  xmlParserInputBufferPtr buffer;
+  xmlParserInputPtr input = NULL;
+
+  if (!ctxt)
+  {
+    xmlCopyError(xmlGetLastError(), &item->error);
+    return NULL;
+  }
+
+  ctxt->sax->serror = rxml_parser_batch_error;
+
+  if (item->path)
+  {
+    input = xmlLoadExternalEntity(item->path, NULL, ctxt);
+  }
+  else
+  {
+    item->reader.offset = 0;
+    buffer = xmlParserInputBufferCreateIO(rxml_memory_read_callback, NULL, &item->reader, XML_CHAR_ENCODING_NONE);
+    if (buffer)
+    {
+      input = xmlNewIOInputStream(ctxt, buffer, XML_CHAR_ENCODING_NONE);
+      if (!input)
+        xmlFreeParserInputBuffer(buffer);
+    }
+  }
+
+  if (!input)
+  {
+    xmlCopyError(&ctxt->lastError, &item->error);
+    xmlFreeParserCtxt(ctxt);
+    return NULL;
+  }
+
+  inputPush(ctxt, input);
+
+  if (item->path && !ctxt->directory)
+    ctxt->directory = xmlParserGetDirectory(item->path);
+
+  xmlCtxtUseOptions(ctxt, batch->options);
+
+  return ctxt;
+}
+
+static void rxml_parser_batch_parse(rxml_parser_batch *batch, rxml_parser_batch_item *item)
+{
+  rxml_parser_parse_data data;
+  xmlParserCtxtPtr ctxt;
+  int detached = rxml_gvl_detach(1);
+
+  ctxt = rxml_parser_batch_context(batch, item);
+  if (!ctxt)
+  {
+    rxml_gvl_detach(detached);
+    item->done = 1;
+    return;
+  }
+
+  memset(&data, 0, sizeof(data));
+  data.ctxt = ctxt;
+  data.interrupted = &batch->cancelled;
+  data.cancel = 1;
+
+  rxml_parser_hook(&data);
+  data.status = xmlParseDocument(ctxt);
+  rxml_parser_unhook(&data);
+
+  if (data.stopped)
+  {
+    /* Abandoned, the source will be parsed again if needed */
+    xmlFreeDoc(ctxt->myDoc);
+  }
+  else if ((data.status == -1 || !ctxt->wellFormed) && !ctxt->recovery)
+  {
+    xmlCopyError(&ctxt->lastError, &item->error);
+    xmlFreeDoc(ctxt->myDoc);
+    item->done = 1;
+  }
+  else
+  {
+    item->doc = ctxt->myDoc;
+    item->done = 1;
+  }
+
+  /* The error may refer to the parser context or to nodes that are gone */
+  item->error.ctxt = NULL;
+  item->error.node = NULL;
+
+  ctxt->myDoc = NULL;
+  xmlFreeParserCtxt(ctxt);
+  rxml_gvl_detach(detached);
+}
+
+static void *rxml_parser_batch_work(void *data)
+{
+  rxml_parser_batch *batch = (rxml_parser_batch*)data;
+  long index;
+
+  while (!batch->cancelled)
+  {
+    xmlMutexLock(batch->mutex);
+    index = batch->next++;
+    xmlMutexUnlock(batch->mutex);
+
+    if (index >= batch->count)
+      break;
+
+    if (!batch->items[index].done)
+      rxml_parser_batch_parse(batch, &batch->items[index]);
+  }
+  return NULL;
+}
+
+static void *rxml_parser_batch_run(void *data)
+{
+  rxml_parser_batch *batch = (rxml_parser_batch*)data;
+#ifdef HAVE_PTHREAD_CREATE
+  pthread_t *workers = malloc(sizeof(pthread_t) * batch->threads);
+  int started = 0;
+  int i;
+
+  for (i = 1; workers && i < batch->threads; i++)
+  {
+    if (pthread_create(&workers[started], NULL, rxml_parser_batch_work, batch) == 0)
+      started++;
+  }
+
+  rxml_parser_batch_work(batch);
+
+  for (i = 0; i < started; i++)
+    pthread_join(workers[i], NULL);
+
+  free(workers);
+#else
+  rxml_parser_batch_work(batch);
+#endif
+  return NULL;
+}
+
+static void rxml_parser_batch_cancel(void *data)
+{
+  ((rxml_parser_batch*)data)->cancelled = 1;
+}
+
+static VALUE rxml_parser_batch_check_ints(VALUE value)
+{
+  rb_thread_check_ints();
+  return Qnil;
+}
+
+static void rxml_parser_batch_free(rxml_parser_batch *batch)
+{
+  long i;
+
+  for (i = 0; i < batch->count; i++)
+  {
+    rxml_parser_batch_item *item = &batch->items[i];
+    xmlFree(item->path);
+    xmlFree(item->data);
+    xmlFreeDoc(item->doc);
+    xmlResetError(&item->error);
+  }
+
+  xmlFree(batch->items);
+  xmlFreeMutex(batch->mutex);
+}
+
+static int rxml_parser_batch_cpus(void)
+{
+#ifdef _SC_NPROCESSORS_ONLN
+  long result = sysconf(_SC_NPROCESSORS_ONLN);
+  if (result > 0)
+    return (int)result;
+#endif
+  return 1;
+}
+
+/*
+ * call-seq:
+ *    XML::Parser.parse_many(sources) -> [XML::Document | XML::Error, ...]
+ *    XML::Parser.parse_many(sources, :threads => 4,
+ *                                    :options => XML::Parser::Options::NOBLANKS) -> [...]
+ *
+ * Parses many documents at once on a pool of native threads.
+ * The parsing happens without holding Ruby's global VM lock.
+ *
+ * Each source is either a string that contains xml or an object
+ * that responds to to_path (such as a Pathname or File), in which
+ * case the named file is parsed.
+ *
+ * Returns an array with one entry per source, in the same order.
+ * An entry is the parsed XML::Document or, if the source could not
+ * be parsed, the XML::Error describing why.  These errors are not
+ * raised and are not passed to XML::Error's handler.
+ *
+ * Valid options are:
+ *
+ *  threads - The number of threads to parse with, defaults to the
+ *            number of processors.
+ *  id_attribute - The name of an attribute to treat as an ID, see
+ *                 XML::Parser::Context#id_attribute=.
+ *  options - Parser options.  Valid values are the constants defined on
+ *            XML::Parser::Options.  Mutliple options can be combined
+ *            by using Bitwise OR (|).
+ */
+static VALUE rxml_parser_parse_many(int argc, VALUE *argv, VALUE klass)
+{
+  VALUE sources, options, sources_copy, result, id_attribute = Qnil;
+  rxml_parser_batch batch;
+  int state = 0;
+  long i;
+
+  rb_scan_args(argc, argv, "11", &sources, &options);
+  Check_Type(sources, T_ARRAY);
+
+  memset(&batch, 0, sizeof(batch));
+  batch.threads = rxml_parser_batch_cpus();
+  batch.options = rxml_libxml_default_options();
+
+  if (!NIL_P(options))
+  {
+    VALUE threads, parse_options;
+    Check_Type(options, T_HASH);
+
+    threads = rb_hash_aref(options, ID2SYM(rb_intern("threads")));
+    if (!NIL_P(threads))
+      batch.threads = NUM2INT(threads);
+
+    parse_options = rb_hash_aref(options, ID2SYM(rb_intern("options")));
+    if (!NIL_P(parse_options))
+      batch.options = NUM2INT(parse_options);
+
+    id_attribute = rb_hash_aref(options, ID2SYM(rb_intern("id_attribute")));
+    if (!NIL_P(id_attribute))
+      id_attribute = rb_str_new_frozen(rb_obj_as_string(id_attribute));
+  }
+
+  /* Resolve the sources before allocating anything since this may raise */
+  sources_copy = rb_ary_new2(RARRAY_LEN(sources));
+  for (i = 0; i < RARRAY_LEN(sources); i++)
+  {
+    VALUE source = rb_ary_entry(sources, i);
+
+    if (TYPE(source) == T_STRING)
+      rb_ary_push(sources_copy, source);
+    else if (rb_respond_to(source, rb_intern("to_path")))
+      rb_ary_push(sources_copy, rb_ary_new3(1, rb_str_to_str(rb_funcall(source, rb_intern("to_path"), 0))));
+    else
+      rb_raise(rb_eTypeError, "Sources must be strings or respond to to_path");
+  }
+
+  batch.count = RARRAY_LEN(sources_copy);
+  if (batch.count == 0)
+    return rb_ary_new();
+
+  if (batch.threads > batch.count)
+    batch.threads = (int)batch.count;
+  if (batch.threads < 1)
+    batch.threads = 1;
+
+  batch.mutex = xmlNewMutex();
+  batch.items = (rxml_parser_batch_item*)xmlMalloc(sizeof(rxml_parser_batch_item) * batch.count);
+  if (!batch.mutex || !batch.items)
+  {
+    xmlFreeMutex(batch.mutex);
+    xmlFree(batch.items);
+    rb_raise(rb_eNoMemError, "Not enough memory to parse %ld documents", batch.count);
+  }
+  memset(batch.items, 0, sizeof(rxml_parser_batch_item) * batch.count);
+
+  for (i = 0; i < batch.count; i++)
+  {
+    VALUE source = rb_ary_entry(sources_copy, i);
+
+    if (TYPE(source) == T_ARRAY)
+    {
+      VALUE path = rb_ary_entry(source, 0);
+      batch.items[i].path = (char*)xmlStrndup((const xmlChar*)RSTRING_PTR(path), (int)RSTRING_LEN(path));
+      if (!batch.items[i].path)
+        break;
+    }
+    else
+    {
+      batch.items[i].data = (char*)xmlMalloc(RSTRING_LEN(source) + 1);
+      if (!batch.items[i].data)
+        break;
+
+      memcpy(batch.items[i].data, RSTRING_PTR(source), RSTRING_LEN(source));
+      batch.items[i].reader.data = batch.items[i].data;
+      batch.items[i].reader.length = RSTRING_LEN(source);
+    }
+  }
+
+  if (i < batch.count)
+  {
+    rxml_parser_batch_free(&batch);
+    rb_raise(rb_eNoMemError, "Not enough memory to copy source %ld", i);
+  }
+
+  do
+  {
+    batch.cancelled = 0;
+    batch.next = 0;
+    rxml_without_gvl(rxml_parser_batch_run, &batch, rxml_parser_batch_cancel, &batch);
+
+    if (batch.cancelled)
+    {
+      rb_protect(rxml_parser_batch_check_ints, Qnil, &state);
+      if (state)
+      {
+        rxml_parser_batch_free(&batch);
+        rb_jump_tag(state);
+      }
+    }
+  }
+  while (batch.cancelled);
+
+  result = rb_ary_new2(batch.count);
+  for (i = 0; i < batch.count; i++)
+  {
+    rxml_parser_batch_item *item = &batch.items[i];
+
+    if (item->doc)
+    {
+      rb_ary_push(result, rxml_document_wrap(item->doc));
+      rxml_parser_register_ids(item->doc, id_attribute);
+      item->doc = NULL;
+    }
+    else
+    {
+      rb_ary_push(result, rxml_error_wrap(&item->error));
+    }
+  }
+
+  rxml_parser_batch_free(&batch);
+  RB_GC_GUARD(sources_copy);
+
+  return result;
 }
 
 void rxml_init_parser(void)
@@ -82,10 +925,16 @@ void rxml_init_parser(void)
 
   /* Atributes */
   CONTEXT_ATTR = rb_intern("@context");
+  DICTIONARY_ATTR = rb_intern("@dictionary");
   rb_define_attr(cXMLParser, "input", 1, 0);
   rb_define_attr(cXMLParser, "context", 1, 0);
 
+  /* Class Methods */
+  rb_define_singleton_method(cXMLParser, "parse_many", rxml_parser_parse_many, -1);
+
   /* Instance Methods */
   rb_define_method(cXMLParser, "initialize", rxml_parser_initialize, -1);
   rb_define_method(cXMLParser, "parse", rxml_parser_parse, 0);
+  rb_define_method(cXMLParser, "feed", rxml_parser_feed, 1);
+  rb_define_method(cXMLParser, "finish", rxml_parser_finish, 0);
 }
@@ -3,8 +3,12 @@
 #include "ruby_libxml.h"
 #include "ruby_xml_parser_context.h"
 
+#include <libxml/uri.h>
+
 VALUE cXMLParserContext;
 static ID IO_ATTR;
+static ID DICTIONARY_ATTR;
+static ID ID_ATTRIBUTE_ATTR;
 
 /*
  * Document-class: LibXML::XML::Parser::Context
@@ -18,16 +22,58 @@ static void rxml_parser_context_free(xmlParserCtxtPtr ctxt)
   xmlFreeParserCtxt(ctxt);
 }
 
+/* XML::Parser and XML::SaxParser mark a context busy by pointing its
+   _private member at it while parsing, see ruby_xml_parser.c */
+int rxml_parser_context_busy_p(xmlParserCtxtPtr ctxt)
+{
+  return ctxt->_private != NULL;
+}
+
+/* Counts the context, its stacks, buffered input and dictionary.  The
+   dictionary may be shared with other contexts and documents. */
+size_t rxml_parser_context_memsize(const void *data)
+{
+  const xmlParserCtxt *ctxt = (const xmlParserCtxt *)data;
+  size_t size = sizeof(xmlParserCtxt);
+  int i;
+
+  size += ctxt->inputMax * sizeof(xmlParserInputPtr);
+  size += ctxt->nodeMax * sizeof(xmlNodePtr);
+  size += ctxt->nameMax * sizeof(xmlChar *);
+  size += ctxt->spaceMax * sizeof(int);
+
+  for (i = 0; i < ctxt->inputNr; i++)
+  {
+    xmlParserInputPtr input = ctxt->inputTab[i];
+    size += sizeof(xmlParserInput);
+
+    // Only count input read into libxml's own buffers
+    if (input->buf && input->base && input->end)
+      size += input->end - input->base;
+  }
+
+  if (ctxt->dict)
+    size += xmlDictGetUsage(ctxt->dict);
+
+  return size;
+}
+
+const rb_data_type_t rxml_parser_context_data_type = {
+  "LibXML::XML::Parser::Context",
+  {NULL, (RUBY_DATA_FUNC)rxml_parser_context_free, rxml_parser_context_memsize},
+  NULL, NULL, 0
+};
+
 static VALUE rxml_parser_context_wrap(xmlParserCtxtPtr ctxt)
 {
-  return Data_Wrap_Struct(cXMLParserContext, NULL, rxml_parser_context_free, ctxt);
+  return TypedData_Wrap_Struct(cXMLParserContext, &rxml_parser_context_data_type, ctxt);
 }
 
 
 static VALUE rxml_parser_context_alloc(VALUE klass)
 {
   xmlParserCtxtPtr ctxt = xmlNewParserCtxt();
-  return Data_Wrap_Struct(klass, NULL, rxml_parser_context_free, ctxt);
+  return TypedData_Wrap_Struct(klass, &rxml_parser_context_data_type, ctxt);
 }
 
 /* call-seq:
@@ -49,7 +95,7 @@ static VALUE rxml_parser_context_document(VALUE klass, VALUE document)
   if (rb_obj_is_kind_of(document, cXMLDocument) == Qfalse)
     rb_raise(rb_eTypeError, "Must pass an XML::Document object");
 
-  Data_Get_Struct(document, xmlDoc, xdoc);
+  TypedData_Get_Struct(document, xmlDoc, &rxml_document_data_type, xdoc);
   xmlDocDumpFormatMemoryEnc(xdoc, &buffer, &length, (const char*)xdoc->encoding, 0);
 
   ctxt = xmlCreateDocParserCtxt(buffer);
@@ -91,24 +137,160 @@ static VALUE rxml_parser_context_file(VALUE klass, VALUE file)
   return rxml_parser_context_wrap(ctxt);
 }
 
+#ifdef HAVE_MMAP
+/* call-seq:
+ *    XML::Parser::Context.mmap(path) -> XML::Parser::Context
+ *
+ * Creates a new parser context that parses the specified file by
+ * mapping it into memory, instead of reading it into buffers.
+ * This avoids copying large files and lets repeated parses of the
+ * same file be served from the operating system's page cache.
+ *
+ * The file must not be truncated while it is being parsed.  This
+ * method is not available on platforms without mmap.
+ *
+ * Parameters:
+ *
+ *  path - The path to a local file.
+*/
+static VALUE rxml_parser_context_mmap(VALUE klass, VALUE path)
+{
+  xmlParserCtxtPtr ctxt;
+  xmlParserInputBufferPtr input;
+  xmlParserInputPtr stream;
+  const char *xpath = StringValueCStr(path);
+  void *reader = rxml_mmap_input_open(xpath);
+
+  if (!reader)
+    rb_sys_fail_str(path);
+
+  input = xmlParserInputBufferCreateIO(rxml_memory_read_callback, rxml_mmap_input_close,
+                                       reader, XML_CHAR_ENCODING_NONE);
+
+  if (!input)
+  {
+    rxml_mmap_input_close(reader);
+    rxml_raise(&xmlLastError);
+  }
+
+  ctxt = xmlNewParserCtxt();
+
+  if (!ctxt)
+  {
+    xmlFreeParserInputBuffer(input);
+    rxml_raise(&xmlLastError);
+  }
+
+  /* This is annoying, but xmlInitParserCtxt (called indirectly above) and 
+     xmlCtxtUseOptionsInternal (called below) initialize slightly different
+     context options, in particular XML_PARSE_NODICT which xmlInitParserCtxt
+     sets to 0 and xmlCtxtUseOptionsInternal sets to 1.  So we have to call both. */
+  xmlCtxtUseOptions(ctxt, rxml_libxml_default_options());
+
+  stream = xmlNewIOInputStream(ctxt, input, XML_CHAR_ENCODING_NONE);
+
+  if (!stream)
+  {
+    xmlFreeParserInputBuffer(input);
+    xmlFreeParserCtxt(ctxt);
+    rxml_raise(&xmlLastError);
+  }
+
+  /* Mimic xmlCreateURLParserCtxt so relative references resolve against the file */
+  stream->filename = (char *) xmlCanonicPath((const xmlChar *) xpath);
+  if (!ctxt->directory)
+    ctxt->directory = xmlParserGetDirectory(xpath);
+
+  inputPush(ctxt, stream);
+
+  return rxml_parser_context_wrap(ctxt);
+}
+#endif /* HAVE_MMAP */
+
+/* call-seq:
+ *    XML::Parser::Context.push -> XML::Parser::Context
+ *
+ * Creates a new parser context that is given its input in
+ * chunks, as the data becomes available, instead of reading
+ * it from a source.  This makes it possible to parse a document
+ * while it is still being received, without buffering it or
+ * blocking on an io object.
+ *
+ *   parser = XML::Parser.new(XML::Parser::Context.push)
+ *   socket.each_chunk {|chunk| parser.feed(chunk)}
+ *   doc = parser.finish
+ *
+ * See XML::Parser#feed and XML::Parser#finish.
+*/
+static VALUE rxml_parser_context_push(VALUE klass)
+{
+  xmlParserCtxtPtr ctxt = xmlCreatePushParserCtxt(NULL, NULL, NULL, 0, NULL);
+
+  if (!ctxt)
+    rxml_raise(&xmlLastError);
+
+  /* This is annoying, but xmlInitParserCtxt (called indirectly above) and 
+     xmlCtxtUseOptionsInternal (called below) initialize slightly different
+     context options, in particular XML_PARSE_NODICT which xmlInitParserCtxt
+     sets to 0 and xmlCtxtUseOptionsInternal sets to 1.  So we have to call both. */
+  xmlCtxtUseOptions(ctxt, rxml_libxml_default_options());
+
+  return rxml_parser_context_wrap(ctxt);
+}
+
+/* Makes string the context's input.  The string is read in place,
+   see rxml_string_input_open. */
+static void rxml_parser_context_push_string(xmlParserCtxtPtr ctxt, VALUE string)
+{
+  xmlParserInputBufferPtr input;
+  xmlParserInputPtr stream;
+  void *reader = rxml_string_input_open(string);
+
+  input = xmlParserInputBufferCreateIO(rxml_memory_read_callback, rxml_string_input_close,
+                                       reader, XML_CHAR_ENCODING_NONE);
+
+  if (!input)
+  {
+    rxml_string_input_close(reader);
+    rxml_raise(&xmlLastError);
+  }
+
+  stream = xmlNewIOInputStream(ctxt, input, XML_CHAR_ENCODING_NONE);
+
+  if (!stream)
+  {
+    xmlFreeParserInputBuffer(input);
+    rxml_raise(&xmlLastError);
+  }
+  inputPush(ctxt, stream);
+}
+
 /* call-seq:
  *    XML::Parser::Context.string(string) -> XML::Parser::Context
  *
  * Creates a new parser context based on the specified string.
  *
+ * The string is not copied.  Instead libxml reads directly from it
+ * as parsing proceeds, so parsing a large string does not double
+ * the memory used.  The string is kept alive until the context is
+ * closed.  If it is not frozen, a frozen copy-on-write view of it is
+ * parsed so changing the original string afterwards is safe.
+ *
  * Parameters:
  *
  *  string - A string that contains the data to parse.
 */
 static VALUE rxml_parser_context_string(VALUE klass, VALUE string)
 {
+  VALUE result;
   xmlParserCtxtPtr ctxt;
+
   Check_Type(string, T_STRING);
 
   if (RSTRING_LEN(string) == 0)
     rb_raise(rb_eArgError, "Must specify a string with one or more characters");
 
-  ctxt = xmlCreateMemoryParserCtxt(StringValuePtr(string), (int)RSTRING_LEN(string));
+  ctxt = xmlNewParserCtxt();
   
   if (!ctxt)
     rxml_raise(&xmlLastError);
@@ -119,30 +301,53 @@ static VALUE rxml_parser_context_string(VALUE klass, VALUE string)
      sets to 0 and xmlCtxtUseOptionsInternal sets to 1.  So we have to call both. */
   xmlCtxtUseOptions(ctxt, rxml_libxml_default_options());
 
-  return rxml_parser_context_wrap(ctxt);
+  /* Wrap the context first so it is freed if pushing the input fails */
+  result = rxml_parser_context_wrap(ctxt);
+  rxml_parser_context_push_string(ctxt, string);
+
+  return result;
 }
 
 /* call-seq:
  *    XML::Parser::Context.io(io) -> XML::Parser::Context
+ *    XML::Parser::Context.io(io, :chunk_size => 1048576) -> XML::Parser::Context
  *
  * Creates a new parser context based on the specified io object.
  *
+ * The io object is read in chunks with readpartial, reusing a single
+ * buffer.  Regular files are read directly from their file descriptor
+ * without holding the GVL.
+ *
  * Parameters:
  *
  *  io - A ruby IO object.
+ *  chunk_size - The number of bytes to read from the io object at a
+ *               time, defaults to 65536.
 */
-static VALUE rxml_parser_context_io(VALUE klass, VALUE io)
+static VALUE rxml_parser_context_io(int argc, VALUE *argv, VALUE klass)
 {
+  VALUE io;
+  VALUE options;
   VALUE result;
   xmlParserCtxtPtr ctxt;
   xmlParserInputBufferPtr input;
   xmlParserInputPtr stream;
+  void *reader;
+
+  rb_scan_args(argc, argv, "11", &io, &options);
 
   if (NIL_P(io))
     rb_raise(rb_eTypeError, "Must pass in an IO object");
 
-  input = xmlParserInputBufferCreateIO((xmlInputReadCallback) rxml_read_callback, NULL,
-                                       (void*)io, XML_CHAR_ENCODING_NONE);
+  reader = rxml_io_input_open(io, rxml_io_chunk_size(options));
+  input = xmlParserInputBufferCreateIO(rxml_io_input_callback(reader), rxml_io_input_close,
+                                       reader, XML_CHAR_ENCODING_NONE);
+
+  if (!input)
+  {
+    rxml_io_input_close(reader);
+    rxml_raise(&xmlLastError);
+  }
     
   ctxt = xmlNewParserCtxt();
 
@@ -184,7 +389,7 @@ static VALUE rxml_parser_context_io(VALUE klass, VALUE io)
 static VALUE rxml_parser_context_base_uri_get(VALUE self)
 {
   xmlParserCtxtPtr ctxt;
-  Data_Get_Struct(self, xmlParserCtxt, ctxt);
+  TypedData_Get_Struct(self, xmlParserCtxt, &rxml_parser_context_data_type, ctxt);
 
   if (ctxt->input && ctxt->input->filename)
     return rxml_new_cstr((const xmlChar*)ctxt->input->filename, ctxt->encoding);
@@ -201,7 +406,7 @@ static VALUE rxml_parser_context_base_uri_get(VALUE self)
 static VALUE rxml_parser_context_base_uri_set(VALUE self, VALUE url)
 {
   xmlParserCtxtPtr ctxt;
-  Data_Get_Struct(self, xmlParserCtxt, ctxt);
+  TypedData_Get_Struct(self, xmlParserCtxt, &rxml_parser_context_data_type, ctxt);
 
   Check_Type(url, T_STRING);
 
@@ -225,7 +430,7 @@ static VALUE rxml_parser_context_close(VALUE self)
 {
   xmlParserCtxtPtr ctxt;
   xmlParserInputPtr xinput;
-  Data_Get_Struct(self, xmlParserCtxt, ctxt);
+  TypedData_Get_Struct(self, xmlParserCtxt, &rxml_parser_context_data_type, ctxt);
 
   while ((xinput = inputPop(ctxt)) != NULL)
   {
@@ -234,6 +439,51 @@ static VALUE rxml_parser_context_close(VALUE self)
   return Qnil;
 }
 
+/*
+ * call-seq:
+ *    context.reset -> XML::Parser::Context
+ *    context.reset(string) -> XML::Parser::Context
+ *
+ * Resets the context so it can be used to parse another document.
+ * This is cheaper than creating a new context, since the context
+ * keeps its allocated buffers, dictionary and parser options.  If a
+ * string is given, it becomes the context's new input and is read
+ * in place as with XML::Parser::Context.string.
+ *
+ * Documents previously parsed with the context are not affected.
+ * See XML::Parser::Pool for reusing contexts across threads.
+ */
+static VALUE rxml_parser_context_reset(int argc, VALUE *argv, VALUE self)
+{
+  xmlParserCtxtPtr ctxt;
+  VALUE string;
+
+  rb_scan_args(argc, argv, "01", &string);
+  TypedData_Get_Struct(self, xmlParserCtxt, &rxml_parser_context_data_type, ctxt);
+
+  if (rxml_parser_context_busy_p(ctxt))
+    rb_raise(rb_eRuntimeError, "The parser context is being parsed");
+
+  if (!NIL_P(string))
+  {
+    Check_Type(string, T_STRING);
+
+    if (RSTRING_LEN(string) == 0)
+      rb_raise(rb_eArgError, "Must specify a string with one or more characters");
+  }
+
+  /* Frees the inputs and any document left over from a failed parse */
+  if (ctxt->html)
+    htmlCtxtReset(ctxt);
+  else
+    xmlCtxtReset(ctxt);
+
+  if (!NIL_P(string))
+    rxml_parser_context_push_string(ctxt, string);
+
+  return self;
+}
+
 /*
  * call-seq:
  *    context.data_directory -> "dir"
@@ -243,7 +493,7 @@ static VALUE rxml_parser_context_close(VALUE self)
 static VALUE rxml_parser_context_data_directory_get(VALUE self)
 {
   xmlParserCtxtPtr ctxt;
-  Data_Get_Struct(self, xmlParserCtxt, ctxt);
+  TypedData_Get_Struct(self, xmlParserCtxt, &rxml_parser_context_data_type, ctxt);
 
   if (ctxt->directory == NULL)
     return (Qnil);
@@ -260,11 +510,91 @@ static VALUE rxml_parser_context_data_directory_get(VALUE self)
 static VALUE rxml_parser_context_depth_get(VALUE self)
 {
   xmlParserCtxtPtr ctxt;
-  Data_Get_Struct(self, xmlParserCtxt, ctxt);
+  TypedData_Get_Struct(self, xmlParserCtxt, &rxml_parser_context_data_type, ctxt);
 
   return (INT2NUM(ctxt->depth));
 }
 
+/*
+ * call-seq:
+ *    context.dictionary -> XML::Dictionary
+ *
+ * Returns the dictionary assigned with XML::Parser::Context#dictionary=,
+ * or nil if the context uses its own dictionary.
+ */
+static VALUE rxml_parser_context_dictionary_get(VALUE self)
+{
+  return rb_ivar_get(self, DICTIONARY_ATTR);
+}
+
+/*
+ * call-seq:
+ *    context.dictionary = XML::Dictionary.new
+ *
+ * Makes the context intern names in the specified dictionary, so
+ * that documents parsed with it share their names with other
+ * documents parsed with the same dictionary.  This also clears the
+ * XML::Parser::Options::NODICT option.  The dictionary can not be
+ * changed once parsing has started.
+ */
+static VALUE rxml_parser_context_dictionary_set(VALUE self, VALUE dictionary)
+{
+  xmlParserCtxtPtr ctxt;
+  xmlDictPtr dict = rxml_dictionary_get(dictionary);
+
+  TypedData_Get_Struct(self, xmlParserCtxt, &rxml_parser_context_data_type, ctxt);
+
+  if (ctxt->instate != XML_PARSER_START || ctxt->myDoc)
+    rb_raise(rb_eRuntimeError, "Cannot change the dictionary once parsing has started");
+
+  if (ctxt->dict != dict)
+  {
+    xmlDictReference(dict);
+    xmlDictFree(ctxt->dict);
+    ctxt->dict = dict;
+
+    /* Mimic xmlInitParserCtxt, these are compared by pointer */
+    ctxt->str_xml = xmlDictLookup(dict, BAD_CAST "xml", 3);
+    ctxt->str_xmlns = xmlDictLookup(dict, BAD_CAST "xmlns", 5);
+    ctxt->str_xml_ns = xmlDictLookup(dict, XML_XML_NAMESPACE, 36);
+  }
+
+  ctxt->dictNames = 1;
+  ctxt->options &= ~XML_PARSE_NODICT;
+
+  rb_ivar_set(self, DICTIONARY_ATTR, dictionary);
+
+  return self;
+}
+
+/*
+ * call-seq:
+ *    context.id_attribute -> String
+ *
+ * Returns the name of the attribute registered as an ID, see
+ * XML::Parser::Context#id_attribute=.
+ */
+static VALUE rxml_parser_context_id_attribute_get(VALUE self)
+{
+  return rb_attr_get(self, ID_ATTRIBUTE_ATTR);
+}
+
+/*
+ * call-seq:
+ *    context.id_attribute = "id"
+ *
+ * Treats attributes with the specified name and no namespace as IDs,
+ * as if the document's DTD had declared them so.  Parsed documents
+ * can then look their elements up with XML::Document#element_by_id.
+ * If several elements have the same ID the first one is used.  Set to
+ * nil to only use xml:id and DTD declared IDs.
+ */
+static VALUE rxml_parser_context_id_attribute_set(VALUE self, VALUE name)
+{
+  rb_ivar_set(self, ID_ATTRIBUTE_ATTR, NIL_P(name) ? Qnil : rb_str_new_frozen(rb_obj_as_string(name)));
+  return self;
+}
+
 /*
  * call-seq:
  *    context.disable_cdata? -> (true|false)
@@ -274,7 +604,7 @@ static VALUE rxml_parser_context_depth_get(VALUE self)
 static VALUE rxml_parser_context_disable_cdata_q(VALUE self)
 {
   xmlParserCtxtPtr ctxt;
-  Data_Get_Struct(self, xmlParserCtxt, ctxt);
+  TypedData_Get_Struct(self, xmlParserCtxt, &rxml_parser_context_data_type, ctxt);
 
   /* LibXML controls this internally with the default SAX handler. */
   if (ctxt->sax && ctxt->sax->cdataBlock)
@@ -292,7 +622,7 @@ static VALUE rxml_parser_context_disable_cdata_q(VALUE self)
 static VALUE rxml_parser_context_disable_cdata_set(VALUE self, VALUE value)
 {
   xmlParserCtxtPtr ctxt;
-  Data_Get_Struct(self, xmlParserCtxt, ctxt);
+  TypedData_Get_Struct(self, xmlParserCtxt, &rxml_parser_context_data_type, ctxt);
 
   if (ctxt->sax == NULL)
     rb_raise(rb_eRuntimeError, "Sax handler is not yet set");
@@ -316,7 +646,7 @@ static VALUE rxml_parser_context_disable_cdata_set(VALUE self, VALUE value)
 static VALUE rxml_parser_context_disable_sax_q(VALUE self)
 {
   xmlParserCtxtPtr ctxt;
-  Data_Get_Struct(self, xmlParserCtxt, ctxt);
+  TypedData_Get_Struct(self, xmlParserCtxt, &rxml_parser_context_data_type, ctxt);
 
   if (ctxt->disableSAX)
     return (Qtrue);
@@ -333,7 +663,7 @@ static VALUE rxml_parser_context_disable_sax_q(VALUE self)
 static VALUE rxml_parser_context_docbook_q(VALUE self)
 {
   xmlParserCtxtPtr ctxt;
-  Data_Get_Struct(self, xmlParserCtxt, ctxt);
+  TypedData_Get_Struct(self, xmlParserCtxt, &rxml_parser_context_data_type, ctxt);
 
   if (ctxt->html == 2) // TODO check this
     return (Qtrue);
@@ -351,7 +681,7 @@ static VALUE rxml_parser_context_docbook_q(VALUE self)
 static VALUE rxml_parser_context_encoding_get(VALUE self)
 {
   xmlParserCtxtPtr ctxt;
-  Data_Get_Struct(self, xmlParserCtxt, ctxt);
+  TypedData_Get_Struct(self, xmlParserCtxt, &rxml_parser_context_data_type, ctxt);
   return INT2NUM(xmlParseCharEncoding((const char*)ctxt->encoding));
 }
 
@@ -371,7 +701,7 @@ static VALUE rxml_parser_context_encoding_set(VALUE self, VALUE encoding)
   if (!hdlr)
     rb_raise(rb_eArgError, "Unknown encoding: %i", NUM2INT(encoding));
 
-  Data_Get_Struct(self, xmlParserCtxt, ctxt);
+  TypedData_Get_Struct(self, xmlParserCtxt, &rxml_parser_context_data_type, ctxt);
   result = xmlSwitchToEncoding(ctxt, hdlr);
 
   if (result != 0)
@@ -393,7 +723,7 @@ static VALUE rxml_parser_context_encoding_set(VALUE self, VALUE encoding)
 static VALUE rxml_parser_context_errno_get(VALUE self)
 {
   xmlParserCtxtPtr ctxt;
-  Data_Get_Struct(self, xmlParserCtxt, ctxt);
+  TypedData_Get_Struct(self, xmlParserCtxt, &rxml_parser_context_data_type, ctxt);
 
   return (INT2NUM(ctxt->errNo));
 }
@@ -407,7 +737,7 @@ static VALUE rxml_parser_context_errno_get(VALUE self)
 static VALUE rxml_parser_context_html_q(VALUE self)
 {
   xmlParserCtxtPtr ctxt;
-  Data_Get_Struct(self, xmlParserCtxt, ctxt);
+  TypedData_Get_Struct(self, xmlParserCtxt, &rxml_parser_context_data_type, ctxt);
 
   if (ctxt->html == 1)
     return (Qtrue);
@@ -426,7 +756,7 @@ static VALUE rxml_parser_context_io_max_num_streams_get(VALUE self)
 {
   // TODO alias to max_streams and dep this?
   xmlParserCtxtPtr ctxt;
-  Data_Get_Struct(self, xmlParserCtxt, ctxt);
+  TypedData_Get_Struct(self, xmlParserCtxt, &rxml_parser_context_data_type, ctxt);
 
   return (INT2NUM(ctxt->inputMax));
 }
@@ -441,7 +771,7 @@ static VALUE rxml_parser_context_io_max_num_streams_get(VALUE self)
 static VALUE rxml_parser_context_io_num_streams_get(VALUE self)
 {
   xmlParserCtxtPtr ctxt;
-  Data_Get_Struct(self, xmlParserCtxt, ctxt);
+  TypedData_Get_Struct(self, xmlParserCtxt, &rxml_parser_context_data_type, ctxt);
 
   return (INT2NUM(ctxt->inputNr));
 }
@@ -456,7 +786,7 @@ static VALUE rxml_parser_context_io_num_streams_get(VALUE self)
 static VALUE rxml_parser_context_keep_blanks_q(VALUE self)
 {
   xmlParserCtxtPtr ctxt;
-  Data_Get_Struct(self, xmlParserCtxt, ctxt);
+  TypedData_Get_Struct(self, xmlParserCtxt, &rxml_parser_context_data_type, ctxt);
 
   if (ctxt->keepBlanks)
     return (Qtrue);
@@ -473,7 +803,7 @@ static VALUE rxml_parser_context_keep_blanks_q(VALUE self)
 static VALUE rxml_parser_context_name_depth_get(VALUE self)
 {
   xmlParserCtxtPtr ctxt;
-  Data_Get_Struct(self, xmlParserCtxt, ctxt);
+  TypedData_Get_Struct(self, xmlParserCtxt, &rxml_parser_context_data_type, ctxt);
 
   return (INT2NUM(ctxt->nameNr));
 }
@@ -487,7 +817,7 @@ static VALUE rxml_parser_context_name_depth_get(VALUE self)
 static VALUE rxml_parser_context_name_depth_max_get(VALUE self)
 {
   xmlParserCtxtPtr ctxt;
-  Data_Get_Struct(self, xmlParserCtxt, ctxt);
+  TypedData_Get_Struct(self, xmlParserCtxt, &rxml_parser_context_data_type, ctxt);
 
   return (INT2NUM(ctxt->nameMax));
 }
@@ -501,7 +831,7 @@ static VALUE rxml_parser_context_name_depth_max_get(VALUE self)
 static VALUE rxml_parser_context_name_node_get(VALUE self)
 {
   xmlParserCtxtPtr ctxt;
-  Data_Get_Struct(self, xmlParserCtxt, ctxt);
+  TypedData_Get_Struct(self, xmlParserCtxt, &rxml_parser_context_data_type, ctxt);
 
   if (ctxt->name == NULL)
     return (Qnil);
@@ -521,7 +851,7 @@ static VALUE rxml_parser_context_name_tab_get(VALUE self)
   xmlParserCtxtPtr ctxt;
   VALUE tab_ary;
 
-  Data_Get_Struct(self, xmlParserCtxt, ctxt);
+  TypedData_Get_Struct(self, xmlParserCtxt, &rxml_parser_context_data_type, ctxt);
 
   if (ctxt->nameTab == NULL)
     return (Qnil);
@@ -548,7 +878,7 @@ static VALUE rxml_parser_context_name_tab_get(VALUE self)
 static VALUE rxml_parser_context_node_depth_get(VALUE self)
 {
   xmlParserCtxtPtr ctxt;
-  Data_Get_Struct(self, xmlParserCtxt, ctxt);
+  TypedData_Get_Struct(self, xmlParserCtxt, &rxml_parser_context_data_type, ctxt);
 
   return (INT2NUM(ctxt->nodeNr));
 }
@@ -562,7 +892,7 @@ static VALUE rxml_parser_context_node_depth_get(VALUE self)
 static VALUE rxml_parser_context_node_get(VALUE self)
 {
   xmlParserCtxtPtr ctxt;
-  Data_Get_Struct(self, xmlParserCtxt, ctxt);
+  TypedData_Get_Struct(self, xmlParserCtxt, &rxml_parser_context_data_type, ctxt);
 
   if (ctxt->node == NULL)
     return (Qnil);
@@ -579,7 +909,7 @@ static VALUE rxml_parser_context_node_get(VALUE self)
 static VALUE rxml_parser_context_node_depth_max_get(VALUE self)
 {
   xmlParserCtxtPtr ctxt;
-  Data_Get_Struct(self, xmlParserCtxt, ctxt);
+  TypedData_Get_Struct(self, xmlParserCtxt, &rxml_parser_context_data_type, ctxt);
 
   return (INT2NUM(ctxt->nodeMax));
 }
@@ -593,7 +923,7 @@ static VALUE rxml_parser_context_node_depth_max_get(VALUE self)
 static VALUE rxml_parser_context_num_chars_get(VALUE self)
 {
   xmlParserCtxtPtr ctxt;
-  Data_Get_Struct(self, xmlParserCtxt, ctxt);
+  TypedData_Get_Struct(self, xmlParserCtxt, &rxml_parser_context_data_type, ctxt);
 
   return (LONG2NUM(ctxt->nbChars));
 }
@@ -609,7 +939,7 @@ static VALUE rxml_parser_context_num_chars_get(VALUE self)
 static VALUE rxml_parser_context_options_get(VALUE self)
 {
   xmlParserCtxtPtr ctxt;
-  Data_Get_Struct(self, xmlParserCtxt, ctxt);
+  TypedData_Get_Struct(self, xmlParserCtxt, &rxml_parser_context_data_type, ctxt);
 
   return INT2NUM(ctxt->options);
 }
@@ -628,7 +958,7 @@ static VALUE rxml_parser_context_options_set(VALUE self, VALUE options)
   xmlParserCtxtPtr ctxt;
   Check_Type(options, T_FIXNUM);
 
-  Data_Get_Struct(self, xmlParserCtxt, ctxt);
+  TypedData_Get_Struct(self, xmlParserCtxt, &rxml_parser_context_data_type, ctxt);
   xmlCtxtUseOptions(ctxt, NUM2INT(options));
 
   return self;
@@ -644,7 +974,7 @@ static VALUE rxml_parser_context_options_set(VALUE self, VALUE options)
 static VALUE rxml_parser_context_recovery_q(VALUE self)
 {
   xmlParserCtxtPtr ctxt;
-  Data_Get_Struct(self, xmlParserCtxt, ctxt);
+  TypedData_Get_Struct(self, xmlParserCtxt, &rxml_parser_context_data_type, ctxt);
 
   if (ctxt->recovery)
     return (Qtrue);
@@ -662,7 +992,7 @@ static VALUE rxml_parser_context_recovery_q(VALUE self)
 static VALUE rxml_parser_context_recovery_set(VALUE self, VALUE value)
 {
   xmlParserCtxtPtr ctxt;
-  Data_Get_Struct(self, xmlParserCtxt, ctxt);
+  TypedData_Get_Struct(self, xmlParserCtxt, &rxml_parser_context_data_type, ctxt);
 
   if (value == Qfalse)
   {
@@ -686,7 +1016,7 @@ static VALUE rxml_parser_context_recovery_set(VALUE self, VALUE value)
 static VALUE rxml_parser_context_replace_entities_q(VALUE self)
 {
   xmlParserCtxtPtr ctxt;
-  Data_Get_Struct(self, xmlParserCtxt, ctxt);
+  TypedData_Get_Struct(self, xmlParserCtxt, &rxml_parser_context_data_type, ctxt);
 
   if (ctxt->replaceEntities)
     return (Qtrue);
@@ -704,7 +1034,7 @@ static VALUE rxml_parser_context_replace_entities_q(VALUE self)
 static VALUE rxml_parser_context_replace_entities_set(VALUE self, VALUE value)
 {
   xmlParserCtxtPtr ctxt;
-  Data_Get_Struct(self, xmlParserCtxt, ctxt);
+  TypedData_Get_Struct(self, xmlParserCtxt, &rxml_parser_context_data_type, ctxt);
 
   if (value == Qfalse)
   {
@@ -727,7 +1057,7 @@ static VALUE rxml_parser_context_replace_entities_set(VALUE self, VALUE value)
 static VALUE rxml_parser_context_space_depth_get(VALUE self)
 {
   xmlParserCtxtPtr ctxt;
-  Data_Get_Struct(self, xmlParserCtxt, ctxt);
+  TypedData_Get_Struct(self, xmlParserCtxt, &rxml_parser_context_data_type, ctxt);
 
   return (INT2NUM(ctxt->spaceNr));
 }
@@ -741,7 +1071,7 @@ static VALUE rxml_parser_context_space_depth_get(VALUE self)
 static VALUE rxml_parser_context_space_depth_max_get(VALUE self)
 {
   xmlParserCtxtPtr ctxt;
-  Data_Get_Struct(self, xmlParserCtxt, ctxt);
+  TypedData_Get_Struct(self, xmlParserCtxt, &rxml_parser_context_data_type, ctxt);
 
   return (INT2NUM(ctxt->spaceMax));
 }
@@ -756,7 +1086,7 @@ static VALUE rxml_parser_context_space_depth_max_get(VALUE self)
 static VALUE rxml_parser_context_subset_external_q(VALUE self)
 {
   xmlParserCtxtPtr ctxt;
-  Data_Get_Struct(self, xmlParserCtxt, ctxt);
+  TypedData_Get_Struct(self, xmlParserCtxt, &rxml_parser_context_data_type, ctxt);
 
   if (ctxt->inSubset == 2)
     return (Qtrue);
@@ -774,7 +1104,7 @@ static VALUE rxml_parser_context_subset_external_q(VALUE self)
 static VALUE rxml_parser_context_subset_internal_q(VALUE self)
 {
   xmlParserCtxtPtr ctxt;
-  Data_Get_Struct(self, xmlParserCtxt, ctxt);
+  TypedData_Get_Struct(self, xmlParserCtxt, &rxml_parser_context_data_type, ctxt);
 
   if (ctxt->inSubset == 1)
     return (Qtrue);
@@ -793,7 +1123,7 @@ static VALUE rxml_parser_context_subset_internal_q(VALUE self)
 static VALUE rxml_parser_context_subset_name_get(VALUE self)
 {
   xmlParserCtxtPtr ctxt;
-  Data_Get_Struct(self, xmlParserCtxt, ctxt);
+  TypedData_Get_Struct(self, xmlParserCtxt, &rxml_parser_context_data_type, ctxt);
 
   if (ctxt->intSubName == NULL)
     return (Qnil);
@@ -812,7 +1142,7 @@ static VALUE rxml_parser_context_subset_name_get(VALUE self)
 static VALUE rxml_parser_context_subset_external_uri_get(VALUE self)
 {
   xmlParserCtxtPtr ctxt;
-  Data_Get_Struct(self, xmlParserCtxt, ctxt);
+  TypedData_Get_Struct(self, xmlParserCtxt, &rxml_parser_context_data_type, ctxt);
 
   if (ctxt->extSubURI == NULL)
     return (Qnil);
@@ -831,7 +1161,7 @@ static VALUE rxml_parser_context_subset_external_uri_get(VALUE self)
 static VALUE rxml_parser_context_subset_external_system_id_get(VALUE self)
 {
   xmlParserCtxtPtr ctxt;
-  Data_Get_Struct(self, xmlParserCtxt, ctxt);
+  TypedData_Get_Struct(self, xmlParserCtxt, &rxml_parser_context_data_type, ctxt);
 
   if (ctxt->extSubSystem == NULL)
     return (Qnil);
@@ -848,7 +1178,7 @@ static VALUE rxml_parser_context_subset_external_system_id_get(VALUE self)
 static VALUE rxml_parser_context_standalone_q(VALUE self)
 {
   xmlParserCtxtPtr ctxt;
-  Data_Get_Struct(self, xmlParserCtxt, ctxt);
+  TypedData_Get_Struct(self, xmlParserCtxt, &rxml_parser_context_data_type, ctxt);
 
   if (ctxt->standalone)
     return (Qtrue);
@@ -865,7 +1195,7 @@ static VALUE rxml_parser_context_standalone_q(VALUE self)
 static VALUE rxml_parser_context_stats_q(VALUE self)
 {
   xmlParserCtxtPtr ctxt;
-  Data_Get_Struct(self, xmlParserCtxt, ctxt);
+  TypedData_Get_Struct(self, xmlParserCtxt, &rxml_parser_context_data_type, ctxt);
 
   if (ctxt->record_info)
     return (Qtrue);
@@ -882,7 +1212,7 @@ static VALUE rxml_parser_context_stats_q(VALUE self)
 static VALUE rxml_parser_context_valid_q(VALUE self)
 {
   xmlParserCtxtPtr ctxt;
-  Data_Get_Struct(self, xmlParserCtxt, ctxt);
+  TypedData_Get_Struct(self, xmlParserCtxt, &rxml_parser_context_data_type, ctxt);
 
   if (ctxt->valid)
     return (Qtrue);
@@ -899,7 +1229,7 @@ static VALUE rxml_parser_context_valid_q(VALUE self)
 static VALUE rxml_parser_context_validate_q(VALUE self)
 {
   xmlParserCtxtPtr ctxt;
-  Data_Get_Struct(self, xmlParserCtxt, ctxt);
+  TypedData_Get_Struct(self, xmlParserCtxt, &rxml_parser_context_data_type, ctxt);
 
   if (ctxt->validate)
     return (Qtrue);
@@ -916,7 +1246,7 @@ static VALUE rxml_parser_context_validate_q(VALUE self)
 static VALUE rxml_parser_context_version_get(VALUE self)
 {
   xmlParserCtxtPtr ctxt;
-  Data_Get_Struct(self, xmlParserCtxt, ctxt);
+  TypedData_Get_Struct(self, xmlParserCtxt, &rxml_parser_context_data_type, ctxt);
 
   if (ctxt->version == NULL)
     return (Qnil);
@@ -933,7 +1263,7 @@ static VALUE rxml_parser_context_version_get(VALUE self)
 static VALUE rxml_parser_context_well_formed_q(VALUE self)
 {
   xmlParserCtxtPtr ctxt;
-  Data_Get_Struct(self, xmlParserCtxt, ctxt);
+  TypedData_Get_Struct(self, xmlParserCtxt, &rxml_parser_context_data_type, ctxt);
 
   if (ctxt->wellFormed)
     return (Qtrue);
@@ -944,25 +1274,38 @@ static VALUE rxml_parser_context_well_formed_q(VALUE self)
 void rxml_init_parser_context(void)
 {
   IO_ATTR = ID2SYM(rb_intern("@io"));
+  DICTIONARY_ATTR = rb_intern("@dictionary");
+  ID_ATTRIBUTE_ATTR = rb_intern("@id_attribute");
 
   cXMLParserContext = rb_define_class_under(cXMLParser, "Context", rb_cObject);
   rb_define_alloc_func(cXMLParserContext, rxml_parser_context_alloc);
 
   rb_define_singleton_method(cXMLParserContext, "document", rxml_parser_context_document, 1);
   rb_define_singleton_method(cXMLParserContext, "file", rxml_parser_context_file, 1);
-  rb_define_singleton_method(cXMLParserContext, "io", rxml_parser_context_io, 1);
+  rb_define_singleton_method(cXMLParserContext, "io", rxml_parser_context_io, -1);
+#ifdef HAVE_MMAP
+  rb_define_singleton_method(cXMLParserContext, "mmap", rxml_parser_context_mmap, 1);
+#else
+  rb_define_singleton_method(cXMLParserContext, "mmap", rb_f_notimplement, -1);
+#endif
+  rb_define_singleton_method(cXMLParserContext, "push", rxml_parser_context_push, 0);
   rb_define_singleton_method(cXMLParserContext, "string", rxml_parser_context_string, 1);
 
   rb_define_method(cXMLParserContext, "base_uri", rxml_parser_context_base_uri_get, 0);
   rb_define_method(cXMLParserContext, "base_uri=", rxml_parser_context_base_uri_set, 1);
   rb_define_method(cXMLParserContext, "close", rxml_parser_context_close, 0);
+  rb_define_method(cXMLParserContext, "reset", rxml_parser_context_reset, -1);
   rb_define_method(cXMLParserContext, "data_directory", rxml_parser_context_data_directory_get, 0);
   rb_define_method(cXMLParserContext, "depth", rxml_parser_context_depth_get, 0);
+  rb_define_method(cXMLParserContext, "dictionary", rxml_parser_context_dictionary_get, 0);
+  rb_define_method(cXMLParserContext, "dictionary=", rxml_parser_context_dictionary_set, 1);
   rb_define_method(cXMLParserContext, "disable_cdata?", rxml_parser_context_disable_cdata_q, 0);
   rb_define_method(cXMLParserContext, "disable_cdata=", rxml_parser_context_disable_cdata_set, 1);
   rb_define_method(cXMLParserContext, "disable_sax?", rxml_parser_context_disable_sax_q, 0);
   rb_define_method(cXMLParserContext, "docbook?", rxml_parser_context_docbook_q, 0);
   rb_define_method(cXMLParserContext, "encoding", rxml_parser_context_encoding_get, 0);
+  rb_define_method(cXMLParserContext, "id_attribute", rxml_parser_context_id_attribute_get, 0);
+  rb_define_method(cXMLParserContext, "id_attribute=", rxml_parser_context_id_attribute_set, 1);
   rb_define_method(cXMLParserContext, "encoding=", rxml_parser_context_encoding_set, 1);
   rb_define_method(cXMLParserContext, "errno", rxml_parser_context_errno_get, 0);
   rb_define_method(cXMLParserContext, "html?", rxml_parser_context_html_q, 0);
@@ -4,6 +4,10 @@
 #define __RXML_PARSER_CONTEXT__
 
 extern VALUE cXMLParserContext;
+extern const rb_data_type_t rxml_parser_context_data_type;
+
+size_t rxml_parser_context_memsize(const void *data);
+int rxml_parser_context_busy_p(xmlParserCtxtPtr ctxt);
 
 void rxml_init_parser_context(void);
 
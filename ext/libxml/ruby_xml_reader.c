@@ -51,6 +51,7 @@ VALUE cXMLReader;
 
 static ID BASE_URI_SYMBOL;
 static ID ENCODING_SYMBOL;
+static ID DOCUMENT_ATTR;
 static ID IO_ATTR;
 static ID OPTIONS_SYMBOL;
 
@@ -59,23 +60,23 @@ static void rxml_reader_free(xmlTextReaderPtr xreader)
   xmlFreeTextReader(xreader);
 }
 
-static void rxml_reader_mark(xmlTextReaderPtr xreader)
-{
-  xmlDocPtr xdoc = xmlTextReaderCurrentDoc(xreader);
-  VALUE doc = (VALUE)xdoc->_private;
-  rb_gc_mark(doc);
-}
+/* The reader's internals are private to libxml, so its size is unknown. */
+static const rb_data_type_t rxml_reader_data_type = {
+  "LibXML::XML::Reader",
+  {NULL, (RUBY_DATA_FUNC)rxml_reader_free, NULL},
+  NULL, NULL, 0
+};
 
 static VALUE rxml_reader_wrap(xmlTextReaderPtr xreader)
 {
-  return Data_Wrap_Struct(cXMLReader, NULL, rxml_reader_free, xreader);
+  return TypedData_Wrap_Struct(cXMLReader, &rxml_reader_data_type, xreader);
 }
 
 
 static xmlTextReaderPtr rxml_text_reader_get(VALUE obj)
 {
   xmlTextReaderPtr xreader;
-  Data_Get_Struct(obj, xmlTextReader, xreader);
+  TypedData_Get_Struct(obj, xmlTextReader, &rxml_reader_data_type, xreader);
   return xreader;
 }
 
@@ -90,7 +91,7 @@ VALUE rxml_reader_document(VALUE klass, VALUE doc)
   xmlDocPtr xdoc;
   xmlTextReaderPtr xreader;
 
-  Data_Get_Struct(doc, xmlDoc, xdoc);
+  TypedData_Get_Struct(doc, xmlDoc, &rxml_document_data_type, xdoc);
 
   xreader = xmlReaderWalker(xdoc);
 
@@ -158,10 +159,16 @@ static VALUE rxml_reader_file(int argc, VALUE *argv, VALUE klass)
  *
  * Creates a new reader by parsing the specified io object.
  *
+ * The io object is read in chunks with readpartial, reusing a single
+ * buffer.  Regular files are read directly from their file descriptor
+ * without holding the GVL.
+ *
  * You may provide an optional hash table to control how the
  * parsing is performed.  Valid options are:
  *
  *  base_uri - The base url for the parsed document.
+ *  chunk_size - The number of bytes to read from the io object at a
+ *               time, defaults to 65536.
  *  encoding - The document encoding, defaults to nil. Valid values
  *             are the encoding constants defined on XML::Encoding.
  *  options - Controls the execution of the parser, defaults to 0.
@@ -175,6 +182,7 @@ static VALUE rxml_reader_io(int argc, VALUE *argv, VALUE klass)
   VALUE result;
   VALUE io;
   VALUE options;
+  void *input;
   char *xbaseurl = NULL;
   const char *xencoding = NULL;
   int xoptions = 0;
@@ -199,8 +207,8 @@ static VALUE rxml_reader_io(int argc, VALUE *argv, VALUE klass)
     xoptions = NIL_P(parserOptions) ? 0 : NUM2INT(parserOptions);
   }
   
-  xreader = xmlReaderForIO((xmlInputReadCallback) rxml_read_callback, NULL,
-                           (void *) io, 
+  input = rxml_io_input_open(io, rxml_io_chunk_size(options));
+  xreader = xmlReaderForIO(rxml_io_input_callback(input), rxml_io_input_close, input,
                            xbaseurl, xencoding, xoptions);
 
   if (xreader == NULL)
@@ -214,12 +222,80 @@ static VALUE rxml_reader_io(int argc, VALUE *argv, VALUE klass)
   return result;
 }
 
+#ifdef HAVE_MMAP
+/* call-seq:
+ *    XML::Reader.mmap(path) -> XML::Reader
+ *    XML::Reader.mmap(path, :encoding => XML::Encoding::UTF_8,
+ *                           :options => XML::Parser::Options::NOENT) -> XML::Reader
+ *
+ * Creates a new reader that reads the specified file by mapping it
+ * into memory, instead of reading it into buffers.  This avoids
+ * copying large files and lets repeated reads of the same file be
+ * served from the operating system's page cache.
+ *
+ * The file must not be truncated while it is being read.  This
+ * method is not available on platforms without mmap.
+ *
+ * You may provide an optional hash table to control how the
+ * parsing is performed.  Valid options are:
+ *
+ *  encoding - The document encoding, defaults to nil. Valid values
+ *             are the encoding constants defined on XML::Encoding.
+ *  options - Controls the execution of the parser, defaults to 0.
+ *            Valid values are the constants defined on
+ *            XML::Parser::Options.  Mutliple options can be combined
+ *            by using Bitwise OR (|). 
+ */
+static VALUE rxml_reader_mmap(int argc, VALUE *argv, VALUE klass)
+{
+  xmlTextReaderPtr xreader;
+  VALUE path;
+  VALUE options;
+  void *input;
+
+  const char *xpath;
+  const char *xencoding = NULL;
+  int xoptions = 0;
+
+  rb_scan_args(argc, argv, "11", &path, &options);
+  xpath = StringValueCStr(path);
+
+  if (!NIL_P(options))
+  {
+    VALUE encoding = Qnil;
+    VALUE parserOptions = Qnil;
+
+    Check_Type(options, T_HASH);
+
+    encoding = rb_hash_aref(options, ENCODING_SYMBOL);
+    xencoding = NIL_P(encoding) ? NULL : xmlGetCharEncodingName(NUM2INT(encoding));
+
+    parserOptions = rb_hash_aref(options, OPTIONS_SYMBOL);
+    xoptions = NIL_P(parserOptions) ? 0 : NUM2INT(parserOptions);
+  }
+
+  input = rxml_mmap_input_open(xpath);
+
+  if (!input)
+    rb_sys_fail_str(path);
+
+  xreader = xmlReaderForIO(rxml_memory_read_callback, rxml_mmap_input_close, input,
+                           xpath, xencoding, xoptions);
+
+  if (xreader == NULL)
+    rxml_raise(&xmlLastError);
+
+  return rxml_reader_wrap(xreader);
+}
+#endif /* HAVE_MMAP */
+
 /* call-seq:
  *    XML::Reader.string(io) -> XML::Reader
  *    XML::Reader.string(io, :encoding => XML::Encoding::UTF_8,
  *                           :options => XML::Parser::Options::NOENT) -> XML::Parser
  *
  * Creates a new reader by parsing the specified string.
+ * The string is read in place rather than copied.
  *
  * You may provide an optional hash table to control how the
  * parsing is performed.  Valid options are:
@@ -262,8 +338,11 @@ static VALUE rxml_reader_string(int argc, VALUE *argv, VALUE klass)
     xoptions = NIL_P(parserOptions) ? 0 : NUM2INT(parserOptions);
   }
   
-  xreader = xmlReaderForMemory(StringValueCStr(string), (int)RSTRING_LEN(string),
-                               xbaseurl, xencoding, xoptions);
+  /* Read directly from the string, which is kept alive until the reader's
+     input is closed (see rxml_string_input_open). */
+  xreader = xmlReaderForIO(rxml_memory_read_callback, rxml_string_input_close,
+                           rxml_string_input_open(string),
+                           xbaseurl, xencoding, xoptions);
 
   if (xreader == NULL)
     rxml_raise(&xmlLastError);
@@ -604,7 +683,7 @@ static VALUE rxml_reader_relax_ng_validate(VALUE self, VALUE rng)
   xmlTextReaderPtr xreader = rxml_text_reader_get(self);
   xmlRelaxNGPtr xrelax;
   int status;
-  Data_Get_Struct(rng, xmlRelaxNG, xrelax);
+  TypedData_Get_Struct(rng, xmlRelaxNG, &rxml_relaxng_data_type, xrelax);
   
   status = xmlTextReaderRelaxNGSetSchema(xreader, xrelax);
   return (status == 0 ? Qtrue : Qfalse);
@@ -629,7 +708,7 @@ rxml_reader_schema_validate(VALUE self, VALUE xsd)
   xmlSchemaPtr xschema;
   int status;
 
-  Data_Get_Struct(xsd, xmlSchema, xschema);
+  TypedData_Get_Struct(xsd, xmlSchema, &rxml_schema_data_type, xschema);
   status = xmlTextReaderSetSchema(xreader, xschema);
   return (status == 0 ? Qtrue : Qfalse);
 }
@@ -1004,6 +1083,206 @@ static VALUE rxml_reader_expand(VALUE self)
   }
 }
 
+#ifdef LIBXML_PATTERN_ENABLED
+typedef struct
+{
+  VALUE self;
+  xmlTextReaderPtr xreader;
+  xmlPatternPtr xpattern;
+  xmlStreamCtxtPtr xstream;
+  int expand;
+} rxml_reader_match;
+
+static int rxml_reader_match_namespace(VALUE prefix, VALUE uri, VALUE data)
+{
+  VALUE namespaces = data;
+  rb_ary_push(namespaces, rb_obj_as_string(uri));
+  rb_ary_push(namespaces, rb_obj_as_string(prefix));
+  return ST_CONTINUE;
+}
+
+/* Pushes an element and its ancestors, outermost first, and returns
+   how many were pushed */
+static int rxml_reader_match_ancestors(rxml_reader_match *match, xmlNodePtr xnode)
+{
+  int pushed;
+
+  if (!xnode || xnode->type != XML_ELEMENT_NODE)
+    return 0;
+
+  pushed = rxml_reader_match_ancestors(match, xnode->parent);
+
+  if (xmlStreamPush(match->xstream, xnode->name, xnode->ns ? xnode->ns->href : NULL) < 0)
+    rb_raise(rb_eRuntimeError, "Could not match the element against the pattern");
+
+  return pushed + 1;
+}
+
+static VALUE rxml_reader_match_each(VALUE data)
+{
+  rxml_reader_match *match = (rxml_reader_match*)data;
+  xmlTextReaderPtr xreader = match->xreader;
+  xmlNodePtr xnode;
+  int pushed;
+  int status;
+
+  /* Start with the document node so absolute patterns can match */
+  if (xmlStreamPush(match->xstream, NULL, NULL) < 0)
+    rb_raise(rb_eRuntimeError, "Could not initialize the pattern stream");
+
+  /* If the reader already moved, the elements it is inside of have been
+     read.  Push them too so that patterns see the same path as if the
+     stream had started at the beginning of the document. */
+  xmlTextReaderMoveToElement(xreader);
+  xnode = xmlTextReaderCurrentNode(xreader);
+  if (xnode && xnode->type != XML_ELEMENT_NODE)
+    xnode = xnode->parent;
+  pushed = rxml_reader_match_ancestors(match, xnode);
+
+  status = xmlTextReaderRead(xreader);
+
+  while (status == 1)
+  {
+    rb_thread_check_ints();
+
+    if (xmlTextReaderNodeType(xreader) == XML_READER_TYPE_ELEMENT)
+    {
+      int depth = xmlTextReaderDepth(xreader);
+      int matched;
+
+      /* Sync the stream with the reader's depth, which also covers end
+         tags, empty elements and subtrees skipped by the block */
+      for (; pushed > depth; pushed--)
+        xmlStreamPop(match->xstream);
+
+      matched = xmlStreamPush(match->xstream, xmlTextReaderConstLocalName(xreader),
+                              xmlTextReaderConstNamespaceUri(xreader));
+      pushed++;
+
+      if (matched < 0)
+        rb_raise(rb_eRuntimeError, "Could not match the element against the pattern");
+
+      if (matched == 1 && match->expand)
+      {
+        xmlNodePtr xnode = xmlTextReaderCurrentNode(xreader);
+        rb_yield_values(2, match->self, rxml_reader_expand(match->self));
+
+        /* Continue after the subtree, unless the block moved the reader */
+        if (xmlTextReaderCurrentNode(xreader) == xnode &&
+            xmlTextReaderDepth(xreader) == depth)
+        {
+          status = xmlTextReaderNext(xreader);
+          continue;
+        }
+      }
+      else if (matched == 1)
+      {
+        rb_yield(match->self);
+      }
+    }
+
+    status = xmlTextReaderRead(xreader);
+  }
+
+  if (status == -1)
+    rxml_raise(&xmlLastError);
+
+  return match->self;
+}
+
+static VALUE rxml_reader_match_free(VALUE data)
+{
+  rxml_reader_match *match = (rxml_reader_match*)data;
+  xmlFreeStreamCtxt(match->xstream);
+  xmlFreePattern(match->xpattern);
+  return Qnil;
+}
+
+/*
+ * call-seq:
+ *    reader.each_match(pattern) {|reader| ... } -> reader
+ *    reader.each_match([pattern, ...], :namespaces => {'p' => 'urn:p'}) {|reader| ... } -> reader
+ *    reader.each_match(pattern, :expand => true) {|reader, node| ... } -> reader
+ *
+ * Reads the rest of the document and yields the reader each time it
+ * is positioned on an element matching one of the patterns.  If the
+ * reader is already inside the document, for example positioned on an
+ * element, patterns match against the element's full path, but the
+ * element itself and the nodes read before it are not reported.  Patterns
+ * use the streamable subset of XPath understood by libxml's pattern
+ * module, for example "item", "/feed/entry", "//p:price" or
+ * "entry/title".  Prefixes are resolved with the :namespaces hash.
+ *
+ * Non-matching nodes are read without calling back into Ruby, which makes
+ * this far cheaper than a #read loop when only a few nodes are of
+ * interest.
+ *
+ * With :expand, the matching element is expanded (see #expand) and
+ * passed to the block as well.  Afterwards reading continues after the
+ * element, so matches inside it are not reported.  The node is only
+ * valid until the block returns.
+ *
+ *  reader = XML::Reader.file('feed.xml')
+ *  reader.each_match('/feed/entry', :expand => true) do |reader, entry|
+ *    puts entry['id']
+ *  end
+ */
+static VALUE rxml_reader_each_match(int argc, VALUE *argv, VALUE self)
+{
+  rxml_reader_match match;
+  VALUE patterns, options, namespaces = Qnil, nslist;
+  const xmlChar **xnamespaces = NULL;
+  long i;
+
+  RETURN_ENUMERATOR(self, argc, argv);
+  rb_scan_args(argc, argv, "11", &patterns, &options);
+
+  if (!NIL_P(options))
+  {
+    Check_Type(options, T_HASH);
+    namespaces = rb_hash_aref(options, ID2SYM(rb_intern("namespaces")));
+    match.expand = RTEST(rb_hash_aref(options, ID2SYM(rb_intern("expand"))));
+  }
+  else
+  {
+    match.expand = 0;
+  }
+
+  /* The pattern module separates alternatives with | */
+  patterns = rb_ary_join(rb_Array(patterns), rb_str_new2("|"));
+
+  /* Namespaces are passed as a NULL terminated list of uri, prefix pairs */
+  nslist = rb_ary_new();
+  if (!NIL_P(namespaces))
+  {
+    Check_Type(namespaces, T_HASH);
+    rb_hash_foreach(namespaces, rxml_reader_match_namespace, nslist);
+    xnamespaces = ALLOCA_N(const xmlChar*, RARRAY_LEN(nslist) + 2);
+    for (i = 0; i < RARRAY_LEN(nslist); i++)
+      xnamespaces[i] = (const xmlChar*)StringValueCStr(RARRAY_PTR(nslist)[i]);
+    xnamespaces[i] = NULL;
+    xnamespaces[i + 1] = NULL;
+  }
+
+  match.self = self;
+  match.xreader = rxml_text_reader_get(self);
+  match.xpattern = xmlPatterncompile((const xmlChar*)StringValueCStr(patterns), NULL, 0, xnamespaces);
+
+  if (!match.xpattern)
+    rb_raise(rb_eArgError, "Invalid pattern: %s", StringValueCStr(patterns));
+
+  match.xstream = xmlPatternGetStreamCtxt(match.xpattern);
+  if (!match.xstream)
+  {
+    xmlFreePattern(match.xpattern);
+    rb_raise(rb_eArgError, "Pattern cannot be matched while streaming: %s", StringValueCStr(patterns));
+  }
+
+  RB_GC_GUARD(nslist);
+  return rb_ensure(rxml_reader_match_each, (VALUE)&match, rxml_reader_match_free, (VALUE)&match);
+}
+#endif
+
 /*
 * call-seq:
 *    reader.document -> doc
@@ -1025,8 +1304,8 @@ static VALUE rxml_reader_doc(VALUE self)
 
   result = rxml_document_wrap(xdoc);
 
-  // And now hook in a mark function to keep the document alive as long as the reader is valid
-  RDATA(self)->dmark = (RUBY_DATA_FUNC)rxml_reader_mark;
+  // And now keep the document alive as long as the reader is valid
+  rb_ivar_set(self, DOCUMENT_ATTR, result);
 
   return result;
 }
@@ -1131,14 +1410,21 @@ void rxml_init_reader(void)
 {
   BASE_URI_SYMBOL = ID2SYM(rb_intern("base_uri"));
   ENCODING_SYMBOL = ID2SYM(rb_intern("encoding"));
+  DOCUMENT_ATTR = rb_intern("@document");
   IO_ATTR = rb_intern("@io");
   OPTIONS_SYMBOL = ID2SYM(rb_intern("options"));
 
   cXMLReader = rb_define_class_under(mXML, "Reader", rb_cObject);
+  rb_undef_alloc_func(cXMLReader);
 
   rb_define_singleton_method(cXMLReader, "document", rxml_reader_document, 1);
   rb_define_singleton_method(cXMLReader, "file", rxml_reader_file, -1);
   rb_define_singleton_method(cXMLReader, "io", rxml_reader_io, -1);
+#ifdef HAVE_MMAP
+  rb_define_singleton_method(cXMLReader, "mmap", rxml_reader_mmap, -1);
+#else
+  rb_define_singleton_method(cXMLReader, "mmap", rb_f_notimplement, -1);
+#endif
   rb_define_singleton_method(cXMLReader, "string", rxml_reader_string, -1);
 
   rb_define_method(cXMLReader, "[]", rxml_reader_attribute, 1);
@@ -1153,6 +1439,11 @@ void rxml_init_reader(void)
 #endif
   rb_define_method(cXMLReader, "depth", rxml_reader_depth, 0);
   rb_define_method(cXMLReader, "doc", rxml_reader_doc, 0);
+#ifdef LIBXML_PATTERN_ENABLED
+  rb_define_method(cXMLReader, "each_match", rxml_reader_each_match, -1);
+#else
+  rb_define_method(cXMLReader, "each_match", rb_f_notimplement, -1);
+#endif
   rb_define_method(cXMLReader, "encoding", rxml_reader_encoding, 0);
   rb_define_method(cXMLReader, "expand", rxml_reader_expand, 0);
   rb_define_method(cXMLReader, "get_attribute", rxml_reader_get_attribute, 1);
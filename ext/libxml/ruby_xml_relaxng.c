@@ -37,6 +37,13 @@ static void rxml_relaxng_free(xmlRelaxNGPtr xrelaxng)
   xmlRelaxNGFree(xrelaxng);
 }
 
+/* The schema's internals are private to libxml, so its size is unknown. */
+const rb_data_type_t rxml_relaxng_data_type = {
+  "LibXML::XML::RelaxNG",
+  {NULL, (RUBY_DATA_FUNC)rxml_relaxng_free, NULL},
+  NULL, NULL, RUBY_TYPED_FREE_IMMEDIATELY
+};
+
 /*
  * call-seq:
  *    XML::Relaxng.new(relaxng_uri) -> relaxng
@@ -54,7 +61,7 @@ static VALUE rxml_relaxng_init_from_uri(VALUE class, VALUE uri)
   xrelaxng = xmlRelaxNGParse(xparser);
   xmlRelaxNGFreeParserCtxt(xparser);
 
-  return Data_Wrap_Struct(cXMLRelaxNG, NULL, rxml_relaxng_free, xrelaxng);
+  return TypedData_Wrap_Struct(cXMLRelaxNG, &rxml_relaxng_data_type, xrelaxng);
 }
 
 /*
@@ -69,13 +76,13 @@ static VALUE rxml_relaxng_init_from_document(VALUE class, VALUE document)
   xmlRelaxNGPtr xrelaxng;
   xmlRelaxNGParserCtxtPtr xparser;
 
-  Data_Get_Struct(document, xmlDoc, xdoc);
+  TypedData_Get_Struct(document, xmlDoc, &rxml_document_data_type, xdoc);
 
   xparser = xmlRelaxNGNewDocParserCtxt(xdoc);
   xrelaxng = xmlRelaxNGParse(xparser);
   xmlRelaxNGFreeParserCtxt(xparser);
 
-  return Data_Wrap_Struct(cXMLRelaxNG, NULL, rxml_relaxng_free, xrelaxng);
+  return TypedData_Wrap_Struct(cXMLRelaxNG, &rxml_relaxng_data_type, xrelaxng);
 }
 
 /*
@@ -95,12 +102,13 @@ static VALUE rxml_relaxng_init_from_string(VALUE self, VALUE relaxng_str)
   xrelaxng = xmlRelaxNGParse(xparser);
   xmlRelaxNGFreeParserCtxt(xparser);
 
-  return Data_Wrap_Struct(cXMLRelaxNG, NULL, rxml_relaxng_free, xrelaxng);
+  return TypedData_Wrap_Struct(cXMLRelaxNG, &rxml_relaxng_data_type, xrelaxng);
 }
 
 void rxml_init_relaxng(void)
 {
   cXMLRelaxNG = rb_define_class_under(mXML, "RelaxNG", rb_cObject);
+  rb_undef_alloc_func(cXMLRelaxNG);
   rb_define_singleton_method(cXMLRelaxNG, "new", rxml_relaxng_init_from_uri, 1);
   rb_define_singleton_method(cXMLRelaxNG, "from_string",
       rxml_relaxng_init_from_string, 1);
@@ -4,6 +4,7 @@
 #include <libxml/relaxng.h>
 
 extern VALUE cXMLRelaxNG;
+extern const rb_data_type_t rxml_relaxng_data_type;
 
 void  rxml_init_relaxng(void);
 #endif
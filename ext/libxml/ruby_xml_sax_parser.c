@@ -33,7 +33,14 @@
  *   parser.parse
  *
  * You can also parse strings (see XML::SaxParser.string) and
- * io objects (see XML::SaxParser.io).
+ * io objects (see XML::SaxParser.io).  To parse data as it
+ * arrives, create a push parser and feed it chunks:
+ *
+ *   parser = XML::SaxParser.push
+ *   parser.callbacks = MyCallbacks.new
+ *   parser.feed(chunk)
+ *   ...
+ *   parser.finish
  */
 
 VALUE cXMLSaxParser;
@@ -65,23 +72,19 @@ static VALUE rxml_sax_parser_initialize(int argc, VALUE *argv, VALUE self)
   return self;
 }
 
-/*
- * call-seq:
- *    parser.parse -> (true|false)
- *
- * Parse the input XML, generating callbacks to the object
- * registered via the +callbacks+ attributesibute.
- */
-static VALUE rxml_sax_parser_parse(VALUE self)
+static xmlParserCtxtPtr rxml_sax_parser_context(VALUE self)
 {
-  int status;
   VALUE context = rb_ivar_get(self, CONTEXT_ATTR);
   xmlParserCtxtPtr ctxt;
-  Data_Get_Struct(context, xmlParserCtxt, ctxt);
+  TypedData_Get_Struct(context, xmlParserCtxt, &rxml_parser_context_data_type, ctxt);
 
   ctxt->sax2 = 1;
 	ctxt->userData = (void*)rb_ivar_get(self, CALLBACKS_ATTR);
 
+  /* A push parser keeps its handler between chunks */
+  if (ctxt->sax && ctxt->sax->startElementNs == rxml_sax_handler.startElementNs)
+    return ctxt;
+
   if (ctxt->sax != (xmlSAXHandlerPtr) &xmlDefaultSAXHandler)
     xmlFree(ctxt->sax);
     
@@ -89,7 +92,36 @@ static VALUE rxml_sax_parser_parse(VALUE self)
   if (ctxt->sax == NULL)
     rb_fatal("Not enough memory.");
   memcpy(ctxt->sax, &rxml_sax_handler, sizeof(rxml_sax_handler));
-    
+
+  return ctxt;
+}
+
+static VALUE rxml_sax_parser_release(VALUE value)
+{
+  xmlParserCtxtPtr ctxt = (xmlParserCtxtPtr)value;
+  ctxt->_private = NULL;
+  return Qnil;
+}
+
+/* Calls func with the parser's context marked busy.  Callbacks run Ruby
+   code, which could otherwise parse, feed or finish the same context
+   again while libxml is still inside it. */
+static VALUE rxml_sax_parser_exclusive(VALUE self, VALUE (*func)(VALUE), VALUE arg)
+{
+  xmlParserCtxtPtr ctxt = rxml_sax_parser_context(self);
+
+  if (rxml_parser_context_busy_p(ctxt))
+    rb_raise(rb_eRuntimeError, "The parser context is already being parsed");
+
+  ctxt->_private = ctxt;
+  return rb_ensure(func, arg, rxml_sax_parser_release, (VALUE)ctxt);
+}
+
+static VALUE rxml_sax_parser_parse_exclusive(VALUE self)
+{
+  int status;
+  xmlParserCtxtPtr ctxt = rxml_sax_parser_context(self);
+
   status = xmlParseDocument(ctxt);
 
   /* Now check the parsing result*/
@@ -100,6 +132,105 @@ static VALUE rxml_sax_parser_parse(VALUE self)
   return Qtrue;
 }
 
+/*
+ * call-seq:
+ *    parser.parse -> (true|false)
+ *
+ * Parse the input XML, generating callbacks to the object
+ * registered via the +callbacks+ attributesibute.
+ */
+static VALUE rxml_sax_parser_parse(VALUE self)
+{
+  return rxml_sax_parser_exclusive(self, rxml_sax_parser_parse_exclusive, self);
+}
+
+static VALUE rxml_sax_parser_feed_locked(VALUE value)
+{
+  VALUE *args = (VALUE*)value;
+  VALUE self = args[0];
+  VALUE chunk = args[1];
+  xmlParserCtxtPtr ctxt = rxml_sax_parser_context(self);
+  long size = RSTRING_LEN(chunk);
+  long offset = 0;
+
+  /* xmlParseChunk takes an int length */
+  do
+  {
+    int length = (size - offset > INT_MAX) ? INT_MAX : (int)(size - offset);
+    xmlParseChunk(ctxt, RSTRING_PTR(chunk) + offset, length, 0);
+    offset += length;
+  }
+  while (offset < size && ctxt->wellFormed);
+
+  if (!ctxt->wellFormed)
+  {
+    rxml_raise(&ctxt->lastError);
+  }
+  return self;
+}
+
+static VALUE rxml_sax_parser_feed_exclusive(VALUE value)
+{
+  VALUE *args = (VALUE*)value;
+
+  /* Keep callbacks and other threads from modifying the chunk while it
+     is parsed, a callback that raises still unlocks it */
+  rb_str_locktmp(args[1]);
+  return rb_ensure(rxml_sax_parser_feed_locked, value, rb_str_unlocktmp, args[1]);
+}
+
+/*
+ * call-seq:
+ *    parser.feed(chunk) -> XML::SaxParser
+ *
+ * Parses the next chunk of xml for a parser created from a
+ * push context (see XML::SaxParser.push), generating callbacks
+ * for everything in the chunk that can be parsed so far.  Chunks
+ * may be split anywhere.  Once all the input has been fed, call
+ * XML::SaxParser#finish.
+ *
+ * This makes it possible to drive the parser from an event loop,
+ * feeding it data as it arrives instead of blocking on an io object.
+ * Calling parse, feed or finish from a callback raises a
+ * RuntimeError.
+ */
+static VALUE rxml_sax_parser_feed(VALUE self, VALUE chunk)
+{
+  VALUE args[2];
+
+  StringValue(chunk);
+  args[0] = self;
+  args[1] = chunk;
+
+  return rxml_sax_parser_exclusive(self, rxml_sax_parser_feed_exclusive, (VALUE)args);
+}
+
+static VALUE rxml_sax_parser_finish_exclusive(VALUE self)
+{
+  xmlParserCtxtPtr ctxt = rxml_sax_parser_context(self);
+  xmlParseChunk(ctxt, NULL, 0, 1);
+
+  if (!ctxt->wellFormed)
+  {
+    rxml_raise(&ctxt->lastError);
+  }
+  return Qtrue;
+}
+
+/*
+ * call-seq:
+ *    parser.finish -> (true|false)
+ *
+ * Tells a parser created from a push context that all the
+ * input has been fed (see XML::SaxParser#feed), which
+ * generates the remaining callbacks.  If the document is
+ * incomplete or malformed, an XML::Error is raised.
+ */
+static VALUE rxml_sax_parser_finish(VALUE self)
+{
+  return rxml_sax_parser_exclusive(self, rxml_sax_parser_finish_exclusive, self);
+}
+
 void rxml_init_sax_parser(void)
 {
   /* SaxParser */
@@ -113,4 +244,6 @@ void rxml_init_sax_parser(void)
   /* Instance Methods */
   rb_define_method(cXMLSaxParser, "initialize", rxml_sax_parser_initialize, -1);
   rb_define_method(cXMLSaxParser, "parse", rxml_sax_parser_parse, 0);
+  rb_define_method(cXMLSaxParser, "feed", rxml_sax_parser_feed, 1);
+  rb_define_method(cXMLSaxParser, "finish", rxml_sax_parser_finish, 0);
 }
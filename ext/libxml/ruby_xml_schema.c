@@ -44,9 +44,26 @@ static void rxml_schema_free(xmlSchemaPtr xschema)
   xmlSchemaFree(xschema);
 }
 
+static size_t rxml_schema_memsize(const void *data)
+{
+  const xmlSchema *xschema = (const xmlSchema *)data;
+  size_t size = sizeof(xmlSchema);
+
+  if (xschema->dict)
+    size += xmlDictGetUsage(xschema->dict);
+
+  return size;
+}
+
+const rb_data_type_t rxml_schema_data_type = {
+  "LibXML::XML::Schema",
+  {NULL, (RUBY_DATA_FUNC)rxml_schema_free, rxml_schema_memsize},
+  NULL, NULL, RUBY_TYPED_FREE_IMMEDIATELY
+};
+
 VALUE rxml_wrap_schema(xmlSchemaPtr xschema)
 {
-  return Data_Wrap_Struct(cXMLSchema, NULL, rxml_schema_free, xschema);
+  return TypedData_Wrap_Struct(cXMLSchema, &rxml_schema_data_type, xschema);
 }
 
 
@@ -67,7 +84,7 @@ static VALUE rxml_schema_init_from_uri(VALUE class, VALUE uri)
   xschema = xmlSchemaParse(xparser);
   xmlSchemaFreeParserCtxt(xparser);
 
-  return Data_Wrap_Struct(cXMLSchema, NULL, rxml_schema_free, xschema);
+  return TypedData_Wrap_Struct(cXMLSchema, &rxml_schema_data_type, xschema);
 }
 
 /*
@@ -82,7 +99,7 @@ static VALUE rxml_schema_init_from_document(VALUE class, VALUE document)
   xmlSchemaPtr xschema;
   xmlSchemaParserCtxtPtr xparser;
 
-  Data_Get_Struct(document, xmlDoc, xdoc);
+  TypedData_Get_Struct(document, xmlDoc, &rxml_document_data_type, xdoc);
 
   xparser = xmlSchemaNewDocParserCtxt(xdoc);
   xschema = xmlSchemaParse(xparser);
@@ -91,7 +108,7 @@ static VALUE rxml_schema_init_from_document(VALUE class, VALUE document)
   if (xschema == NULL)
     return Qnil;
 
-  return Data_Wrap_Struct(cXMLSchema, NULL, rxml_schema_free, xschema);
+  return TypedData_Wrap_Struct(cXMLSchema, &rxml_schema_data_type, xschema);
 }
 
 /*
@@ -111,7 +128,7 @@ static VALUE rxml_schema_init_from_string(VALUE self, VALUE schema_str)
   xschema = xmlSchemaParse(xparser);
   xmlSchemaFreeParserCtxt(xparser);
 
-  return Data_Wrap_Struct(cXMLSchema, NULL, rxml_schema_free, xschema);
+  return TypedData_Wrap_Struct(cXMLSchema, &rxml_schema_data_type, xschema);
 }
 
 
@@ -119,7 +136,7 @@ static VALUE rxml_schema_target_namespace(VALUE self)
 {
   xmlSchemaPtr xschema;
 
-  Data_Get_Struct(self, xmlSchema, xschema);
+  TypedData_Get_Struct(self, xmlSchema, &rxml_schema_data_type, xschema);
 
   QNIL_OR_STRING(xschema->targetNamespace)
 }
@@ -128,7 +145,7 @@ static VALUE rxml_schema_name(VALUE self)
 {
   xmlSchemaPtr xschema;
 
-  Data_Get_Struct(self, xmlSchema, xschema);
+  TypedData_Get_Struct(self, xmlSchema, &rxml_schema_data_type, xschema);
 
   QNIL_OR_STRING(xschema->name)
 }
@@ -137,7 +154,7 @@ static VALUE rxml_schema_version(VALUE self)
 {
   xmlSchemaPtr xschema;
 
-  Data_Get_Struct(self, xmlSchema, xschema);
+  TypedData_Get_Struct(self, xmlSchema, &rxml_schema_data_type, xschema);
 
   QNIL_OR_STRING(xschema->version)
 }
@@ -146,7 +163,7 @@ static VALUE rxml_schema_id(VALUE self)
 {
   xmlSchemaPtr xschema;
 
-  Data_Get_Struct(self, xmlSchema, xschema);
+  TypedData_Get_Struct(self, xmlSchema, &rxml_schema_data_type, xschema);
 
   QNIL_OR_STRING(xschema->id)
 }
@@ -155,7 +172,7 @@ static VALUE rxml_schema_document(VALUE self)
 {
   xmlSchemaPtr xschema;
 
-  Data_Get_Struct(self, xmlSchema, xschema);
+  TypedData_Get_Struct(self, xmlSchema, &rxml_schema_data_type, xschema);
 
   return rxml_node_wrap(xmlDocGetRootElement(xschema->doc));
 }
@@ -184,7 +201,7 @@ static VALUE rxml_schema_namespaces(VALUE self)
   VALUE result;
   xmlSchemaPtr xschema;
 
-  Data_Get_Struct(self, xmlSchema, xschema);
+  TypedData_Get_Struct(self, xmlSchema, &rxml_schema_data_type, xschema);
 
   result = rb_ary_new();
   xmlHashScan(xschema->schemasImports, (xmlHashScanner)scan_namespaces, (void *)result);
@@ -203,7 +220,7 @@ static VALUE rxml_schema_elements(VALUE self)
   VALUE result = rb_hash_new();
   xmlSchemaPtr xschema;
 
-  Data_Get_Struct(self, xmlSchema, xschema);
+  TypedData_Get_Struct(self, xmlSchema, &rxml_schema_data_type, xschema);
   xmlHashScan(xschema->elemDecl, (xmlHashScanner)scan_element, (void *)result);
 
   return result;
@@ -220,7 +237,7 @@ static VALUE rxml_schema_types(VALUE self)
 	VALUE result = rb_hash_new();
 	xmlSchemaPtr xschema;
 
-	Data_Get_Struct(self, xmlSchema, xschema);
+	TypedData_Get_Struct(self, xmlSchema, &rxml_schema_data_type, xschema);
 
 	if (xschema != NULL && xschema->typeDecl != NULL)
 	{
@@ -243,7 +260,7 @@ static VALUE rxml_schema_imported_types(VALUE self)
   xmlSchemaPtr xschema;
   VALUE result = rb_hash_new();
 
-  Data_Get_Struct(self, xmlSchema, xschema);
+  TypedData_Get_Struct(self, xmlSchema, &rxml_schema_data_type, xschema);
 
   if (xschema)
   {
@@ -256,6 +273,7 @@ static VALUE rxml_schema_imported_types(VALUE self)
 void rxml_init_schema(void)
 {
   cXMLSchema = rb_define_class_under(mXML, "Schema", rb_cObject);
+  rb_undef_alloc_func(cXMLSchema);
   rb_define_singleton_method(cXMLSchema, "new", rxml_schema_init_from_uri, 1);
   rb_define_singleton_method(cXMLSchema, "from_string", rxml_schema_init_from_string, 1);
   rb_define_singleton_method(cXMLSchema, "document", rxml_schema_init_from_document, 1);
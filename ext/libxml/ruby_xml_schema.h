@@ -6,6 +6,7 @@
 #include <libxml/xmlschemastypes.h>
 
 extern VALUE cXMLSchema;
+extern const rb_data_type_t rxml_schema_data_type;
 
 void rxml_init_schema(void);
 
@@ -86,16 +86,34 @@ static void rxml_writer_mark(rxml_writer_object *rwo)
     }
 }
 
+static size_t rxml_writer_memsize(const void *data)
+{
+    const rxml_writer_object *rwo = (const rxml_writer_object *) data;
+    size_t size = sizeof(rxml_writer_object);
+
+    if (NULL != rwo->buffer) {
+        size += rwo->buffer->size;
+    }
+
+    return size;
+}
+
+static const rb_data_type_t rxml_writer_data_type = {
+    "LibXML::XML::Writer",
+    {(RUBY_DATA_FUNC) rxml_writer_mark, (RUBY_DATA_FUNC) rxml_writer_free, rxml_writer_memsize},
+    NULL, NULL, 0
+};
+
 static VALUE rxml_writer_wrap(rxml_writer_object *rwo)
 {
-    return Data_Wrap_Struct(cXMLWriter, rxml_writer_mark, rxml_writer_free, rwo);
+    return TypedData_Wrap_Struct(cXMLWriter, &rxml_writer_data_type, rwo);
 }
 
 static rxml_writer_object *rxml_textwriter_get(VALUE obj)
 {
     rxml_writer_object *rwo;
 
-    Data_Get_Struct(obj, rxml_writer_object, rwo);
+    TypedData_Get_Struct(obj, rxml_writer_object, &rxml_writer_data_type, rwo);
 
     return rwo;
 }
@@ -1064,6 +1082,7 @@ void rxml_init_writer(void)
     sStandalone = ID2SYM(rb_intern("standalone"));
 
     cXMLWriter = rb_define_class_under(mXML, "Writer", rb_cObject);
+    rb_undef_alloc_func(cXMLWriter);
 
 #ifdef LIBXML_WRITER_ENABLED
     rb_define_singleton_method(cXMLWriter, "io", rxml_writer_io, 1);
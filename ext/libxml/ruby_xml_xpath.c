@@ -78,7 +78,9 @@
 
 VALUE mXPath;
 
-VALUE rxml_xpath_to_value(xmlXPathContextPtr xctxt, xmlXPathObjectPtr xobject)
+/* Converts an XPath result to a Ruby value and frees it.  namespaces is
+   passed on to rxml_xpath_object_wrap. */
+VALUE rxml_xpath_to_value(xmlXPathContextPtr xctxt, xmlXPathObjectPtr xobject, int namespaces)
 {
   VALUE result;
   int type;
@@ -95,7 +97,7 @@ VALUE rxml_xpath_to_value(xmlXPathContextPtr xctxt, xmlXPathObjectPtr xobject)
   switch (type = xobject->type)
   {
     case XPATH_NODESET:
-      result = rxml_xpath_object_wrap(xctxt->doc, xobject);
+      result = rxml_xpath_object_wrap(xctxt->doc, xobject, namespaces);
       break;
     case XPATH_BOOLEAN:
       result = (xobject->boolval != 0) ? Qtrue : Qfalse;
@@ -119,10 +121,70 @@ VALUE rxml_xpath_to_value(xmlXPathContextPtr xctxt, xmlXPathObjectPtr xobject)
   return result;
 }
 
-xmlXPathObjectPtr rxml_xpath_from_value(VALUE value)
+/* Nodes handed to libxml from Ruby are only kept alive by their Ruby
+   objects, which the XPath result does not reference.  Only accept
+   nodes that are part of the given document's tree, since the document
+   outlives the result. */
+static void rxml_xpath_check_node(xmlDocPtr xdoc, xmlNodePtr xnode)
+{
+  xmlNodePtr xtop;
+
+  /* Namespace nodes in a node set point to their element */
+  if (xnode->type == XML_NAMESPACE_DECL)
+  {
+    xnode = (xmlNodePtr)((xmlNsPtr)xnode)->next;
+    if (xnode == NULL || xnode->type == XML_NAMESPACE_DECL)
+      return;
+  }
+
+  for (xtop = xnode; xtop->parent != NULL; xtop = xtop->parent);
+
+  if (xnode->doc != xdoc || xtop != (xmlNodePtr)xdoc)
+    rb_raise(eXMLError, "XPath values must be nodes of the document being queried");
+}
+
+static void rxml_xpath_check_value(xmlDocPtr xdoc, VALUE value)
+{
+  long i;
+
+  switch (TYPE(value))
+  {
+  case T_ARRAY:
+    for (i = 0; i < RARRAY_LEN(value); i++)
+      rxml_xpath_check_value(xdoc, rb_ary_entry(value, i));
+    break;
+  case T_DATA:
+    if (rb_obj_is_kind_of(value, cXMLNode) || rb_obj_is_kind_of(value, cXMLAttr))
+    {
+      xmlNodePtr xnode;
+      Data_Get_Struct(value, xmlNode, xnode);
+      rxml_xpath_check_node(xdoc, xnode);
+    }
+    else if (rb_obj_is_kind_of(value, cXMLXPathObject))
+    {
+      xmlNodeSetPtr xnodes = rxml_xpath_object_nodeset(value);
+      if (xnodes)
+      {
+        for (i = 0; i < xnodes->nodeNr; i++)
+          rxml_xpath_check_node(xdoc, xnodes->nodeTab[i]);
+      }
+    }
+    break;
+  default:
+    break;
+  }
+}
+
+/* Converts a Ruby value to an XPath object.  If xdoc is not NULL, nodes
+   must belong to its tree. */
+xmlXPathObjectPtr rxml_xpath_from_value(VALUE value, xmlDocPtr xdoc)
 {
   xmlXPathObjectPtr result = NULL;
 
+  /* Check first so nothing allocated below leaks when raising */
+  if (xdoc)
+    rxml_xpath_check_value(xdoc, value);
+
   switch (TYPE(value))
   {
   case T_TRUE:
@@ -130,6 +192,7 @@ xmlXPathObjectPtr rxml_xpath_from_value(VALUE value)
     result = xmlXPathNewBoolean(RTEST(value));
     break;
   case T_FIXNUM:
+  case T_BIGNUM:
   case T_FLOAT:
     result = xmlXPathNewFloat(NUM2DBL(value));
     break;
@@ -144,9 +207,9 @@ xmlXPathObjectPtr rxml_xpath_from_value(VALUE value)
     long i, j;
     result = xmlXPathNewNodeSet(NULL);
 
-    for (i = RARRAY_LEN(value); i > 0; i--)
+    for (i = 0; i < RARRAY_LEN(value); i++)
     {
-      xmlXPathObjectPtr obj = rxml_xpath_from_value(rb_ary_shift(value));
+      xmlXPathObjectPtr obj = rxml_xpath_from_value(rb_ary_entry(value, i), NULL);
 
       if ((obj->nodesetval != NULL) && (obj->nodesetval->nodeNr != 0))
       {
@@ -155,9 +218,34 @@ xmlXPathObjectPtr rxml_xpath_from_value(VALUE value)
           xmlXPathNodeSetAdd(result->nodesetval, obj->nodesetval->nodeTab[j]);
         }
       }
+      xmlXPathFreeObject(obj);
     }
     break;
   }
+  case T_DATA:
+    if (rb_obj_is_kind_of(value, cXMLNode))
+    {
+      xmlNodePtr xnode;
+      Data_Get_Struct(value, xmlNode, xnode);
+      result = xmlXPathNewNodeSet(xnode);
+      break;
+    }
+    else if (rb_obj_is_kind_of(value, cXMLAttr))
+    {
+      xmlAttrPtr xattr;
+      Data_Get_Struct(value, xmlAttr, xattr);
+      result = xmlXPathNewNodeSet((xmlNodePtr)xattr);
+      break;
+    }
+    else if (rb_obj_is_kind_of(value, cXMLXPathObject))
+    {
+      xmlNodeSetPtr xnodes = rxml_xpath_object_nodeset(value);
+      result = xmlXPathNewNodeSet(NULL);
+      if (xnodes)
+        xmlXPathNodeSetMerge(result->nodesetval, xnodes);
+      break;
+    }
+    /* fall through */
   default:
     rb_raise(rb_eTypeError,
       "can't convert object of type %s to XPath object", rb_obj_classname(value)
@@ -167,10 +255,44 @@ xmlXPathObjectPtr rxml_xpath_from_value(VALUE value)
   return result;
 }
 
+/*
+ * call-seq:
+ *    XPath.string(value) -> String
+ *
+ * Converts a value returned by XPath::Context#find, or a node, to a
+ * String the way the XPath string() function does.  Unlike Ruby's
+ * to_s, integral numbers have no fraction and special numbers are
+ * named as in XPath:
+ *
+ *  XML::XPath.string(2.0)           # => "2"
+ *  XML::XPath.string(Float::NAN)    # => "NaN"
+ *  XML::XPath.string(true)          # => "true"
+ */
+static VALUE rxml_xpath_string(VALUE self, VALUE value)
+{
+  xmlXPathObjectPtr xobject;
+  xmlChar *xstring;
+  VALUE result;
+
+  if (TYPE(value) == T_STRING)
+    return value;
+
+  xobject = rxml_xpath_from_value(value, NULL);
+  xstring = xmlXPathCastToString(xobject);
+  xmlXPathFreeObject(xobject);
+
+  result = rxml_new_cstr(xstring, NULL);
+  xmlFree(xstring);
+
+  return result;
+}
+
 void rxml_init_xpath(void)
 {
   mXPath = rb_define_module_under(mXML, "XPath");
 
+  rb_define_module_function(mXPath, "string", rxml_xpath_string, 1);
+
   /* 0: Undefined value. */
   rb_define_const(mXPath, "UNDEFINED", INT2NUM(XPATH_UNDEFINED));
   /* 1: A nodeset, will be wrapped by XPath Object. */
@@ -7,7 +7,7 @@ extern VALUE mXPath;
 
 void rxml_init_xpath(void);
 
-VALUE rxml_xpath_to_value(xmlXPathContextPtr, xmlXPathObjectPtr);
-xmlXPathObjectPtr rxml_xpath_from_value(VALUE);
+VALUE rxml_xpath_to_value(xmlXPathContextPtr, xmlXPathObjectPtr, int);
+xmlXPathObjectPtr rxml_xpath_from_value(VALUE, xmlDocPtr);
 
 #endif
@@ -0,0 +1,427 @@
+/* Please see the LICENSE file for copyright and distribution information */
+
+#include "ruby_libxml.h"
+#include "ruby_xml_xpath_cache.h"
+
+#ifdef HAVE_RUBY_THREAD_NATIVE_H
+#include <ruby/thread_native.h>
+#endif
+
+/* Cache of compiled XPath expressions shared by the whole process.
+ *
+ * XPath::Context#find, and therefore Document#find and Node#find, look
+ * up string expressions here before evaluating them, so an expression
+ * is only tokenized and compiled the first time it is used.  Namespace
+ * prefixes of node tests and variables are resolved each time the
+ * expression is evaluated, so one entry serves every document and
+ * context.  Function calls are not: libxml stores the function a call
+ * resolved to, and for prefixed calls the namespace URI it looked up in
+ * the context, in the compiled expression the first time it runs.  That
+ * URI belongs to the first context and may be bound differently, or
+ * freed, by the time another context evaluates the expression, so
+ * expressions calling a prefixed function are never cached.  Unprefixed
+ * calls resolve to the same built-in function, or to the extension
+ * function dispatcher, in every context.
+ *
+ * The cache holds at most XML::XPath.cache_size entries and evicts the
+ * least recently used one when it is full.  Entries are reference
+ * counted while an expression is being evaluated, so an entry evicted
+ * in the meantime, for example by a find nested inside an XPath
+ * function, is only freed once its last evaluation finishes.  A native
+ * lock protects the cache since expressions may be released by code
+ * running without the GVL.  Memory comes from libxml's allocator and
+ * hash table so the cache never raises while the lock is held. */
+
+#define RXML_XPATH_CACHE_DEFAULT_SIZE 256
+
+struct rxml_xpath_cache_entry
+{
+  xmlChar *expression;
+  xmlXPathCompExprPtr compexpr;
+  int references;
+  int cached;
+  rxml_xpath_cache_entry *newer;
+  rxml_xpath_cache_entry *older;
+};
+
+#ifdef HAVE_RUBY_THREAD_NATIVE_H
+static rb_nativethread_lock_t rxml_xpath_cache_lock;
+#define RXML_XPATH_CACHE_LOCK() rb_nativethread_lock_lock(&rxml_xpath_cache_lock)
+#define RXML_XPATH_CACHE_UNLOCK() rb_nativethread_lock_unlock(&rxml_xpath_cache_lock)
+#else
+/* Without native locks all access happens under the GVL */
+#define RXML_XPATH_CACHE_LOCK()
+#define RXML_XPATH_CACHE_UNLOCK()
+#endif
+
+static xmlHashTablePtr rxml_xpath_cache_table = NULL;
+static rxml_xpath_cache_entry *rxml_xpath_cache_newest = NULL;
+static rxml_xpath_cache_entry *rxml_xpath_cache_oldest = NULL;
+static long rxml_xpath_cache_count = 0;
+static long rxml_xpath_cache_size = RXML_XPATH_CACHE_DEFAULT_SIZE;
+static unsigned long rxml_xpath_cache_hits = 0;
+static unsigned long rxml_xpath_cache_misses = 0;
+
+static void rxml_xpath_cache_entry_free(rxml_xpath_cache_entry *entry)
+{
+  xmlXPathFreeCompExpr(entry->compexpr);
+  xmlFree(entry->expression);
+  xmlFree(entry);
+}
+
+static void rxml_xpath_cache_unlink(rxml_xpath_cache_entry *entry)
+{
+  if (entry->newer)
+    entry->newer->older = entry->older;
+  else
+    rxml_xpath_cache_newest = entry->older;
+
+  if (entry->older)
+    entry->older->newer = entry->newer;
+  else
+    rxml_xpath_cache_oldest = entry->newer;
+
+  entry->newer = NULL;
+  entry->older = NULL;
+}
+
+static void rxml_xpath_cache_link(rxml_xpath_cache_entry *entry)
+{
+  entry->older = rxml_xpath_cache_newest;
+  entry->newer = NULL;
+
+  if (rxml_xpath_cache_newest)
+    rxml_xpath_cache_newest->newer = entry;
+  else
+    rxml_xpath_cache_oldest = entry;
+
+  rxml_xpath_cache_newest = entry;
+}
+
+/* Must be called with the lock held */
+static void rxml_xpath_cache_evict(rxml_xpath_cache_entry *entry)
+{
+  xmlHashRemoveEntry(rxml_xpath_cache_table, entry->expression, NULL);
+  rxml_xpath_cache_unlink(entry);
+  rxml_xpath_cache_count--;
+  entry->cached = 0;
+
+  if (entry->references == 0)
+    rxml_xpath_cache_entry_free(entry);
+}
+
+/* Must be called with the lock held */
+static void rxml_xpath_cache_trim(long size)
+{
+  while (rxml_xpath_cache_count > size)
+    rxml_xpath_cache_evict(rxml_xpath_cache_oldest);
+}
+
+static int rxml_xpath_cache_name_char(xmlChar c)
+{
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+         c == '_' || c == '-' || c == '.' || c >= 0x80;
+}
+
+/* Returns 0 if expression may call a function with a namespace prefix,
+   that is it contains prefix:name( outside of string literals.  Such
+   expressions must be compiled for each evaluation, see above.  Anything
+   that looks like a call counts, so the check may reject an expression
+   that can be shared but never accepts one that can not. */
+int rxml_xpath_cache_shareable(const xmlChar *expression)
+{
+  const xmlChar *cur = expression;
+  xmlChar quote = 0;
+
+  for (; *cur; cur++)
+  {
+    if (quote)
+    {
+      if (*cur == quote)
+        quote = 0;
+    }
+    else if (*cur == '"' || *cur == '\'')
+    {
+      quote = *cur;
+    }
+    else if (*cur == ':' && cur > expression && rxml_xpath_cache_name_char(cur[-1]) &&
+             rxml_xpath_cache_name_char(cur[1]))
+    {
+      const xmlChar *next = cur + 1;
+
+      while (rxml_xpath_cache_name_char(*next))
+        next++;
+      while (IS_BLANK_CH(*next))
+        next++;
+
+      if (*next == '(')
+        return 0;
+    }
+  }
+
+  return 1;
+}
+
+/* XPath 1.0 functions and node type tests, which never return namespace
+   nodes */
+static const char *rxml_xpath_cache_core_functions[] = {
+  "last", "position", "count", "id", "local-name", "namespace-uri", "name",
+  "string", "concat", "starts-with", "contains", "substring-before",
+  "substring-after", "substring", "string-length", "normalize-space",
+  "translate", "boolean", "not", "true", "false", "lang", "number", "sum",
+  "floor", "ceiling", "round", "node", "text", "comment",
+  "processing-instruction", NULL
+};
+
+static int rxml_xpath_cache_core_function(const xmlChar *name, int len)
+{
+  const char **function;
+
+  for (function = rxml_xpath_cache_core_functions; *function; function++)
+  {
+    if ((int)strlen(*function) == len && xmlStrncmp(name, (const xmlChar*)*function, len) == 0)
+      return 1;
+  }
+
+  return 0;
+}
+
+/* Returns 1 if evaluating expression may return namespace nodes, which
+   libxml copies into the node set (see ruby_xml_xpath_object.c).  That
+   takes a namespace axis step, or a variable or extension function, whose
+   value may be a node set with namespace nodes.  Like
+   rxml_xpath_cache_shareable the check may accept more expressions than
+   necessary, but never misses one. */
+int rxml_xpath_cache_namespaces(const xmlChar *expression)
+{
+  const xmlChar *cur = expression;
+  xmlChar quote = 0;
+
+  while (*cur)
+  {
+    if (quote)
+    {
+      if (*cur == quote)
+        quote = 0;
+      cur++;
+    }
+    else if (*cur == '"' || *cur == '\'')
+    {
+      quote = *cur++;
+    }
+    else if (*cur == '$')
+    {
+      return 1;
+    }
+    else if (rxml_xpath_cache_name_char(*cur))
+    {
+      const xmlChar *name = cur;
+      int len, prefixed = 0;
+
+      while (rxml_xpath_cache_name_char(*cur))
+        cur++;
+      if (cur[0] == ':' && rxml_xpath_cache_name_char(cur[1]))
+      {
+        prefixed = 1;
+        for (cur++; rxml_xpath_cache_name_char(*cur); cur++);
+      }
+      len = (int)(cur - name);
+
+      while (IS_BLANK_CH(*cur))
+        cur++;
+
+      if (cur[0] == ':' && cur[1] == ':' && !prefixed &&
+          len == 9 && xmlStrncmp(name, (const xmlChar*)"namespace", 9) == 0)
+        return 1;
+
+      if (*cur == '(' && (prefixed || !rxml_xpath_cache_core_function(name, len)))
+        return 1;
+    }
+    else
+    {
+      cur++;
+    }
+  }
+
+  return 0;
+}
+
+/* Returns the cache entry for expression, compiling the expression if it
+   is not cached yet, or NULL if the cache is disabled or the expression
+   may not be shared (see rxml_xpath_cache_shareable).  Raises an XML::Error
+   if the expression does not compile.  The compiled expression stays valid
+   until the entry is passed to rxml_xpath_cache_release. */
+rxml_xpath_cache_entry *rxml_xpath_cache_acquire(const xmlChar *expression)
+{
+  rxml_xpath_cache_entry *entry;
+  xmlXPathCompExprPtr compexpr;
+  long size;
+
+  if (!rxml_xpath_cache_shareable(expression))
+    return NULL;
+
+  RXML_XPATH_CACHE_LOCK();
+  size = rxml_xpath_cache_size;
+  entry = size > 0 ? xmlHashLookup(rxml_xpath_cache_table, expression) : NULL;
+
+  if (entry)
+  {
+    rxml_xpath_cache_hits++;
+    rxml_xpath_cache_unlink(entry);
+    rxml_xpath_cache_link(entry);
+    entry->references++;
+  }
+  else if (size > 0)
+  {
+    rxml_xpath_cache_misses++;
+  }
+  RXML_XPATH_CACHE_UNLOCK();
+
+  if (entry || size == 0)
+    return entry;
+
+  /* Compile without a context so the expression does not reference any
+     context's dictionary or namespaces */
+  compexpr = xmlXPathCompile(expression);
+  if (!compexpr)
+    rxml_raise(xmlGetLastError());
+
+  entry = xmlMalloc(sizeof(rxml_xpath_cache_entry));
+  entry->expression = xmlStrdup(expression);
+  entry->compexpr = compexpr;
+  entry->references = 1;
+  entry->cached = 0;
+  entry->newer = NULL;
+  entry->older = NULL;
+
+  /* Another thread may have cached the same expression in the meantime,
+     then this entry is used once and freed on release. */
+  RXML_XPATH_CACHE_LOCK();
+  if (rxml_xpath_cache_size > 0 &&
+      xmlHashAddEntry(rxml_xpath_cache_table, entry->expression, entry) == 0)
+  {
+    entry->cached = 1;
+    rxml_xpath_cache_link(entry);
+    rxml_xpath_cache_count++;
+    rxml_xpath_cache_trim(rxml_xpath_cache_size);
+  }
+  RXML_XPATH_CACHE_UNLOCK();
+
+  return entry;
+}
+
+xmlXPathCompExprPtr rxml_xpath_cache_expression(rxml_xpath_cache_entry *entry)
+{
+  return entry->compexpr;
+}
+
+void rxml_xpath_cache_release(rxml_xpath_cache_entry *entry)
+{
+  int unused;
+
+  RXML_XPATH_CACHE_LOCK();
+  entry->references--;
+  unused = !entry->cached && entry->references == 0;
+  RXML_XPATH_CACHE_UNLOCK();
+
+  if (unused)
+    rxml_xpath_cache_entry_free(entry);
+}
+
+/*
+ * call-seq:
+ *    XML::XPath.cache_size -> Integer
+ *
+ * Returns the maximum number of compiled expressions kept by the
+ * XPath expression cache.
+ */
+static VALUE rxml_xpath_cache_size_get(VALUE klass)
+{
+  return LONG2NUM(rxml_xpath_cache_size);
+}
+
+/*
+ * call-seq:
+ *    XML::XPath.cache_size = 256
+ *
+ * Sets the maximum number of compiled expressions kept by the XPath
+ * expression cache.  When the cache is full the least recently used
+ * expression is discarded.  A size of 0 disables the cache.
+ */
+static VALUE rxml_xpath_cache_size_set(VALUE klass, VALUE value)
+{
+  long size = NUM2LONG(value);
+
+  if (size < 0)
+    rb_raise(rb_eArgError, "size must not be negative");
+
+  RXML_XPATH_CACHE_LOCK();
+  rxml_xpath_cache_size = size;
+  rxml_xpath_cache_trim(size);
+  RXML_XPATH_CACHE_UNLOCK();
+
+  return value;
+}
+
+/*
+ * call-seq:
+ *    XML::XPath.cache_stats -> Hash
+ *
+ * Returns statistics about the XPath expression cache: the number of
+ * evaluations that found their expression compiled (:hits) or had to
+ * compile it (:misses), the resulting :hit_rate, the number of cached
+ * expressions (:entries) and the maximum number (:size).
+ */
+static VALUE rxml_xpath_cache_stats(VALUE klass)
+{
+  VALUE result = rb_hash_new();
+  unsigned long hits, misses;
+  long count, size;
+
+  RXML_XPATH_CACHE_LOCK();
+  hits = rxml_xpath_cache_hits;
+  misses = rxml_xpath_cache_misses;
+  count = rxml_xpath_cache_count;
+  size = rxml_xpath_cache_size;
+  RXML_XPATH_CACHE_UNLOCK();
+
+  rb_hash_aset(result, ID2SYM(rb_intern("hits")), ULONG2NUM(hits));
+  rb_hash_aset(result, ID2SYM(rb_intern("misses")), ULONG2NUM(misses));
+  rb_hash_aset(result, ID2SYM(rb_intern("hit_rate")),
+               rb_float_new(hits + misses == 0 ? 0.0 : (double)hits / (double)(hits + misses)));
+  rb_hash_aset(result, ID2SYM(rb_intern("entries")), LONG2NUM(count));
+  rb_hash_aset(result, ID2SYM(rb_intern("size")), LONG2NUM(size));
+
+  return result;
+}
+
+/*
+ * call-seq:
+ *    XML::XPath.clear_cache -> nil
+ *
+ * Discards all compiled expressions from the XPath expression cache
+ * and resets its statistics.
+ */
+static VALUE rxml_xpath_cache_clear(VALUE klass)
+{
+  RXML_XPATH_CACHE_LOCK();
+  rxml_xpath_cache_trim(0);
+  rxml_xpath_cache_hits = 0;
+  rxml_xpath_cache_misses = 0;
+  RXML_XPATH_CACHE_UNLOCK();
+
+  return Qnil;
+}
+
+void rxml_init_xpath_cache(void)
+{
+#ifdef HAVE_RUBY_THREAD_NATIVE_H
+  rb_nativethread_lock_initialize(&rxml_xpath_cache_lock);
+#endif
+  rxml_xpath_cache_table = xmlHashCreate(RXML_XPATH_CACHE_DEFAULT_SIZE);
+
+  rb_define_singleton_method(mXPath, "cache_size", rxml_xpath_cache_size_get, 0);
+  rb_define_singleton_method(mXPath, "cache_size=", rxml_xpath_cache_size_set, 1);
+  rb_define_singleton_method(mXPath, "cache_stats", rxml_xpath_cache_stats, 0);
+  rb_define_singleton_method(mXPath, "clear_cache", rxml_xpath_cache_clear, 0);
+}
@@ -0,0 +1,15 @@
+/* Please see the LICENSE file for copyright and distribution information */
+
+#ifndef __RXML_XPATH_CACHE__
+#define __RXML_XPATH_CACHE__
+
+typedef struct rxml_xpath_cache_entry rxml_xpath_cache_entry;
+
+void rxml_init_xpath_cache(void);
+int rxml_xpath_cache_shareable(const xmlChar *expression);
+int rxml_xpath_cache_namespaces(const xmlChar *expression);
+rxml_xpath_cache_entry *rxml_xpath_cache_acquire(const xmlChar *expression);
+xmlXPathCompExprPtr rxml_xpath_cache_expression(rxml_xpath_cache_entry *entry);
+void rxml_xpath_cache_release(rxml_xpath_cache_entry *entry);
+
+#endif
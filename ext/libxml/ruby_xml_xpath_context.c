@@ -25,16 +25,174 @@
  */
 
 VALUE cXMLXPathContext;
+static ID VARIABLES_ATTR;
+
+/* Extension functions registered with XPath::Context#register_function.
+ *
+ * All of them are implemented by rxml_xpath_function_dispatch, which
+ * looks up the Ruby callable by the name and namespace URI libxml is
+ * calling.  Compiled expressions remember the C function a name resolved
+ * to, and unprefixed calls may be shared between contexts (see
+ * ruby_xml_xpath_cache.c), so every extension function resolves to the
+ * same dispatcher.  The namespace URI of a prefixed call is remembered
+ * too, which is why expressions with such calls are compiled for each
+ * evaluation and the URI always comes from the current context.  An
+ * exception raised by a callable stops the evaluation and is re-raised
+ * by XPath::Context#find. */
+typedef struct
+{
+  xmlHashTablePtr table;
+  int state;
+} rxml_xpath_functions;
+
+typedef struct
+{
+  xmlXPathParserContextPtr ctxt;
+  int nargs;
+  VALUE function;
+  xmlXPathObjectPtr result;
+  int state;
+} rxml_xpath_function_call;
+
+static xmlXPathFunction rxml_xpath_function_lookup(void *data, const xmlChar *name,
+                                                   const xmlChar *ns_uri);
+static void rxml_xpath_function_dispatch(xmlXPathParserContextPtr ctxt, int nargs);
+
+static rxml_xpath_functions *rxml_xpath_context_functions(xmlXPathContextPtr ctxt)
+{
+  if (ctxt->funcLookupFunc == rxml_xpath_function_lookup)
+    return (rxml_xpath_functions*)ctxt->funcLookupData;
+  else
+    return NULL;
+}
+
+/* A context is busy while it evaluates an expression, see
+   rxml_xpath_context_eval */
+static void rxml_xpath_context_check_idle(xmlXPathContextPtr ctxt)
+{
+  if (ctxt->userData == ctxt)
+    rb_raise(rb_eRuntimeError, "The XPath context is already evaluating an expression");
+}
+
+static void rxml_xpath_function_mark(void *payload, void *data, const xmlChar *name)
+{
+  rb_gc_mark((VALUE)payload);
+}
 
 static void rxml_xpath_context_free(xmlXPathContextPtr ctxt)
 {
+  rxml_xpath_functions *functions = rxml_xpath_context_functions(ctxt);
+
+  if (functions)
+  {
+    xmlHashFree(functions->table, NULL);
+    xfree(functions);
+  }
+
   xmlXPathFreeContext(ctxt);
 }
 
 static void rxml_xpath_context_mark(xmlXPathContextPtr ctxt)
 {
+  rxml_xpath_functions *functions = rxml_xpath_context_functions(ctxt);
   VALUE value = (VALUE)ctxt->doc->_private;
   rb_gc_mark(value);
+
+  /* Marking with rb_gc_mark also keeps the callables from being moved */
+  if (functions)
+    xmlHashScan(functions->table, rxml_xpath_function_mark, NULL);
+}
+
+static xmlXPathFunction rxml_xpath_function_lookup(void *data, const xmlChar *name,
+                                                   const xmlChar *ns_uri)
+{
+  rxml_xpath_functions *functions = (rxml_xpath_functions*)data;
+  return xmlHashLookup2(functions->table, name, ns_uri) ? rxml_xpath_function_dispatch : NULL;
+}
+
+static VALUE rxml_xpath_function_invoke(VALUE data)
+{
+  rxml_xpath_function_call *call = (rxml_xpath_function_call*)data;
+  VALUE args = rb_ary_new2(call->nargs);
+  VALUE result;
+  int i;
+
+  /* Arguments are on the stack in reverse order.  They are not known to
+     be free of namespace nodes, see rxml_xpath_cache_namespaces. */
+  for (i = call->nargs - 1; i >= 0; i--)
+    rb_ary_store(args, i, rxml_xpath_to_value(call->ctxt->context, valuePop(call->ctxt), 1));
+
+  result = rb_funcall2(call->function, rb_intern("call"), call->nargs, RARRAY_PTR(args));
+  RB_GC_GUARD(args);
+
+  call->result = rxml_xpath_from_value(result, call->ctxt->context->doc);
+  return Qnil;
+}
+
+static void *rxml_xpath_function_protect(void *data)
+{
+  rxml_xpath_function_call *call = (rxml_xpath_function_call*)data;
+  rb_protect(rxml_xpath_function_invoke, (VALUE)call, &call->state);
+  return NULL;
+}
+
+static void rxml_xpath_function_dispatch(xmlXPathParserContextPtr ctxt, int nargs)
+{
+  rxml_xpath_functions *functions = rxml_xpath_context_functions(ctxt->context);
+  rxml_xpath_function_call call = {ctxt, nargs, Qnil, NULL, 0};
+  void *function = NULL;
+
+  if (functions)
+    function = xmlHashLookup2(functions->table, ctxt->context->function, ctxt->context->functionURI);
+
+  if (!function)
+  {
+    xmlXPathErr(ctxt, XPATH_UNKNOWN_FUNC_ERROR);
+    return;
+  }
+
+  call.function = (VALUE)function;
+  rxml_with_gvl(rxml_xpath_function_protect, &call);
+
+  if (call.state)
+  {
+    /* Stop the evaluation without reporting another error */
+    if (!functions->state)
+      functions->state = call.state;
+    ctxt->error = XPATH_EXPR_ERROR;
+    return;
+  }
+
+  valuePush(ctxt, call.result);
+}
+
+static void rxml_xpath_context_register(xmlXPathContextPtr ctxt, VALUE name, VALUE ns_uri,
+                                        VALUE function)
+{
+  rxml_xpath_functions *functions = rxml_xpath_context_functions(ctxt);
+  const xmlChar *xname = (const xmlChar*)StringValueCStr(name);
+  const xmlChar *xns_uri = NIL_P(ns_uri) ? NULL : (const xmlChar*)StringValueCStr(ns_uri);
+
+  if (!xns_uri && xmlHashLookup2(ctxt->funcHash, xname, NULL))
+    rb_raise(rb_eArgError, "%s is a built-in XPath function", xname);
+
+  if (!functions)
+  {
+    functions = ALLOC(rxml_xpath_functions);
+    functions->table = xmlHashCreate(0);
+    functions->state = 0;
+    xmlXPathRegisterFuncLookup(ctxt, rxml_xpath_function_lookup, functions);
+  }
+
+  xmlHashUpdateEntry2(functions->table, xname, xns_uri, (void*)function, NULL);
+}
+
+static int rxml_xpath_context_register_default(VALUE key, VALUE function, VALUE self)
+{
+  xmlXPathContextPtr ctxt;
+  Data_Get_Struct(self, xmlXPathContext, ctxt);
+  rxml_xpath_context_register(ctxt, rb_ary_entry(key, 0), rb_ary_entry(key, 1), function);
+  return ST_CONTINUE;
 }
 
 static VALUE rxml_xpath_context_alloc(VALUE klass)
@@ -52,19 +210,27 @@ static VALUE rxml_xpath_context_alloc(VALUE klass)
  *  context = XPath::Context.new(doc)
  *  nodes = XPath::Object.new('//first', context)
  *  nodes.length == 1
+ *
+ * The context starts out with the document's XPath functions, see
+ * XML::Document#register_xpath_function.
  */
 static VALUE rxml_xpath_context_initialize(VALUE self, VALUE document)
 {
   xmlDocPtr xdoc;
+  VALUE functions;
 
   if (rb_obj_is_kind_of(document, cXMLDocument) != Qtrue)
   {
     rb_raise(rb_eTypeError, "Supplied argument must be a document or node.");
   }
 
-  Data_Get_Struct(document, xmlDoc, xdoc);
+  TypedData_Get_Struct(document, xmlDoc, &rxml_document_data_type, xdoc);
   DATA_PTR(self) = xmlXPathNewContext(xdoc);
 
+  functions = rxml_document_xpath_functions(document);
+  if (!NIL_P(functions))
+    rb_hash_foreach(functions, rxml_xpath_context_register_default, self);
+
   return self;
 }
 
@@ -97,6 +263,7 @@ static VALUE rxml_xpath_context_register_namespace(VALUE self, VALUE prefix, VAL
 {
   xmlXPathContextPtr ctxt;
   Data_Get_Struct(self, xmlXPathContext, ctxt);
+  rxml_xpath_context_check_idle(ctxt);
 
   /* Prefix could be a symbol. */
   prefix = rb_obj_as_string(prefix);
@@ -131,11 +298,12 @@ static VALUE rxml_xpath_context_register_namespaces_from_node(VALUE self,
   xmlNsPtr *xnsArr;
 
   Data_Get_Struct(self, xmlXPathContext, xctxt);
+  rxml_xpath_context_check_idle(xctxt);
 
   if (rb_obj_is_kind_of(node, cXMLDocument) == Qtrue)
   {
     xmlDocPtr xdoc;
-    Data_Get_Struct(node, xmlDoc, xdoc);
+    TypedData_Get_Struct(node, xmlDoc, &rxml_document_data_type, xdoc);
     xnode = xmlDocGetRootElement(xdoc);
   }
   else if (rb_obj_is_kind_of(node, cXMLNode) == Qtrue)
@@ -236,6 +404,117 @@ static VALUE rxml_xpath_context_register_namespaces(VALUE self, VALUE nslist)
   return self;
 }
 
+/* call-seq:
+ *    context.register_function(name) {|*args| ... } -> self
+ *    context.register_function(name, ns_uri) {|*args| ... } -> self
+ *
+ * Registers an XPath extension function implemented by the block.
+ * The block is called with the function's arguments converted to
+ * Ruby values - node sets are passed as XPath::Object - and returns
+ * true, false, a number, a string, nil (an empty node set), a node,
+ * an attribute, an XPath::Object or an array of nodes.  Functions with
+ * a namespace uri are called with a prefix registered for it.
+ *
+ *  context.register_namespace('f', 'urn:functions')
+ *  context.register_function('price-above', 'urn:functions') do |nodes, limit|
+ *    nodes.any? {|node| node.content.to_f > limit}
+ *  end
+ *  context.find("//book[f:price-above(price, 40)]")
+ */
+static VALUE rxml_xpath_context_register_function(int argc, VALUE *argv, VALUE self)
+{
+  xmlXPathContextPtr ctxt;
+  VALUE name, ns_uri, block;
+
+  rb_scan_args(argc, argv, "11&", &name, &ns_uri, &block);
+  if (NIL_P(block))
+    rb_raise(rb_eArgError, "A block is required");
+
+  Data_Get_Struct(self, xmlXPathContext, ctxt);
+  rxml_xpath_context_check_idle(ctxt);
+  rxml_xpath_context_register(ctxt, rb_obj_as_string(name), ns_uri, block);
+
+  return self;
+}
+
+/*
+ * call-seq:
+ *    context[name] = value
+ *
+ * Binds the XPath variable $name to value, which is converted like the
+ * result of an extension function (see #register_function).  Setting a
+ * variable to nil removes it.  Variables let one compiled expression
+ * be evaluated with different values, without building a new
+ * expression string for each one:
+ *
+ *  expr = XML::XPath::Expression.new('//book[@id = $id]')
+ *  context['id'] = 'bk101'
+ *  context.find(expr)
+ *
+ * The context keeps value alive, so nodes bound to a variable and then
+ * removed from the document are not freed.  Nodes that libxml itself
+ * frees, such as the children replaced by Node#content=, are not kept
+ * though, so rebind variables that refer to them after such changes.
+ */
+static VALUE rxml_xpath_context_variable_set(VALUE self, VALUE name, VALUE value)
+{
+  xmlXPathContextPtr xctxt;
+  xmlXPathObjectPtr xobject = NULL;
+  VALUE variables;
+
+  Data_Get_Struct(self, xmlXPathContext, xctxt);
+  rxml_xpath_context_check_idle(xctxt);
+  name = rb_obj_as_string(name);
+
+  if (!NIL_P(value))
+    xobject = rxml_xpath_from_value(value, xctxt->doc);
+
+  /* The context takes ownership of the object */
+  if (xmlXPathRegisterVariable(xctxt, (const xmlChar*)StringValueCStr(name), xobject) != 0)
+  {
+    if (xobject)
+      xmlXPathFreeObject(xobject);
+    rb_raise(rb_eArgError, "Could not register the XPath variable %s", StringValueCStr(name));
+  }
+
+  /* The variable only holds pointers to the nodes in value */
+  variables = rb_attr_get(self, VARIABLES_ATTR);
+  if (NIL_P(variables))
+  {
+    variables = rb_hash_new();
+    rb_ivar_set(self, VARIABLES_ATTR, variables);
+  }
+
+  if (NIL_P(value))
+    rb_hash_delete(variables, name);
+  else
+    rb_hash_aset(variables, name, value);
+
+  return value;
+}
+
+/*
+ * call-seq:
+ *    context[name] -> value
+ *
+ * Returns the value bound to the XPath variable $name, or nil.
+ */
+static VALUE rxml_xpath_context_variable_get(VALUE self, VALUE name)
+{
+  xmlXPathContextPtr xctxt;
+  xmlXPathObjectPtr xobject;
+
+  Data_Get_Struct(self, xmlXPathContext, xctxt);
+  name = rb_obj_as_string(name);
+
+  /* Returns a copy */
+  xobject = xmlXPathVariableLookup(xctxt, (const xmlChar*)StringValueCStr(name));
+  if (!xobject)
+    return Qnil;
+
+  return rxml_xpath_to_value(xctxt, xobject, 1);
+}
+
 /*
  * call-seq:
  *    context.node = node
@@ -251,11 +530,214 @@ static VALUE rxml_xpath_context_node_set(VALUE self, VALUE node)
   xmlNodePtr xnode;
 
   Data_Get_Struct(self, xmlXPathContext, xctxt);
+  rxml_xpath_context_check_idle(xctxt);
   Data_Get_Struct(node, xmlNode, xnode);
   xctxt->node = xnode;
   return node;
 }
 
+typedef struct
+{
+  xmlXPathCompExprPtr xcompexpr;
+  xmlXPathContextPtr xctxt;
+  xmlXPathObjectPtr result;
+} rxml_xpath_eval_data;
+
+static void *rxml_xpath_eval_without_gvl(void *data)
+{
+  rxml_xpath_eval_data *eval = (rxml_xpath_eval_data*)data;
+  eval->result = xmlXPathCompiledEval(eval->xcompexpr, eval->xctxt);
+  return NULL;
+}
+
+/* Ruby checks for interrupts, such as Thread#raise, once it holds the
+   GVL again, so this may raise after the evaluation finished */
+static VALUE rxml_xpath_eval_protected(VALUE data)
+{
+  rxml_without_gvl(rxml_xpath_eval_without_gvl, (void*)data, NULL, NULL);
+  return Qnil;
+}
+
+/* Read only documents can not change while an expression is evaluated,
+   so other threads may run in the meantime.  Extension functions and
+   error handlers reacquire the lock via rxml_with_gvl.  An exception
+   from an error handler is left pending, and one raised when the GVL
+   is reacquired is returned in state, for rxml_xpath_context_eval to
+   re-raise.  This relies on libxml keeping its last error per thread. */
+static xmlXPathObjectPtr rxml_xpath_compiled_eval(xmlXPathCompExprPtr xcompexpr, xmlXPathContextPtr xctxt,
+                                                  int *state)
+{
+#ifdef LIBXML_THREAD_ENABLED
+  if (rxml_document_read_only_p(xctxt->doc))
+  {
+    rxml_xpath_eval_data eval = {xcompexpr, xctxt, NULL};
+
+    rxml_document_evaluation_begin(xctxt->doc);
+    rb_protect(rxml_xpath_eval_protected, (VALUE)&eval, state);
+    rxml_document_evaluation_end(xctxt->doc);
+
+    return eval.result;
+  }
+#endif
+  return xmlXPathCompiledEval(xcompexpr, xctxt);
+}
+
+/* Answers expressions of the form //name or //prefix:name from the
+   document's element index.  Returns NULL if the expression has another
+   form, the prefix is not registered or the document is not indexed, so
+   it is evaluated as usual. */
+static xmlXPathObjectPtr rxml_xpath_index_eval(xmlXPathContextPtr xctxt, const char *expression)
+{
+  const xmlChar *name = (const xmlChar*)expression + 2;
+  const xmlChar *href = NULL;
+  const xmlChar *colon;
+  xmlNodeSetPtr nodes;
+
+  if (expression[0] != '/' || expression[1] != '/' || !xctxt->doc)
+    return NULL;
+
+  colon = xmlStrchr(name, ':');
+  if (colon)
+  {
+    xmlChar *prefix = xmlStrndup(name, (int)(colon - name));
+
+    if (xmlValidateNCName(prefix, 0) == 0)
+      href = xmlXPathNsLookup(xctxt, prefix);
+
+    xmlFree(prefix);
+    if (!href)
+      return NULL;
+
+    name = colon + 1;
+  }
+
+  if (xmlValidateNCName(name, 0) != 0)
+    return NULL;
+
+  if (!rxml_document_index_lookup(xctxt->doc, name, href, &nodes))
+    return NULL;
+
+  return xmlXPathWrapNodeSet(xmlXPathNodeSetMerge(NULL, nodes));
+}
+
+/* Evaluates a String or XPath::Expression against the context, re-raising
+   any exception raised by an extension function.  Returns NULL, with the
+   error in xmlLastError, if the evaluation failed.  Sets namespaces to
+   whether the result may contain namespace nodes. */
+static xmlXPathObjectPtr rxml_xpath_context_eval_exclusive(xmlXPathContextPtr xctxt, VALUE xpath_expr,
+                                                           int *namespaces)
+{
+  rxml_xpath_functions *functions;
+  xmlXPathObjectPtr xobject;
+  xmlXPathCompExprPtr xcompexpr;
+  int state = 0;
+
+  if (TYPE(xpath_expr) == T_STRING)
+  {
+    VALUE expression = rb_check_string_type(xpath_expr);
+    rxml_xpath_cache_entry *entry;
+
+    *namespaces = 0;
+    xobject = rxml_xpath_index_eval(xctxt, StringValueCStr(expression));
+    if (xobject)
+      return xobject;
+
+    *namespaces = rxml_xpath_cache_namespaces((xmlChar*) StringValueCStr(expression));
+
+    entry = rxml_xpath_cache_acquire((xmlChar*) StringValueCStr(expression));
+
+    if (entry)
+    {
+      xobject = rxml_xpath_compiled_eval(rxml_xpath_cache_expression(entry), xctxt, &state);
+      rxml_xpath_cache_release(entry);
+    }
+    else
+    {
+      xobject = xmlXPathEval((xmlChar*) StringValueCStr(expression), xctxt);
+    }
+  }
+  else if (rb_obj_is_kind_of(xpath_expr, cXMLXPathExpression))
+  {
+    /* Set for expressions that must not be shared between contexts */
+    VALUE expression = rb_attr_get(xpath_expr, rb_intern("expression"));
+
+    *namespaces = RTEST(rb_attr_get(xpath_expr, rb_intern("namespaces")));
+    if (NIL_P(expression))
+    {
+      Data_Get_Struct(xpath_expr, xmlXPathCompExpr, xcompexpr);
+      xobject = rxml_xpath_compiled_eval(xcompexpr, xctxt, &state);
+    }
+    else
+    {
+      xobject = xmlXPathEval((xmlChar*) StringValueCStr(expression), xctxt);
+    }
+  }
+  else
+  {
+    rb_raise(rb_eTypeError,
+        "Argument should be an instance of a String or XPath::Expression");
+  }
+
+  /* Re-raise an interrupt, an exception from an extension function or
+     one from an error handler called without the GVL.  All are cleared,
+     so none is raised again by a later evaluation or parse. */
+  functions = rxml_xpath_context_functions(xctxt);
+  if (state || (functions && functions->state) || rxml_gvl_pending_p())
+  {
+    if (functions)
+    {
+      if (!state)
+        state = functions->state;
+      functions->state = 0;
+    }
+    if (xobject)
+      xmlXPathFreeObject(xobject);
+    rxml_gvl_raise_pending();
+    rb_jump_tag(state);
+  }
+
+  return xobject;
+}
+
+typedef struct
+{
+  xmlXPathContextPtr xctxt;
+  VALUE xpath_expr;
+  int namespaces;
+} rxml_xpath_context_eval_args;
+
+static VALUE rxml_xpath_context_eval_body(VALUE data)
+{
+  rxml_xpath_context_eval_args *args = (rxml_xpath_context_eval_args*)data;
+  return (VALUE)rxml_xpath_context_eval_exclusive(args->xctxt, args->xpath_expr, &args->namespaces);
+}
+
+static VALUE rxml_xpath_context_release(VALUE value)
+{
+  xmlXPathContextPtr xctxt = (xmlXPathContextPtr)value;
+  xctxt->userData = NULL;
+  return Qnil;
+}
+
+/* Evaluates xpath_expr with the context marked busy.  Evaluations on read
+   only documents release the GVL and extension functions call Ruby, so
+   another thread could otherwise use the context's node, variables and
+   object cache at the same time. */
+static xmlXPathObjectPtr rxml_xpath_context_eval(xmlXPathContextPtr xctxt, VALUE xpath_expr,
+                                                 int *namespaces)
+{
+  rxml_xpath_context_eval_args args = {xctxt, xpath_expr, 0};
+  VALUE result;
+
+  rxml_xpath_context_check_idle(xctxt);
+  xctxt->userData = xctxt;
+  result = rb_ensure(rxml_xpath_context_eval_body, (VALUE)&args,
+                     rxml_xpath_context_release, (VALUE)xctxt);
+
+  *namespaces = args.namespaces;
+  return (xmlXPathObjectPtr)result;
+}
+
 /*
  * call-seq:
  *    context.find("xpath") -> true|false|number|string|XML::XPath::Object
@@ -263,32 +745,77 @@ static VALUE rxml_xpath_context_node_set(VALUE self, VALUE node)
  * Executes the provided xpath function.  The result depends on the execution
  * of the xpath statement.  It may be true, false, a number, a string or 
  * a node set.
+ *
+ * String expressions are compiled the first time they are used and
+ * then kept in a process-wide cache, see XML::XPath.cache_size.
  */
 static VALUE rxml_xpath_context_find(VALUE self, VALUE xpath_expr)
 {
   xmlXPathContextPtr xctxt;
   xmlXPathObjectPtr xobject;
-  xmlXPathCompExprPtr xcompexpr;
+  int namespaces;
 
   Data_Get_Struct(self, xmlXPathContext, xctxt);
+  xobject = rxml_xpath_context_eval(xctxt, xpath_expr, &namespaces);
+  return rxml_xpath_to_value(xctxt, xobject, namespaces);
+}
 
-  if (TYPE(xpath_expr) == T_STRING)
-  {
-    VALUE expression = rb_check_string_type(xpath_expr);
-    xobject = xmlXPathEval((xmlChar*) StringValueCStr(expression), xctxt);
-  }
-  else if (rb_obj_is_kind_of(xpath_expr, cXMLXPathExpression))
+/*
+ * call-seq:
+ *    context.find_all([expr, ...]) -> [result, ...]
+ *    context.find_all([expr, ...], :strings => true) -> [String, ...]
+ *
+ * Evaluates each of the given Strings or XPath::Expressions against the
+ * context's current node and returns their results in the same order.
+ * Each result is what #find would return for that expression.
+ *
+ * With :strings, each result is converted to a String with the XPath
+ * string() function instead, so a node set gives the text of its first
+ * node, or an empty String when it is empty, and no XPath::Object is
+ * created at all.
+ *
+ *  exprs = %w(title author price).map {|name| XML::XPath::Expression.new(name)}
+ *  context.node = book
+ *  title, author, price = context.find_all(exprs, :strings => true)
+ */
+static VALUE rxml_xpath_context_find_all(int argc, VALUE *argv, VALUE self)
+{
+  xmlXPathContextPtr xctxt;
+  VALUE expressions, options, result;
+  int strings = 0;
+  long i;
+
+  rb_scan_args(argc, argv, "11", &expressions, &options);
+  Check_Type(expressions, T_ARRAY);
+
+  if (!NIL_P(options))
   {
-    Data_Get_Struct(xpath_expr, xmlXPathCompExpr, xcompexpr);
-    xobject = xmlXPathCompiledEval(xcompexpr, xctxt);
+    Check_Type(options, T_HASH);
+    strings = RTEST(rb_hash_aref(options, ID2SYM(rb_intern("strings"))));
   }
-  else
+
+  Data_Get_Struct(self, xmlXPathContext, xctxt);
+  result = rb_ary_new2(RARRAY_LEN(expressions));
+
+  for (i = 0; i < RARRAY_LEN(expressions); i++)
   {
-    rb_raise(rb_eTypeError,
-        "Argument should be an instance of a String or XPath::Expression");
+    int namespaces;
+    xmlXPathObjectPtr xobject = rxml_xpath_context_eval(xctxt, rb_ary_entry(expressions, i), &namespaces);
+
+    if (strings && xobject)
+    {
+      xmlChar *string = xmlXPathCastToString(xobject);
+      xmlXPathFreeObject(xobject);
+      rb_ary_push(result, rxml_new_cstr(string, xctxt->doc->encoding));
+      xmlFree(string);
+    }
+    else
+    {
+      rb_ary_push(result, rxml_xpath_to_value(xctxt, xobject, namespaces));
+    }
   }
 
-  return rxml_xpath_to_value(xctxt, xobject);
+  return result;
 }
 
 #if LIBXML_VERSION >= 20626
@@ -311,6 +838,7 @@ rxml_xpath_context_enable_cache(int argc,  VALUE *argv, VALUE self)
   int value = -1;
 
   Data_Get_Struct(self, xmlXPathContext, xctxt);
+  rxml_xpath_context_check_idle(xctxt);
 
   if (rb_scan_args(argc, argv, "01", &size) == 1)
   {
@@ -334,6 +862,7 @@ rxml_xpath_context_disable_cache(VALUE self)
 {
   xmlXPathContextPtr xctxt;
   Data_Get_Struct(self, xmlXPathContext, xctxt);
+  rxml_xpath_context_check_idle(xctxt);
 
   if (xmlXPathContextSetCache(xctxt, 0, 0, 0) == -1)
     rxml_raise(&xmlLastError);
@@ -346,13 +875,20 @@ void rxml_init_xpath_context(void)
 {
   cXMLXPathContext = rb_define_class_under(mXPath, "Context", rb_cObject);
   rb_define_alloc_func(cXMLXPathContext, rxml_xpath_context_alloc);
+
+  VARIABLES_ATTR = rb_intern("variables");
+
   rb_define_method(cXMLXPathContext, "doc", rxml_xpath_context_doc, 0);
   rb_define_method(cXMLXPathContext, "initialize", rxml_xpath_context_initialize, 1);
   rb_define_method(cXMLXPathContext, "register_namespaces", rxml_xpath_context_register_namespaces, 1);
   rb_define_method(cXMLXPathContext, "register_namespaces_from_node", rxml_xpath_context_register_namespaces_from_node, 1);
   rb_define_method(cXMLXPathContext, "register_namespace", rxml_xpath_context_register_namespace, 2);
+  rb_define_method(cXMLXPathContext, "register_function", rxml_xpath_context_register_function, -1);
   rb_define_method(cXMLXPathContext, "node=", rxml_xpath_context_node_set, 1);
+  rb_define_method(cXMLXPathContext, "[]", rxml_xpath_context_variable_get, 1);
+  rb_define_method(cXMLXPathContext, "[]=", rxml_xpath_context_variable_set, 2);
   rb_define_method(cXMLXPathContext, "find", rxml_xpath_context_find, 1);
+  rb_define_method(cXMLXPathContext, "find_all", rxml_xpath_context_find_all, -1);
 #if LIBXML_VERSION >= 20626
   rb_define_method(cXMLXPathContext, "enable_cache", rxml_xpath_context_enable_cache, -1);
   rb_define_method(cXMLXPathContext, "disable_cache", rxml_xpath_context_disable_cache, 0);
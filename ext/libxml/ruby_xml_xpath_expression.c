@@ -3,6 +3,7 @@
 #include "ruby_libxml.h"
 #include "ruby_xml_xpath.h"
 #include "ruby_xml_xpath_expression.h"
+#include "ruby_xml_xpath_cache.h"
 
 /*
  * Document-class: LibXML::XML::XPath::Expression
@@ -69,6 +70,18 @@ static VALUE rxml_xpath_expression_initialize(VALUE self, VALUE expression)
   }
 
   DATA_PTR( self) = compexpr;
+
+  /* Calls to prefixed functions remember the namespace binding of the
+     first context that evaluates them, keep the source to compile the
+     expression again for each evaluation (see ruby_xml_xpath_cache.c) */
+  if (!rxml_xpath_cache_shareable((const xmlChar*)StringValueCStr(expression)))
+    rb_ivar_set(self, rb_intern("expression"), rb_str_new_frozen(expression));
+
+  /* Results of the expression are only searched for namespace nodes if
+     it may return them (see ruby_xml_xpath_object.c) */
+  if (rxml_xpath_cache_namespaces((const xmlChar*)StringValueCStr(expression)))
+    rb_ivar_set(self, rb_intern("namespaces"), Qtrue);
+
   return self;
 }
 
@@ -23,12 +23,24 @@ VALUE cXMLXPathObject;
    However, once both objects go out of scope, the order of their 
    destruction is random.
 
-   To deal with this, the wrapper code searches for the namespace nodes
-   and wraps them in Ruby objects.  When the Ruby objects go out of scope
-   then the namespace nodes are freed. */
+   To deal with this, the namespace copies are collected into a separate
+   list when the node set is wrapped, while all its nodes are still valid.
+   The node set is freed without looking at its nodes, which may belong
+   to a freed document or to a document modified in the meantime.
+
+   Collecting the copies reads every node, so it is only done when the
+   expression may return namespace nodes at all (see
+   rxml_xpath_cache_namespaces).  Otherwise wrapping does not depend on
+   the size of the node set. */
 
 static void rxml_xpath_object_free(rxml_xpath_object *rxpop)
 {
+  int i;
+
+  for (i = 0; i < rxpop->nsNr; i++)
+    xmlFreeNs(rxpop->nsnodes[i]);
+  xfree(rxpop->nsnodes);
+
   /* We positively, absolutely cannot let libxml iterate over
      the nodeTab since if the underlying document has been
      freed the majority of entries are invalid, resulting in
@@ -52,46 +64,79 @@ static void rxml_xpath_object_mark(rxml_xpath_object *rxpop)
 {
   VALUE doc = (VALUE)rxpop->xdoc->_private;
   rb_gc_mark(doc);
-  rb_gc_mark(rxpop->nsnodes);
 }
 
-VALUE rxml_xpath_object_wrap(xmlDocPtr xdoc, xmlXPathObjectPtr xpop)
+static size_t rxml_xpath_object_memsize(const void *data)
 {
-  int i;
+  const rxml_xpath_object *rxpop = (const rxml_xpath_object *)data;
+  size_t size = sizeof(rxml_xpath_object) + sizeof(xmlXPathObject);
+
+  if (rxpop->xpop->nodesetval)
+    size += sizeof(xmlNodeSet) + rxpop->xpop->nodesetval->nodeMax * sizeof(xmlNodePtr);
+  size += rxpop->nsNr * (sizeof(xmlNsPtr) + sizeof(xmlNs));
+
+  return size;
+}
+
+static const rb_data_type_t rxml_xpath_object_data_type = {
+  "LibXML::XML::XPath::Object",
+  {(RUBY_DATA_FUNC)rxml_xpath_object_mark, (RUBY_DATA_FUNC)rxml_xpath_object_free, rxml_xpath_object_memsize},
+  NULL, NULL, 0
+};
+
+/* Wraps an XPath result.  namespaces must be nonzero if the node set may
+   contain namespace nodes. */
+VALUE rxml_xpath_object_wrap(xmlDocPtr xdoc, xmlXPathObjectPtr xpop, int namespaces)
+{
+  VALUE result;
   rxml_xpath_object *rxpop = ALLOC(rxml_xpath_object);
 
-  /* Make sure Ruby's GC can find the array in the stack */
-  VALUE nsnodes = rb_ary_new();
-  rxpop->xdoc =xdoc;
+  xmlNodeSetPtr xset = xpop->nodesetval;
+  int i;
+
+  rxpop->xdoc = xdoc;
   rxpop->xpop = xpop;
+  rxpop->nsnodes = NULL;
+  rxpop->nsNr = 0;
 
-  /* Find all the extra namespace nodes and wrap them. */
-  if (xpop->nodesetval && xpop->nodesetval->nodeNr)
+  /* Find the namespace copies, only allocating if there are any */
+  for (i = 0; namespaces && xset && i < xset->nodeNr; i++)
   {
-    for (i = 0; i < xpop->nodesetval->nodeNr; i++)
-    {
-      xmlNodePtr xnode = xpop->nodesetval->nodeTab[i];
-      if (xnode != NULL && xnode->type == XML_NAMESPACE_DECL)
-      {
-        VALUE ns = Qnil;
-        xmlNsPtr xns = (xmlNsPtr)xnode;
-
-        /* Get rid of libxml's -> next hack.  The issue here is
-           the rxml_namespace code assumes that ns->next refers
-           to another namespace. */
-        xns->next = NULL;
-
-        /* Specify a custom free function here since by default
-           namespace nodes will not be freed */
-        ns = rxml_namespace_wrap((xmlNsPtr)xnode);
-        RDATA(ns)->dfree = (RUBY_DATA_FUNC)rxml_xpath_namespace_free;
-        rb_ary_push(nsnodes, ns);
-      }
-    }
+    if (xset->nodeTab[i]->type != XML_NAMESPACE_DECL)
+      continue;
+
+    if (!rxpop->nsnodes)
+      rxpop->nsnodes = ALLOC_N(xmlNsPtr, xset->nodeNr - i);
+    rxpop->nsnodes[rxpop->nsNr++] = (xmlNsPtr)xset->nodeTab[i];
   }
 
-  rxpop->nsnodes = nsnodes;
-  return Data_Wrap_Struct(cXMLXPathObject, rxml_xpath_object_mark, rxml_xpath_object_free, rxpop);
+  result = TypedData_Wrap_Struct(cXMLXPathObject, &rxml_xpath_object_data_type, rxpop);
+  return result;
+}
+
+/* Namespace nodes in a node set are copies that are freed with the
+   node set.  Their next member points to the parent element instead of
+   another namespace, so hand out an independent copy instead. */
+static VALUE rxml_xpath_object_namespace(xmlNsPtr xns)
+{
+  VALUE result;
+  xmlNsPtr copy = (xmlNsPtr)xmlMalloc(sizeof(xmlNs));
+
+  memset(copy, 0, sizeof(xmlNs));
+  copy->type = XML_NAMESPACE_DECL;
+  copy->href = xmlStrdup(xns->href);
+  copy->prefix = xmlStrdup(xns->prefix);
+
+  result = rxml_namespace_wrap(copy);
+  RDATA(result)->dfree = (RUBY_DATA_FUNC)rxml_xpath_namespace_free;
+  return result;
+}
+
+xmlNodeSetPtr rxml_xpath_object_nodeset(VALUE self)
+{
+  rxml_xpath_object *rxpop;
+  TypedData_Get_Struct(self, rxml_xpath_object, &rxml_xpath_object_data_type, rxpop);
+  return rxpop->xpop->nodesetval;
 }
 
 static VALUE rxml_xpath_object_tabref(xmlXPathObjectPtr xpop, int index)
@@ -108,7 +153,7 @@ static VALUE rxml_xpath_object_tabref(xmlXPathObjectPtr xpop, int index)
     return rxml_attr_wrap((xmlAttrPtr) xpop->nodesetval->nodeTab[index]);
     break;
   case XML_NAMESPACE_DECL:
-    return rxml_namespace_wrap((xmlNsPtr)xpop->nodesetval->nodeTab[index]);
+    return rxml_xpath_object_namespace((xmlNsPtr)xpop->nodesetval->nodeTab[index]);
     break;
   default:
     return rxml_node_wrap(xpop->nodesetval->nodeTab[index]);
@@ -128,7 +173,7 @@ static VALUE rxml_xpath_object_to_a(VALUE self)
   xmlXPathObjectPtr xpop;
   int i;
 
-  Data_Get_Struct(self, rxml_xpath_object, rxpop);
+  TypedData_Get_Struct(self, rxml_xpath_object, &rxml_xpath_object_data_type, rxpop);
   xpop = rxpop->xpop;
 
   set_ary = rb_ary_new();
@@ -145,6 +190,106 @@ static VALUE rxml_xpath_object_to_a(VALUE self)
   return (set_ary);
 }
 
+/* Returns the XPath string value of a node.  Text, attribute values made
+   of a single text node and the like are returned without copying and
+   *copy is set to 0, otherwise the caller must free the result. */
+static const xmlChar *rxml_xpath_object_node_content(xmlNodePtr xnode, int *copy)
+{
+  *copy = 0;
+
+  switch (xnode->type)
+  {
+  case XML_TEXT_NODE:
+  case XML_CDATA_SECTION_NODE:
+  case XML_COMMENT_NODE:
+  case XML_PI_NODE:
+    if (xnode->content)
+      return xnode->content;
+    break;
+  case XML_ATTRIBUTE_NODE:
+    if (xnode->children && xnode->children == xnode->last &&
+        xnode->children->type == XML_TEXT_NODE && xnode->children->content)
+      return xnode->children->content;
+    break;
+  case XML_NAMESPACE_DECL:
+    return ((xmlNsPtr)xnode)->href;
+  default:
+    break;
+  }
+
+  *copy = 1;
+  return xmlXPathCastNodeToString(xnode);
+}
+
+/*
+ * call-seq:
+ *    xpath_object.contents -> [String, ..., String]
+ *    xpath_object.contents(:freeze => true, :dedup => true) -> [String, ..., String]
+ *
+ * Returns the string values of the nodes in this set, which is the
+ * content of elements, text and comments and the value of attributes.
+ * The strings are read straight from the node set, no node objects
+ * are created.  Valid options are:
+ *
+ *  freeze - Returns frozen strings.
+ *  dedup - Returns deduplicated, frozen strings (see String#-@), which
+ *          saves memory when the same values occur many times.
+ *
+ *  doc.find('//book/@id').contents # => ["bk101", "bk102", ...]
+ */
+static VALUE rxml_xpath_object_contents(int argc, VALUE *argv, VALUE self)
+{
+  VALUE options, result;
+  rxml_xpath_object *rxpop;
+  xmlNodeSetPtr xnodes;
+  int freeze = 0, dedup = 0;
+  int i;
+
+  rb_scan_args(argc, argv, "01", &options);
+  if (!NIL_P(options))
+  {
+    Check_Type(options, T_HASH);
+    freeze = RTEST(rb_hash_aref(options, ID2SYM(rb_intern("freeze"))));
+    dedup = RTEST(rb_hash_aref(options, ID2SYM(rb_intern("dedup"))));
+  }
+
+  TypedData_Get_Struct(self, rxml_xpath_object, &rxml_xpath_object_data_type, rxpop);
+  xnodes = rxpop->xpop->nodesetval;
+
+  if (xnodes == NULL || xnodes->nodeNr <= 0)
+    return rb_ary_new();
+
+  result = rb_ary_new2(xnodes->nodeNr);
+
+  for (i = 0; i < xnodes->nodeNr; i++)
+  {
+    int copy;
+    const xmlChar *content = rxml_xpath_object_node_content(xnodes->nodeTab[i], &copy);
+    VALUE value;
+
+#ifdef HAVE_RB_ENC_INTERNED_STR
+    /* Look up existing deduplicated strings without allocating */
+    if (dedup && !rb_default_internal_encoding())
+      value = rb_enc_interned_str((const char*)content, strlen((const char*)content),
+                                  rxml_figure_encoding(rxpop->xdoc->encoding));
+    else
+#endif
+      value = rxml_new_cstr(content, rxpop->xdoc->encoding);
+
+    if (copy)
+      xmlFree((xmlChar*)content);
+
+    if (dedup && !OBJ_FROZEN(value))
+      value = rb_funcall(value, rb_intern("-@"), 0);
+    else if (freeze)
+      rb_obj_freeze(value);
+
+    rb_ary_push(result, value);
+  }
+
+  return result;
+}
+
 /*
  * call-seq:
  *    xpath_object.empty? -> (true|false)
@@ -154,7 +299,7 @@ static VALUE rxml_xpath_object_to_a(VALUE self)
 static VALUE rxml_xpath_object_empty_q(VALUE self)
 {
   rxml_xpath_object *rxpop;
-  Data_Get_Struct(self, rxml_xpath_object, rxpop);
+  TypedData_Get_Struct(self, rxml_xpath_object, &rxml_xpath_object_data_type, rxpop);
 
   if (rxpop->xpop->type != XPATH_NODESET)
     return Qnil;
@@ -177,7 +322,7 @@ static VALUE rxml_xpath_object_each(VALUE self)
   if (rxml_xpath_object_empty_q(self) == Qtrue)
     return Qnil;
 
-  Data_Get_Struct(self, rxml_xpath_object, rxpop);
+  TypedData_Get_Struct(self, rxml_xpath_object, &rxml_xpath_object_data_type, rxpop);
 
   for (i = 0; i < rxpop->xpop->nodesetval->nodeNr; i++)
   {
@@ -199,7 +344,7 @@ static VALUE rxml_xpath_object_first(VALUE self)
   if (rxml_xpath_object_empty_q(self) == Qtrue)
     return Qnil;
 
-  Data_Get_Struct(self, rxml_xpath_object, rxpop);
+  TypedData_Get_Struct(self, rxml_xpath_object, &rxml_xpath_object_data_type, rxpop);
   return rxml_xpath_object_tabref(rxpop->xpop, 0);
 }
 
@@ -216,7 +361,7 @@ static VALUE rxml_xpath_object_last(VALUE self)
   if (rxml_xpath_object_empty_q(self) == Qtrue)
     return Qnil;
 
-  Data_Get_Struct(self, rxml_xpath_object, rxpop);
+  TypedData_Get_Struct(self, rxml_xpath_object, &rxml_xpath_object_data_type, rxpop);
   return rxml_xpath_object_tabref(rxpop->xpop, -1);
 }
 
@@ -233,7 +378,7 @@ static VALUE rxml_xpath_object_aref(VALUE self, VALUE aref)
   if (rxml_xpath_object_empty_q(self) == Qtrue)
     return Qnil;
 
-  Data_Get_Struct(self, rxml_xpath_object, rxpop);
+  TypedData_Get_Struct(self, rxml_xpath_object, &rxml_xpath_object_data_type, rxpop);
   return rxml_xpath_object_tabref(rxpop->xpop, NUM2INT(aref));
 }
 
@@ -250,7 +395,7 @@ static VALUE rxml_xpath_object_length(VALUE self)
   if (rxml_xpath_object_empty_q(self) == Qtrue)
     return INT2FIX(0);
 
-  Data_Get_Struct(self, rxml_xpath_object, rxpop);
+  TypedData_Get_Struct(self, rxml_xpath_object, &rxml_xpath_object_data_type, rxpop);
   return INT2NUM(rxpop->xpop->nodesetval->nodeNr);
 }
 
@@ -276,7 +421,7 @@ static VALUE rxml_xpath_object_length(VALUE self)
 static VALUE rxml_xpath_object_get_type(VALUE self)
 {
   rxml_xpath_object *rxpop;
-  Data_Get_Struct(self, rxml_xpath_object, rxpop);
+  TypedData_Get_Struct(self, rxml_xpath_object, &rxml_xpath_object_data_type, rxpop);
   return INT2FIX(rxpop->xpop->type);
 }
 
@@ -290,7 +435,7 @@ static VALUE rxml_xpath_object_string(VALUE self)
 {
   rxml_xpath_object *rxpop;
 
-  Data_Get_Struct(self, rxml_xpath_object, rxpop);
+  TypedData_Get_Struct(self, rxml_xpath_object, &rxml_xpath_object_data_type, rxpop);
 
   if (rxpop->xpop->stringval == NULL)
     return Qnil;
@@ -309,7 +454,7 @@ static VALUE rxml_xpath_object_debug(VALUE self)
 {
 #ifdef LIBXML_DEBUG_ENABLED
   rxml_xpath_object *rxpop;
-  Data_Get_Struct(self, rxml_xpath_object, rxpop);
+  TypedData_Get_Struct(self, rxml_xpath_object, &rxml_xpath_object_data_type, rxpop);
   xmlXPathDebugDumpObject(stdout, rxpop->xpop, 0);
   return Qtrue;
 #else
@@ -321,6 +466,7 @@ static VALUE rxml_xpath_object_debug(VALUE self)
 void rxml_init_xpath_object(void)
 {
   cXMLXPathObject = rb_define_class_under(mXPath, "Object", rb_cObject);
+  rb_undef_alloc_func(cXMLXPathObject);
   rb_include_module(cXMLXPathObject, rb_mEnumerable);
   rb_define_attr(cXMLXPathObject, "context", 1, 0);
   rb_define_method(cXMLXPathObject, "each", rxml_xpath_object_each, 0);
@@ -330,6 +476,7 @@ void rxml_init_xpath_object(void)
   rb_define_method(cXMLXPathObject, "last", rxml_xpath_object_last, 0);
   rb_define_method(cXMLXPathObject, "length", rxml_xpath_object_length, 0);
   rb_define_method(cXMLXPathObject, "to_a", rxml_xpath_object_to_a, 0);
+  rb_define_method(cXMLXPathObject, "contents", rxml_xpath_object_contents, -1);
   rb_define_method(cXMLXPathObject, "[]", rxml_xpath_object_aref, 1);
   rb_define_method(cXMLXPathObject, "string", rxml_xpath_object_string, 0);
   rb_define_method(cXMLXPathObject, "debug", rxml_xpath_object_debug, 0);
@@ -7,11 +7,13 @@ typedef struct rxml_xpath_object
 {
   xmlDocPtr xdoc;
   xmlXPathObjectPtr xpop;
-  VALUE nsnodes;
+  xmlNsPtr *nsnodes;
+  int nsNr;
 } rxml_xpath_object;
 
 
 void rxml_init_xpath_object(void);
-VALUE rxml_xpath_object_wrap(xmlDocPtr xdoc, xmlXPathObjectPtr xpop);
+VALUE rxml_xpath_object_wrap(xmlDocPtr xdoc, xmlXPathObjectPtr xpop, int namespaces);
+xmlNodeSetPtr rxml_xpath_object_nodeset(VALUE self);
 
 #endif
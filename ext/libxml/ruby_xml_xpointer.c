@@ -38,7 +38,7 @@ static VALUE rxml_xpointer_point(VALUE class, VALUE rnode, VALUE xptr_str)
   if (!xpop)
   rxml_raise(&xmlLastError);
 
-  result = rxml_xpath_object_wrap(xnode->doc, xpop);
+  result = rxml_xpath_object_wrap(xnode->doc, xpop, 1);
   rb_iv_set(result, "@context", context);
 
   return(result);
@@ -84,7 +84,7 @@ static VALUE rxml_xpointer_range(VALUE class, VALUE rstart, VALUE rend)
   if (xpath == NULL)
   rb_fatal("You shouldn't be able to have this happen");
 
-  rxxp = rxml_xpath_object_wrap(start->doc, xpath);
+  rxxp = rxml_xpath_object_wrap(start->doc, xpath, 0);
   return(rxxp);
 #else
   rb_warn("libxml was compiled without XPointer support");
@@ -11,6 +11,7 @@ end
 # Load Ruby supporting code.
 require 'libxml/error'
 require 'libxml/parser'
+require 'libxml/parser/pool'
 require 'libxml/document'
 require 'libxml/namespaces'
 require 'libxml/namespace'
@@ -84,8 +84,10 @@ module LibXML
       # Namespaces is an optional array of XML::NS objects
       def context(nslist = nil)
         context = XPath::Context.new(self)
-        context.node = self.root
-        context.register_namespaces_from_node(self.root)
+        if self.root
+          context.node = self.root
+          context.register_namespaces_from_node(self.root)
+        end
         context.register_namespaces(nslist) if nslist
         context
       end
@@ -97,6 +99,7 @@ module LibXML
       #
       # call-seq:
       #   document.find(xpath, nslist=nil) -> XML::XPath::Object
+      #   document.find(xpath, nslist=nil, :vars => {'id' => 'bk101'}) -> XML::XPath::Object
       # 
       # Parameters:
       # * xpath - The xpath expression as a string
@@ -119,15 +122,52 @@ module LibXML
       #    ... do stuff ...
       #  end
       # #  nodes = nil #  GC.start
-      def find(xpath, nslist = nil)
-        self.context(nslist).find(xpath)
+      #
+      # Without a namespace list the query reuses a context cached by
+      # the document, which already has the root's namespaces registered.
+      #
+      # XPath variables can be bound with the :vars option, so a
+      # compiled XPath::Expression can be reused for different values:
+      #
+      #  expr = XML::XPath::Expression.new('//book[@id = $id]')
+      #  document.find(expr, :vars => {'id' => 'bk101'})
+      def find(xpath, nslist = nil, **options)
+        if self.root.nil?
+          vars = options.delete(:vars)
+          nslist = nslist ? [nslist, options] : options unless options.empty?
+          context = self.context(nslist)
+          vars.each {|name, value| context[name] = value} if vars
+          context.find(xpath)
+        else
+          self.root.find(xpath, nslist, **options)
+        end
       end
     
+      # call-seq:
+      #   document.find_values(xpath, nslist=nil) -> [String]
+      #   document.find_values(xpath, nslist=nil, :freeze => true, :dedup => true) -> [String]
+      #
+      # Returns the string values of the nodes matching the specified
+      # xpath expression, without creating node objects for them (see
+      # XML::XPath::Object#contents).  If the expression returns a
+      # single value, such as a count or a boolean, it is returned in
+      # an array.
+      #
+      #  document.find_values('//book/@id')
+      def find_values(xpath, nslist = nil, freeze: false, dedup: false)
+        result = find(xpath, nslist)
+        if result.is_a?(XPath::Object)
+          result.contents(:freeze => freeze, :dedup => dedup)
+        else
+          [result]
+        end
+      end
+
       # Return the first node matching the specified xpath expression.
       # For more information, please refer to the documentation
       # for XML::Document#find.
-      def find_first(xpath, nslist = nil)
-        find(xpath, nslist).first
+      def find_first(xpath, nslist = nil, **options)
+        find(xpath, nslist, **options).first
       end
       
       # Returns this node's type name    
@@ -13,6 +13,8 @@ module LibXML
       # You may provide an optional hash table to control how the
       # parsing is performed.  Valid options are:
       #
+      #  dictionary - An XML::Dictionary to intern names in, see
+      #               XML::Dictionary.
       #  encoding - The document encoding, defaults to nil. Valid values
       #             are the encoding constants defined on XML::Encoding.
       #  options - Parser options.  Valid values are the constants defined on
@@ -22,6 +24,7 @@ module LibXML
         context = XML::HTMLParser::Context.file(path)
         context.encoding = options[:encoding] if options[:encoding]
         context.options = options[:options] if options[:options]
+        context.dictionary = options[:dictionary] if options[:dictionary]
         self.new(context)
       end
 
@@ -37,16 +40,21 @@ module LibXML
       #
       #  io - io object that contains the xml to parser
       #  base_uri - The base url for the parsed document.
+      #  chunk_size - The number of bytes to read from the io object at a
+      #               time, defaults to 65536.
+      #  dictionary - An XML::Dictionary to intern names in, see
+      #               XML::Dictionary.
       #  encoding - The document encoding, defaults to nil. Valid values
       #             are the encoding constants defined on XML::Encoding.
       #  options - Parser options.  Valid values are the constants defined on
       #            XML::HTMLParser::Options.  Mutliple options can be combined
       #            by using Bitwise OR (|).
       def self.io(io, options = {})
-        context = XML::HTMLParser::Context.io(io)
+        context = XML::HTMLParser::Context.io(io, :chunk_size => options[:chunk_size])
         context.base_uri = options[:base_uri] if options[:base_uri]
         context.encoding = options[:encoding] if options[:encoding]
         context.options = options[:options] if options[:options]
+        context.dictionary = options[:dictionary] if options[:dictionary]
         self.new(context)
       end
 
@@ -62,6 +70,8 @@ module LibXML
       # parsing is performed.  Valid options are:
       #
       #  base_uri - The base url for the parsed document.
+      #  dictionary - An XML::Dictionary to intern names in, see
+      #               XML::Dictionary.
       #  encoding - The document encoding, defaults to nil. Valid values
       #             are the encoding constants defined on XML::Encoding.
       #  options - Parser options.  Valid values are the constants defined on
@@ -72,6 +82,7 @@ module LibXML
         context.base_uri = options[:base_uri] if options[:base_uri]
         context.encoding = options[:encoding] if options[:encoding]
         context.options = options[:options] if options[:options]
+        context.dictionary = options[:dictionary] if options[:dictionary]
         self.new(context)
       end
 
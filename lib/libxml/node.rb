@@ -64,25 +64,70 @@ module LibXML
       end
 
       # call-seq:
-      #   node.find(namespaces=nil) -> XPath::XPathObject
+      #   node.find(xpath, namespaces=nil) -> XPath::XPathObject
+      #   node.find(xpath, namespaces=nil, :vars => {'id' => 'bk101'}) -> XPath::XPathObject
       #
       # Return nodes matching the specified xpath expression.
       # For more information, please refer to the documentation
       # for XML::Document#find.
       #
-      # Namespaces is an optional array of XML::NS objects
-      def find(xpath, nslist = nil)
-        self.context(nslist).find(xpath)
+      # Namespaces is an optional array of XML::NS objects.  Without
+      # them the query reuses an XPath context cached by the document,
+      # unless namespaces declared below the root are in scope.
+      #
+      # The :vars option binds XPath variables for this query, see
+      # XML::XPath::Context#[]=.
+      def find(xpath, nslist = nil, **options)
+        vars = options.delete(:vars)
+        # Any other keywords are namespaces passed as a hash without braces
+        nslist = nslist ? [nslist, options] : options unless options.empty?
+
+        document = self.doc
+        context = document.__send__(:checkout_xpath_context, self) if document && !nslist
+        unless context
+          context = self.context(nslist)
+          vars.each {|name, value| context[name] = value} if vars
+          return context.find(xpath)
+        end
+
+        begin
+          vars.each {|name, value| context[name] = value} if vars
+          context.find(xpath)
+        ensure
+          vars.each_key {|name| context[name] = nil} if vars
+          document.__send__(:checkin_xpath_context, context)
+        end
       end
     
+      # call-seq:
+      #   node.find_strings(xpath, namespaces=nil) -> [String]
+      #   node.find_strings(xpath, namespaces=nil, :freeze => true, :dedup => true) -> [String]
+      #
+      # Returns the string values of the nodes matching the specified
+      # xpath expression, without creating node objects for them (see
+      # XML::XPath::Object#contents).  If the expression returns a
+      # single value, such as a count or a string, it is returned in
+      # an array, converted to a string as by XPath's string() function
+      # (see XML::XPath.string).
+      #
+      #  node.find_strings('book/title')
+      def find_strings(xpath, nslist = nil, freeze: false, dedup: false)
+        result = find(xpath, nslist)
+        if result.is_a?(XPath::Object)
+          result.contents(:freeze => freeze, :dedup => dedup)
+        else
+          [XPath.string(result)]
+        end
+      end
+
       # call-seq:
       #   node.find_first(namespaces=nil) -> XML::Node
       #
       # Return the first node matching the specified xpath expression.
       # For more information, please refer to the documentation
       # for the #find method.
-      def find_first(xpath, nslist = nil)
-        find(xpath, nslist).first
+      def find_first(xpath, nslist = nil, **options)
+        find(xpath, nslist, **options).first
       end
 
       # call-seq:
@@ -106,17 +151,6 @@ module LibXML
         end
       end
       
-      # Iterates over this node's child elements (nodes
-      # that have a node_type == ELEMENT_NODE).
-      #
-      #  doc = XML::Document.new('model/books.xml')
-      #  doc.root.each_element {|element| puts element}
-      def each_element
-        each do |node|
-          yield(node) if node.node_type == ELEMENT_NODE
-        end
-      end
-      
       # Determines whether this node has a parent node
       def parent?
         not parent.nil?
@@ -26,8 +26,12 @@ module LibXML
       # You may provide an optional hash table to control how the
       # parsing is performed.  Valid options are:
       #
+      #  dictionary - An XML::Dictionary to intern names in, see
+      #               XML::Dictionary.
       #  encoding - The document encoding, defaults to nil. Valid values
       #             are the encoding constants defined on XML::Encoding.
+      #  id_attribute - The name of an attribute to treat as an ID, see
+      #                 XML::Parser::Context#id_attribute=.
       #  options - Parser options.  Valid values are the constants defined on
       #            XML::Parser::Options.  Mutliple options can be combined
       #            by using Bitwise OR (|).
@@ -35,6 +39,38 @@ module LibXML
         context = XML::Parser::Context.file(path)
         context.encoding = options[:encoding] if options[:encoding]
         context.options = options[:options] if options[:options]
+        context.dictionary = options[:dictionary] if options[:dictionary]
+        context.id_attribute = options[:id_attribute] if options[:id_attribute]
+        self.new(context)
+      end
+
+      # call-seq:
+      #    XML::Parser.mmap(path) -> XML::Parser
+      #    XML::Parser.mmap(path, :encoding => XML::Encoding::UTF_8,
+      #                           :options => XML::Parser::Options::NOENT) -> XML::Parser
+      #
+      # Creates a new parser for the specified file, which is mapped
+      # into memory instead of being read into buffers.  See
+      # XML::Parser::Context.mmap.
+      #
+      # You may provide an optional hash table to control how the
+      # parsing is performed.  Valid options are:
+      #
+      #  dictionary - An XML::Dictionary to intern names in, see
+      #               XML::Dictionary.
+      #  encoding - The document encoding, defaults to nil. Valid values
+      #             are the encoding constants defined on XML::Encoding.
+      #  id_attribute - The name of an attribute to treat as an ID, see
+      #                 XML::Parser::Context#id_attribute=.
+      #  options - Parser options.  Valid values are the constants defined on
+      #            XML::Parser::Options.  Mutliple options can be combined
+      #            by using Bitwise OR (|).
+      def self.mmap(path, options = {})
+        context = XML::Parser::Context.mmap(path)
+        context.encoding = options[:encoding] if options[:encoding]
+        context.options = options[:options] if options[:options]
+        context.dictionary = options[:dictionary] if options[:dictionary]
+        context.id_attribute = options[:id_attribute] if options[:id_attribute]
         self.new(context)
       end
 
@@ -50,16 +86,62 @@ module LibXML
       #
       #  io - io object that contains the xml to parser
       #  base_uri - The base url for the parsed document.
+      #  chunk_size - The number of bytes to read from the io object at a
+      #               time, defaults to 65536.
+      #  dictionary - An XML::Dictionary to intern names in, see
+      #               XML::Dictionary.
       #  encoding - The document encoding, defaults to nil. Valid values
       #             are the encoding constants defined on XML::Encoding.
+      #  id_attribute - The name of an attribute to treat as an ID, see
+      #                 XML::Parser::Context#id_attribute=.
       #  options - Parser options.  Valid values are the constants defined on
       #            XML::Parser::Options.  Mutliple options can be combined
       #            by using Bitwise OR (|).
       def self.io(io, options = {})
-        context = XML::Parser::Context.io(io)
+        context = XML::Parser::Context.io(io, :chunk_size => options[:chunk_size])
+        context.base_uri = options[:base_uri] if options[:base_uri]
+        context.encoding = options[:encoding] if options[:encoding]
+        context.options = options[:options] if options[:options]
+        context.dictionary = options[:dictionary] if options[:dictionary]
+        context.id_attribute = options[:id_attribute] if options[:id_attribute]
+        self.new(context)
+      end
+
+      # call-seq:
+      #    XML::Parser.push -> XML::Parser
+      #    XML::Parser.push(:encoding => XML::Encoding::UTF_8,
+      #                     :options => XML::Parser::Options::NOENT
+      #                     :base_uri="http://libxml.org") -> XML::Parser
+      #
+      # Creates a new parser that is fed its input in chunks via
+      # XML::Parser#feed.  Once all the input has been fed, call
+      # XML::Parser#finish to obtain the document.
+      #
+      #   parser = XML::Parser.push
+      #   parser.feed('<root><chi')
+      #   parser.feed('ld/></root>')
+      #   doc = parser.finish
+      #
+      # You may provide an optional hash table to control how the
+      # parsing is performed.  Valid options are:
+      #
+      #  base_uri - The base url for the parsed document.
+      #  dictionary - An XML::Dictionary to intern names in, see
+      #               XML::Dictionary.
+      #  encoding - The document encoding, defaults to nil. Valid values
+      #             are the encoding constants defined on XML::Encoding.
+      #  id_attribute - The name of an attribute to treat as an ID, see
+      #                 XML::Parser::Context#id_attribute=.
+      #  options - Parser options.  Valid values are the constants defined on
+      #            XML::Parser::Options.  Mutliple options can be combined
+      #            by using Bitwise OR (|).
+      def self.push(options = {})
+        context = XML::Parser::Context.push
         context.base_uri = options[:base_uri] if options[:base_uri]
         context.encoding = options[:encoding] if options[:encoding]
         context.options = options[:options] if options[:options]
+        context.dictionary = options[:dictionary] if options[:dictionary]
+        context.id_attribute = options[:id_attribute] if options[:id_attribute]
         self.new(context)
       end
 
@@ -75,8 +157,12 @@ module LibXML
       # parsing is performed.  Valid options are:
       #
       #  base_uri - The base url for the parsed document.
+      #  dictionary - An XML::Dictionary to intern names in, see
+      #               XML::Dictionary.
       #  encoding - The document encoding, defaults to nil. Valid values
       #             are the encoding constants defined on XML::Encoding.
+      #  id_attribute - The name of an attribute to treat as an ID, see
+      #                 XML::Parser::Context#id_attribute=.
       #  options - Parser options.  Valid values are the constants defined on
       #            XML::Parser::Options.  Mutliple options can be combined
       #            by using Bitwise OR (|).
@@ -85,6 +171,8 @@ module LibXML
         context.base_uri = options[:base_uri] if options[:base_uri]
         context.encoding = options[:encoding] if options[:encoding]
         context.options = options[:options] if options[:options]
+        context.dictionary = options[:dictionary] if options[:dictionary]
+        context.id_attribute = options[:id_attribute] if options[:id_attribute]
         self.new(context)
       end
 
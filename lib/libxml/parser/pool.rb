@@ -0,0 +1,134 @@
+# encoding: UTF-8
+
+module LibXML
+  module XML
+    # XML::Parser::Pool recycles parser contexts when parsing many
+    # small documents.  Creating a context allocates and initializes
+    # a dictionary, a SAX handler and a number of input and node
+    # stacks, which can cost more than parsing a tiny document.  A
+    # pool instead resets a context it has used before (see
+    # XML::Parser::Context#reset) and points it at the new input.
+    #
+    #   POOL = XML::Parser::Pool.new(:size => 8)
+    #   doc = POOL.parse('<envelope><body/></envelope>')
+    #
+    # A pool may be shared between threads.  Each parse checks out
+    # its own context, so at most one thread uses a context at a time.
+    # The pool keeps up to +size+ idle contexts, any more are left to
+    # the garbage collector.
+    #
+    # Contexts keep their dictionary between parses, so a pool works
+    # best for documents that share a vocabulary.  Pass a :dictionary
+    # to share a single one between all of them.
+    class Parser::Pool
+      attr_reader :size
+
+      # call-seq:
+      #    XML::Parser::Pool.new -> XML::Parser::Pool
+      #    XML::Parser::Pool.new(:size => 8,
+      #                          :encoding => XML::Encoding::UTF_8,
+      #                          :options => XML::Parser::Options::NOENT) -> XML::Parser::Pool
+      #
+      # Creates a new pool.  Valid options are:
+      #
+      #  size - The maximum number of idle contexts kept, defaults to 16.
+      #  dictionary - An XML::Dictionary shared by all the pool's contexts,
+      #               see XML::Dictionary.
+      #  encoding - The document encoding, defaults to nil. Valid values
+      #             are the encoding constants defined on XML::Encoding.
+      #  id_attribute - The name of an attribute to treat as an ID, see
+      #                 XML::Parser::Context#id_attribute=.
+      #  options - Parser options.  Valid values are the constants defined on
+      #            XML::Parser::Options.  Mutliple options can be combined
+      #            by using Bitwise OR (|).
+      def initialize(options = {})
+        @size = options.fetch(:size, 16)
+        raise(ArgumentError, "size must not be negative") if @size < 0
+
+        @dictionary = options[:dictionary]
+        @encoding = options[:encoding]
+        @id_attribute = options[:id_attribute]
+        @options = options[:options]
+        @contexts = []
+        @mutex = Mutex.new
+        @hits = 0
+        @misses = 0
+      end
+
+      # call-seq:
+      #    pool.parse(string) -> XML::Document
+      #
+      # Parses the string with a pooled context and returns the
+      # document.  Raises an XML::Error if the string is not well formed.
+      def parse(string)
+        context = checkout(string)
+        begin
+          XML::Parser.new(context).parse
+        ensure
+          checkin(context)
+        end
+      end
+
+      # call-seq:
+      #    pool.stats -> Hash
+      #
+      # Returns statistics about the pool: the number of parses that
+      # reused a context (:hits) or had to create one (:misses), the
+      # resulting :hit_rate and the number of idle contexts (:idle).
+      def stats
+        @mutex.synchronize do
+          total = @hits + @misses
+          {:hits => @hits,
+           :misses => @misses,
+           :hit_rate => total.zero? ? 0.0 : @hits.fdiv(total),
+           :idle => @contexts.length,
+           :size => @size}
+        end
+      end
+
+      # call-seq:
+      #    pool.clear -> XML::Parser::Pool
+      #
+      # Releases all idle contexts.
+      def clear
+        @mutex.synchronize do
+          @contexts.clear
+        end
+        self
+      end
+
+      private
+
+      def checkout(string)
+        context = @mutex.synchronize do
+          if context = @contexts.pop
+            @hits += 1
+          else
+            @misses += 1
+          end
+          context
+        end
+
+        if context
+          context.reset(string)
+        else
+          context = XML::Parser::Context.string(string)
+          context.options = @options if @options
+          context.dictionary = @dictionary if @dictionary
+        end
+        context.encoding = @encoding if @encoding
+        context.id_attribute = @id_attribute
+        context
+      end
+
+      def checkin(context)
+        # Release the input and anything left over from a failed parse
+        context.reset
+
+        @mutex.synchronize do
+          @contexts.push(context) if @contexts.length < @size
+        end
+      end
+    end
+  end
+end
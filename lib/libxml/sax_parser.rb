@@ -28,6 +28,25 @@ module LibXML
         self.new(context)
       end
 
+      # call-seq:
+      #    XML::SaxParser.push -> XML::SaxParser
+      #    XML::SaxParser.push(:encoding => XML::Encoding::UTF_8) -> XML::SaxParser
+      #
+      # Creates a new parser that is fed its input in chunks, as it
+      # arrives, via XML::SaxParser#feed.  Callbacks are generated as
+      # each chunk is parsed.  Call XML::SaxParser#finish once all the
+      # input has been fed.
+      #
+      # Parameters:
+      #
+      #  encoding - The document encoding, defaults to nil. Valid values
+      #             are the encoding constants defined on XML::Encoding.
+      def self.push(options = {})
+        context = XML::Parser::Context.push
+        context.encoding = options[:encoding] if options[:encoding]
+        self.new(context)
+      end
+
       # call-seq:
       #    XML::SaxParser.string(string)
       #
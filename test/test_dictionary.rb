@@ -0,0 +1,91 @@
+# encoding: UTF-8
+
+require File.expand_path('../test_helper', __FILE__)
+
+class TestDictionary < Minitest::Test
+  def test_new
+    dict = XML::Dictionary.new
+    assert_equal(0, dict.size)
+    refute(dict.include?('root'))
+  end
+
+  def test_parser
+    dict = XML::Dictionary.new
+    docs = 2.times.map do
+      XML::Parser.string('<root><child attr="1"/></root>', :dictionary => dict).parse
+    end
+
+    assert(dict.include?('root'))
+    assert(dict.include?('child'))
+    assert(dict.include?('attr'))
+
+    # Names are only added once
+    size = dict.size
+    XML::Parser.string('<root><child attr="1"/></root>', :dictionary => dict).parse
+    assert_equal(size, dict.size)
+
+    docs.each do |doc|
+      assert_equal('child', doc.root.first.name)
+    end
+  end
+
+  def test_documents_outlive_dictionary
+    dict = XML::Dictionary.new
+    doc = XML::Parser.string('<root><child/></root>', :dictionary => dict).parse
+    dict = nil
+    GC.start
+
+    doc.root << XML::Node.new('other')
+    assert_equal(%w(child other), doc.root.children.map(&:name))
+  end
+
+  def test_context
+    dict = XML::Dictionary.new
+    context = XML::Parser::Context.string('<root/>')
+    assert_nil(context.dictionary)
+
+    context.options = XML::Parser::Options::NODICT
+    context.dictionary = dict
+    assert_same(dict, context.dictionary)
+    assert_equal(0, context.options & XML::Parser::Options::NODICT)
+
+    XML::Parser.new(context).parse
+    assert(dict.include?('root'))
+
+    error = assert_raises(RuntimeError) do
+      context.dictionary = XML::Dictionary.new
+    end
+    assert_equal('Cannot change the dictionary once parsing has started', error.to_s)
+
+    assert_raises(TypeError) do
+      context.dictionary = 'dict'
+    end
+  end
+
+  def test_push
+    dict = XML::Dictionary.new
+    parser = XML::Parser.push(:dictionary => dict)
+    parser.feed('<root><chi')
+    parser.feed('ld/></root>')
+    doc = parser.finish
+
+    assert_equal('child', doc.root.first.name)
+    assert(dict.include?('child'))
+  end
+
+  def test_html_parser
+    dict = XML::Dictionary.new
+    doc = XML::HTMLParser.string('<html><body><p>Hi</p></body></html>', :dictionary => dict).parse
+    assert_equal('html', doc.root.name)
+    assert(dict.include?('body'))
+  end
+
+  def test_pool
+    dict = XML::Dictionary.new
+    pool = XML::Parser::Pool.new(:dictionary => dict)
+    pool.parse('<first/>')
+    pool.parse('<second/>')
+    assert(dict.include?('first'))
+    assert(dict.include?('second'))
+  end
+end
@@ -122,4 +122,161 @@ class TestDocument < Minitest::Test
     assert_equal("<nums><two/><one/></nums>",
                  doc2.root.to_s(:indent => false))
   end
+
+  def test_node_cache
+    refute(@doc.node_cache?)
+    refute(@doc.root.first.equal?(@doc.root.first))
+
+    @doc.node_cache = true
+    assert(@doc.node_cache?)
+
+    nodes = @doc.root.children
+    GC.start
+    assert(nodes.zip(@doc.root.children).all? { |a, b| a.equal?(b) })
+    assert(@doc.find_first('/ruby_array/fixnum').equal?(nodes.first))
+
+    @doc.node_cache = false
+    refute(@doc.node_cache?)
+  end
+
+  def test_node_cache_disabled
+    @doc.node_cache = true
+    names = @doc.root.children.map(&:name)
+    contents = @doc.root.children.map(&:content)
+
+    @doc.node_cache = false
+    GC.start
+
+    assert_equal(names, @doc.root.children.map(&:name))
+    assert_equal(contents, @doc.root.children.map(&:content))
+    assert_equal(names.first, @doc.find_first('/ruby_array/*').name)
+    refute(@doc.root.first.equal?(@doc.root.first))
+  end
+
+  def test_node_cache_modified
+    @doc.node_cache = true
+
+    fixnum = @doc.root.first
+    text = fixnum.first
+    fixnum.content = 'three'
+    error = assert_raises(RuntimeError) do
+      text.content
+    end
+    assert_equal('This node has already been freed.', error.to_s)
+
+    node = fixnum.remove!
+    assert_nil(node.parent)
+    @doc.root << node
+    assert(@doc.root.last.equal?(node))
+    assert_equal('three', node.content)
+  end
+
+  def test_memory_stats
+    require 'objspace'
+    before = ObjectSpace.memsize_of(@doc)
+
+    stats = @doc.memory_stats
+    assert_equal(5, stats[:nodes])
+    assert_equal(6, stats[:text_bytes])
+    assert_operator(stats[:attribute_bytes], :>, 0)
+    assert_operator(stats[:total_bytes], :>, stats[:attribute_bytes] + stats[:dict_bytes])
+
+    # The tree is only counted once memory_stats has walked it
+    assert_operator(before, :<, stats[:total_bytes])
+    assert_operator(ObjectSpace.memsize_of(@doc), :>=, stats[:total_bytes])
+
+    # Changing the tree forgets the stale size
+    @doc.root << XML::Node.new('three')
+    assert_operator(ObjectSpace.memsize_of(@doc), :<, stats[:total_bytes])
+    stats = @doc.memory_stats
+    assert_operator(ObjectSpace.memsize_of(@doc), :>=, stats[:total_bytes])
+  end
+
+  def test_read_only
+    refute(@doc.read_only?)
+    @doc.read_only = true
+    assert(@doc.read_only?)
+
+    node = @doc.root.first
+    assert_raises(FrozenError) {node.content = 'three'}
+    assert_raises(FrozenError) {node.remove!}
+    assert_raises(FrozenError) {@doc.root << XML::Node.new('fixnum')}
+    assert_raises(FrozenError) {@doc.root['uga'] = 'ugh'}
+    assert_raises(FrozenError) {@doc.root.attributes.get_attribute('foo').value = 'baz'}
+    assert_raises(FrozenError) {node.output_escaping = false}
+    assert_raises(FrozenError) {XML::Dtd.new('ruby_array', nil, nil, @doc, true)}
+    assert_equal('<ruby_array uga="booga" foo="bar"><fixnum>one</fixnum><fixnum>two</fixnum></ruby_array>',
+                 @doc.root.to_s(:indent => false))
+    assert_equal(2, @doc.find('/ruby_array/fixnum').length)
+
+    @doc.read_only = false
+    node.content = 'three'
+    assert_equal('three', @doc.root.first.content)
+  end
+
+  def test_build_index
+    doc = XML::Document.string('<root xmlns:p="urn:p"><item id="1"/><p:item id="2"/><group><item id="3"/></group></root>')
+    assert_equal(doc, doc.build_index(:names))
+
+    assert_equal(['1', '3'], doc.find('//item').map {|node| node['id']})
+    assert_equal(['2'], doc.find('//p:item', 'p:urn:p').map {|node| node['id']})
+    assert_equal(['1', '2', '3'], doc.elements_named('item').map {|node| node['id']})
+    assert_equal(['2'], doc.elements_named('item', 'urn:p').map {|node| node['id']})
+    assert_equal([], doc.elements_named('missing'))
+    assert(doc.find('//missing').empty?)
+
+    # Changes discard the index
+    doc.find_first('//group') << XML::Node.new('item')
+    doc.root.first.remove!
+    assert_equal(['2', '3', nil], doc.elements_named('item').map {|node| node['id']})
+    assert_equal(['3', nil], doc.find('//item').map {|node| node['id']})
+
+    doc.drop_index
+    assert_equal(['3', nil], doc.find('//item').map {|node| node['id']})
+    assert_equal(['2'], doc.elements_named('item', 'urn:p').map {|node| node['id']})
+
+    assert_raises(ArgumentError) do
+      doc.build_index(:ids)
+    end
+  end
+
+  def test_build_index_frozen
+    doc = XML::Document.string('<root><item id="1"/><item id="2"/></root>')
+    doc.build_index(:names)
+    doc.freeze
+
+    # The index is discarded and rebuilt without touching the document
+    doc.root.first.remove!
+    assert_equal(['2'], doc.find('//item').map {|node| node['id']})
+    assert_equal(['2'], doc.elements_named('item').map {|node| node['id']})
+
+    assert_raises(FrozenError) {doc.drop_index}
+    assert_raises(FrozenError) {doc.build_index(:names)}
+  end
+
+  def test_element_by_id
+    doc = XML::Document.string('<doc><a xml:id="x1"/><b id="b1"/></doc>')
+    assert_equal('a', doc.element_by_id('x1').name)
+    assert_nil(doc.element_by_id('b1'))
+
+    doc = XML::Document.string('<!DOCTYPE doc [<!ATTLIST b key ID #IMPLIED>]><doc><b key="k1"/></doc>')
+    assert_equal('b', doc.element_by_id('k1').name)
+
+    xml = '<doc><a id="a1"><b id="b1"/></a><c id="a1"/><d p:id="d1" xmlns:p="urn:p"/></doc>'
+    doc = XML::Document.string(xml, :id_attribute => 'id')
+    assert_equal('b', doc.element_by_id('b1').name)
+    assert_equal('a', doc.element_by_id('a1').name)
+    assert_nil(doc.element_by_id('d1'))
+    assert_nil(doc.element_by_id('missing'))
+
+    doc.element_by_id('b1')['id'] = 'b2'
+    assert_nil(doc.element_by_id('b1'))
+    assert_equal('b', doc.element_by_id('b2').name)
+
+    doc.element_by_id('a1').remove!
+    assert_nil(doc.element_by_id('b2'))
+
+    docs = XML::Parser.parse_many([xml], :id_attribute => 'id', :threads => 1)
+    assert_equal('b', docs.first.element_by_id('b1').name)
+  end
 end
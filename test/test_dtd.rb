@@ -62,6 +62,29 @@ class TestDtd < Minitest::Test
     assert(@doc.validate(dtd))
   end
 
+  def test_valid_keeps_ids
+    doc = XML::Parser.string('<root><head a="ee" id="1" xml:id="x">Colorado</head><descr/></root>',
+                             :id_attribute => 'id').parse
+    dtd = XML::Dtd.new(<<-EOS)
+      <!ELEMENT root (head, descr)>
+      <!ELEMENT head (#PCDATA)>
+      <!ATTLIST head id NMTOKEN #REQUIRED a CDATA #IMPLIED xml:id ID #IMPLIED>
+      <!ELEMENT descr EMPTY>
+    EOS
+
+    assert_equal('head', doc.element_by_id('1').name)
+    assert(doc.validate(dtd))
+    assert_equal('head', doc.element_by_id('1').name)
+    assert_equal('head', doc.element_by_id('x').name)
+  end
+
+  def test_validate_read_only
+    @doc.read_only = true
+    assert_raises(FrozenError) do
+      @doc.validate(dtd)
+    end
+  end
+
   def test_node_type
     assert_equal(XML::Node::DTD_NODE, dtd.node_type)
   end
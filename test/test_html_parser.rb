@@ -42,6 +42,13 @@ class HTMLParserTest < Minitest::Test
     end
   end
 
+  def test_io_chunk_size
+    File.open(html_file) do |io|
+      doc = XML::HTMLParser.io(io, :chunk_size => 5).parse
+      assert_equal('html', doc.root.name)
+    end
+  end
+
   def test_io_gc
     # Test that the reader keeps a reference
     # to the io object
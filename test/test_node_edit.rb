@@ -74,6 +74,53 @@ class TestNodeEdit < Minitest::Test
     refute_nil(doc)
   end
 
+  def test_detached_tree_gc
+    root = XML::Node.new('root')
+    node = root
+    5.times do |i|
+      node << XML::Node.new("child#{i}")
+      node = node.first
+    end
+    leaf = node
+
+    # Split the tree, then move the removed part into another tree
+    middle = leaf.parent.parent.remove!
+    other = XML::Node.new('other')
+    other << middle
+    root = middle = other = nil
+    GC.start
+
+    assert_equal('<other><child2><child3><child4/></child3></child2></other>',
+                 leaf.parent.parent.parent.to_s(:indent => false))
+  end
+
+  def test_deep_detached_tree_gc
+    # Deep nodes keep their root alive through owner links, shallow
+    # ones by walking up, even after they are moved deeper
+    root = node = XML::Node.new('root')
+    40.times do
+      node << XML::Node.new('child')
+      node = node.first
+    end
+    deep = node
+
+    shallow_root = XML::Node.new('shallow')
+    shallow_root << XML::Node.new('leaf')
+    shallow = shallow_root.first
+    deep << shallow_root
+
+    middle = deep.parent.remove!
+    other = XML::Node.new('other')
+    other << middle
+    root = node = middle = other = shallow_root = nil
+    GC.start
+
+    assert_equal('other', deep.parent.parent.name)
+    current = shallow
+    current = current.parent while current.parent
+    assert_equal('other', current.name)
+  end
+
   def test_remove_node_iteration
     nodes = Array.new
     @doc.root.each_element do |node|
@@ -2,6 +2,8 @@
 
 require File.expand_path('../test_helper', __FILE__)
 require 'stringio'
+require 'pathname'
+require 'tempfile'
 
 class TestParser < Minitest::Test
   def setup
@@ -39,6 +41,22 @@ class TestParser < Minitest::Test
     assert_instance_of(XML::Parser::Context, parser.context)
   end
 
+  def test_mmap
+    file = File.expand_path(File.join(File.dirname(__FILE__), 'model/rubynet.xml'))
+
+    parser = XML::Parser.mmap(file)
+    doc = parser.parse
+    assert_instance_of(XML::Document, doc)
+    assert_equal(XML::Parser.file(file).parse.to_s, doc.to_s)
+    assert_equal(file, doc.url)
+  end
+
+  def test_mmap_noexistent_file
+    assert_raises(Errno::ENOENT) do
+      XML::Parser.mmap('i_dont_exist.xml')
+    end
+  end
+
   def test_noexistent_file
     error = assert_raises(XML::Error) do
       XML::Parser.file('i_dont_exist.xml')
@@ -93,6 +111,41 @@ class TestParser < Minitest::Test
     end
   end
 
+  def test_io_chunk_size
+    file = File.join(File.dirname(__FILE__), 'model/rubynet.xml')
+    expected = XML::Parser.file(file).parse.to_s
+
+    File.open(file) do |io|
+      assert_equal(expected, XML::Parser.io(io, :chunk_size => 7).parse.to_s)
+    end
+
+    string_io = StringIO.new(File.read(file))
+    assert_equal(expected, XML::Parser.io(string_io, :chunk_size => 3).parse.to_s)
+
+    assert_raises(ArgumentError) do
+      XML::Parser.io(StringIO.new('<a/>'), :chunk_size => 0)
+    end
+  end
+
+  def test_io_buffered
+    # Data already buffered by the io object must not be skipped
+    File.open(File.join(File.dirname(__FILE__), 'model/rubynet.xml')) do |io|
+      io.gets
+      doc = XML::Parser.io(io).parse
+      assert_equal('rubynet', doc.root.name)
+    end
+  end
+
+  def test_io_read_only
+    # Objects that only implement read are still supported
+    io = Object.new
+    string_io = StringIO.new('<root><child/></root>')
+    io.define_singleton_method(:read) {|length| string_io.read(length)}
+
+    doc = XML::Parser.io(io).parse
+    assert_equal('child', doc.root.first.name)
+  end
+
   def test_io_gc
     # Test that the reader keeps a reference
     # to the io object
@@ -103,6 +156,28 @@ class TestParser < Minitest::Test
     assert(parser.parse)
   end
 
+  def test_io_too_deep
+    # Files are parsed without the GVL, and libxml closes the input when it halts
+    Tempfile.create(['deep', '.xml']) do |file|
+      file.write('<a>' * 300 + '</a>' * 300)
+      file.flush
+
+      threads = 4.times.map do
+        Thread.new do
+          20.times do
+            File.open(file.path) do |io|
+              assert_raises(XML::Error) do
+                XML::Parser.io(io).parse
+              end
+            end
+          end
+        end
+      end
+      threads.each(&:join)
+    end
+    GC.start
+  end
+
   def test_nil_io
     error = assert_raises(TypeError) do
       XML::Parser.io(nil)
@@ -137,6 +212,54 @@ class TestParser < Minitest::Test
     puts 'Thread completed'
   end
 
+  def test_push
+    xml = "<bands genre=\"metal\">\n  <m\303\266tley_cr\303\274e/>\n  <iron_maiden/>\n</bands>"
+
+    parser = XML::Parser.push
+    assert_instance_of(XML::Parser, parser)
+    assert_instance_of(XML::Parser::Context, parser.context)
+
+    # Split in the middle of tags and multibyte characters
+    xml.bytes.each_slice(3) do |chunk|
+      assert_same(parser, parser.feed(chunk.pack('C*')))
+    end
+
+    doc = parser.finish
+    assert_instance_of(XML::Document, doc)
+    assert_equal('bands', doc.root.name)
+    assert_equal("m\u00F6tley_cr\u00FCe", doc.root.children[1].name)
+    assert_equal('metal', doc.root['genre'])
+  end
+
+  def test_push_options
+    parser = XML::Parser.push(:options => XML::Parser::Options::NOBLANKS,
+                              :base_uri => 'http://libxml.org')
+    parser.feed("<a>\n  <b/>\n</a>")
+    doc = parser.finish
+
+    assert_equal(1, doc.root.children.size)
+    assert_equal('http://libxml.org', doc.root.base_uri)
+  end
+
+  def test_push_error
+    parser = XML::Parser.push
+    parser.feed('<foo><bar/>')
+
+    error = assert_raises(XML::Error) do
+      parser.feed('</foz>')
+    end
+    assert_equal(XML::Error::TAG_NAME_MISMATCH, error.code)
+  end
+
+  def test_push_incomplete
+    parser = XML::Parser.push
+    parser.feed('<foo><bar/>')
+
+    assert_raises(XML::Error) do
+      parser.finish
+    end
+  end
+
   def test_string
     str = '<ruby_array uga="booga" foo="bar"><fixnum>one</fixnum><fixnum>two</fixnum></ruby_array>'
 
@@ -228,6 +351,23 @@ class TestParser < Minitest::Test
     end
   end
 
+  def test_string_too_deep
+    # libxml halts the parser, and closes the input, while the GVL is released
+    xml = '<a>' * 300 + '</a>' * 300
+
+    threads = 4.times.map do
+      Thread.new do
+        20.times do
+          assert_raises(XML::Error) do
+            XML::Parser.string(xml).parse
+          end
+        end
+      end
+    end
+    threads.each(&:join)
+    GC.start
+  end
+
   def test_fd_gc
     # Test opening # of documents up to the file limit for the OS.
     # Ideally it should run until libxml emits a warning,
@@ -257,6 +397,176 @@ class TestParser < Minitest::Test
     end
   end
 
+  def test_parse_threads
+    xml = '<root>' + (1..1000).map {|i| "<item id=\"#{i}\">#{i}</item>"}.join + '</root>'
+
+    threads = 4.times.map do
+      Thread.new do
+        10.times.map do
+          XML::Parser.string(xml).parse.root.children.size
+        end
+      end
+    end
+
+    threads.each do |thread|
+      assert_equal([1000] * 10, thread.value)
+    end
+  end
+
+  def test_parse_many
+    file = File.expand_path(File.join(File.dirname(__FILE__), 'model/bands.utf-8.xml'))
+    sources = ['<a/>', '<b><c/></b>', '<foo><bar/></foz>', Pathname.new(file), Pathname.new('i_dont_exist.xml')]
+
+    result = XML::Parser.parse_many(sources, :threads => 2)
+    assert_equal(5, result.size)
+
+    assert_instance_of(XML::Document, result[0])
+    assert_equal('a', result[0].root.name)
+    assert_instance_of(XML::Document, result[1])
+    assert_equal('c', result[1].root.child.name)
+    assert_instance_of(XML::Document, result[3])
+    assert_equal('bands', result[3].root.name)
+
+    assert_instance_of(XML::Error, result[2])
+    assert_equal(XML::Error::TAG_NAME_MISMATCH, result[2].code)
+    assert_instance_of(XML::Error, result[4])
+    assert_equal('Warning: failed to load external entity "i_dont_exist.xml".', result[4].to_s)
+  end
+
+  def test_parse_many_order
+    sources = (1..200).map {|i| "<item#{i}>#{'<x/>' * i}</item#{i}>"}
+    result = XML::Parser.parse_many(sources, :threads => 4)
+    assert_equal((1..200).map {|i| "item#{i}"}, result.map {|doc| doc.root.name})
+  end
+
+  def test_parse_many_options
+    result = XML::Parser.parse_many(['<a> <b/> </a>'], :options => XML::Parser::Options::NOBLANKS)
+    assert_equal(1, result.first.root.children.size)
+  end
+
+  class EntityScheme
+    @queries = 0
+
+    class << self
+      attr_accessor :queries
+
+      def document_query(uri)
+        self.queries += 1
+        '<!ENTITY e "entity">'
+      end
+    end
+  end
+
+  def test_parse_many_input_callbacks
+    XML::InputCallbacks.register
+    XML::InputCallbacks.add_scheme('rxml-test://', EntityScheme)
+    xml = '<!DOCTYPE a SYSTEM "rxml-test://a.dtd"><a>&e;</a>'
+    options = XML::Parser::Options::DTDLOAD | XML::Parser::Options::NOENT
+
+    assert_equal('entity', XML::Parser.string(xml, :options => options).parse.root.content)
+    assert_equal(1, EntityScheme.queries)
+
+    # Ruby input callbacks are never called while parsing a batch
+    result = XML::Parser.parse_many([xml] * 4, :threads => 2, :options => options)
+    assert_equal(1, EntityScheme.queries)
+    result.each do |doc|
+      assert_instance_of(XML::Document, doc)
+      assert_equal('', doc.root.content)
+    end
+  ensure
+    XML::InputCallbacks.remove_scheme('rxml-test://')
+  end
+
+  def test_parse_many_invalid
+    assert_equal([], XML::Parser.parse_many([]))
+
+    error = assert_raises(TypeError) do
+      XML::Parser.parse_many(['<a/>', 1])
+    end
+    assert_equal('Sources must be strings or respond to to_path', error.to_s)
+  end
+
+  def test_parse_interrupt
+    xml = '<root>' + '<item>text</item>' * 1_000_000 + '</root>'
+    parser = XML::Parser.string(xml)
+    started = Queue.new
+
+    thread = Thread.new do
+      Thread.current.report_on_exception = false
+      started << true
+      parser.parse
+    end
+
+    started.pop
+    sleep(0.01)
+    thread.raise(Interrupt)
+
+    assert_raises(Interrupt) do
+      thread.join
+    end
+  end
+
+  def test_parse_interrupt_comments
+    # Nothing is reported to the SAX handler until a comment ends
+    xml = '<root>' + ('<!--' + 'x' * 1_000_000 + '-->') * 40 + '</root>'
+    GC.start
+    GC.disable
+    started = Time.now
+    XML::Parser.string(xml).parse
+    duration = Time.now - started
+
+    parser = XML::Parser.string(xml)
+    thread = Thread.new do
+      Thread.current.report_on_exception = false
+      parser.parse
+    end
+
+    sleep(duration / 10)
+    started = Time.now
+    thread.raise(Interrupt)
+    assert_raises(Interrupt) do
+      thread.join
+    end
+    assert_operator(Time.now - started, :<, duration / 2)
+  ensure
+    GC.enable
+  end
+
+  def test_parse_concurrent
+    xml = '<root>' + '<item>text</item>' * 1_000_000 + '</root>'
+    parser = XML::Parser.string(xml)
+    started = Queue.new
+
+    thread = Thread.new do
+      started << true
+      parser.parse
+    end
+
+    started.pop
+    sleep(0.01)
+    error = assert_raises(RuntimeError) do
+      parser.parse
+    end
+    assert_equal('The parser context is already being parsed', error.to_s)
+    assert_raises(RuntimeError) do
+      parser.context.reset
+    end
+
+    assert_equal('item', thread.value.root.first.name)
+  end
+
+  def test_error_handler_raises
+    XML::Error.set_handler do |error|
+      raise(ArgumentError, error.message)
+    end
+
+    assert_raises(ArgumentError) do
+      XML::Parser.string('<foo><bar/></foz>').parse
+    end
+  ensure
+    XML::Error.set_handler(&XML::Error::QUIET_HANDLER)
+  end
+
   # -----  Errors  ------
   def test_error
     error = assert_raises(XML::Error) do
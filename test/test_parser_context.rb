@@ -18,6 +18,15 @@ class TestParserContext < Minitest::Test
     assert_nil(context.base_uri)
   end
 
+  def test_push
+    context = XML::Parser::Context.push
+    assert_instance_of(XML::Parser::Context, context)
+    assert_nil(context.base_uri)
+
+    context.base_uri = 'http://libxml.org'
+    assert_equal('http://libxml.org', context.base_uri)
+  end
+
   def test_encoding
     # ISO_8859_1:
     xml = <<-EOS
@@ -64,6 +73,16 @@ class TestParserContext < Minitest::Test
     assert_equal('http://libxml.rubyforge.org', context.base_uri)
   end
 
+  def test_mmap
+    file = File.join(File.dirname(__FILE__), 'model/bands.utf-8.xml')
+    context = XML::Parser::Context.mmap(file)
+    assert_instance_of(XML::Parser::Context, context)
+    assert_equal(file, context.base_uri)
+
+    doc = XML::Parser.new(context).parse
+    assert_equal('bands', doc.root.name)
+  end
+
   def test_string_empty
     error = assert_raises(TypeError) do
       XML::Parser::Context.string(nil)
@@ -76,6 +95,42 @@ class TestParserContext < Minitest::Test
     assert_equal("Must specify a string with one or more characters", error.to_s)
   end
 
+  def test_string_frozen
+    xml = "<root>#{'<item>value</item>' * 1000}</root>".freeze
+    context = XML::Parser::Context.string(xml)
+    xml = nil
+    GC.start
+    GC.compact if GC.respond_to?(:compact)
+
+    doc = XML::Parser.new(context).parse
+    assert_equal(1000, doc.root.children.length)
+  end
+
+  def test_string_modified
+    xml = +"<root><item/></root>"
+    context = XML::Parser::Context.string(xml)
+    xml.replace("<other/>")
+
+    doc = XML::Parser.new(context).parse
+    assert_equal('root', doc.root.name)
+  end
+
+  def test_reset
+    context = XML::Parser::Context.string('<first/>')
+    doc1 = XML::Parser.new(context).parse
+
+    assert_same(context, context.reset('<second/>'))
+    doc2 = XML::Parser.new(context).parse
+
+    assert_equal('first', doc1.root.name)
+    assert_equal('second', doc2.root.name)
+
+    error = assert_raises(ArgumentError) do
+      context.reset('')
+    end
+    assert_equal("Must specify a string with one or more characters", error.to_s)
+  end
+
   def test_well_formed
     parser = XML::Parser.string("<abc/>")
     parser.parse
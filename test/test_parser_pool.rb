@@ -0,0 +1,74 @@
+# encoding: UTF-8
+
+require File.expand_path('../test_helper', __FILE__)
+
+class TestParserPool < Minitest::Test
+  def test_parse
+    pool = XML::Parser::Pool.new
+    doc = pool.parse('<root><child/></root>')
+    assert_instance_of(XML::Document, doc)
+    assert_equal('child', doc.root.first.name)
+  end
+
+  def test_reuse
+    pool = XML::Parser::Pool.new(:size => 2)
+    docs = 3.times.map {|i| pool.parse("<root#{i}/>")}
+    assert_equal(%w(root0 root1 root2), docs.map {|doc| doc.root.name})
+
+    stats = pool.stats
+    assert_equal(2, stats[:hits])
+    assert_equal(1, stats[:misses])
+    assert_in_delta(2.0/3, stats[:hit_rate])
+    assert_equal(1, stats[:idle])
+  end
+
+  def test_options
+    pool = XML::Parser::Pool.new(:options => XML::Parser::Options::NOBLANKS)
+    2.times do
+      doc = pool.parse("<root>\n  <child/>\n</root>")
+      assert_equal(1, doc.root.children.length)
+    end
+  end
+
+  def test_error
+    pool = XML::Parser::Pool.new
+    assert_raises(XML::Error) do
+      pool.parse('<root>')
+    end
+
+    # The context is still usable
+    doc = pool.parse('<root/>')
+    assert_equal('root', doc.root.name)
+    assert_equal(1, pool.stats[:hits])
+  end
+
+  def test_size
+    pool = XML::Parser::Pool.new(:size => 0)
+    2.times {pool.parse('<root/>')}
+    assert_equal(0, pool.stats[:hits])
+    assert_equal(0, pool.stats[:idle])
+
+    assert_raises(ArgumentError) do
+      XML::Parser::Pool.new(:size => -1)
+    end
+  end
+
+  def test_threads
+    pool = XML::Parser::Pool.new(:size => 2)
+    threads = 4.times.map do |i|
+      Thread.new do
+        50.times.map {pool.parse("<root#{i}/>").root.name}.uniq
+      end
+    end
+    assert_equal(4.times.map {|i| ["root#{i}"]}, threads.map(&:value))
+    assert(pool.stats[:idle] <= 2)
+  end
+
+  def test_clear
+    pool = XML::Parser::Pool.new
+    pool.parse('<root/>')
+    assert_equal(1, pool.stats[:idle])
+    pool.clear
+    assert_equal(0, pool.stats[:idle])
+  end
+end
@@ -65,11 +65,39 @@ class TestReader < Minitest::Test
     end
   end
 
+  def test_mmap
+    reader = XML::Reader.mmap(XML_FILE)
+    verify_simple(reader)
+  end
+
+  def test_mmap_invalid_file
+    assert_raises(Errno::ENOENT) do
+      XML::Reader.mmap('/does/not/exist')
+    end
+  end
+
   def test_string
     reader = XML::Reader.string(File.read(XML_FILE))
     verify_simple(reader)
   end
 
+  def test_string_gc
+    # Test that the reader keeps the string it
+    # reads from alive and unchanged
+    xml = "<root>#{'<item>value</item>' * 1000}</root>"
+    reader = XML::Reader.string(xml)
+    xml.replace('<other/>')
+    xml = nil
+    GC.start
+    GC.compact if GC.respond_to?(:compact)
+
+    count = 0
+    while reader.read
+      count += 1 if reader.name == 'item' && reader.node_type == XML::Reader::TYPE_ELEMENT
+    end
+    assert_equal(1000, count)
+  end
+
   def test_io
     File.open(XML_FILE, 'rb') do |io|
       reader = XML::Reader.io(io)
@@ -77,6 +105,13 @@ class TestReader < Minitest::Test
     end
   end
 
+  def test_io_chunk_size
+    File.open(XML_FILE, 'rb') do |io|
+      reader = XML::Reader.io(io, :chunk_size => 10)
+      verify_simple(reader)
+    end
+  end
+
   def test_io_gc
     # Test that the reader keeps a reference
     # to the io object
@@ -365,4 +400,52 @@ class TestReader < Minitest::Test
     # Encoding is always null for strings, very annoying!
     assert_equal(reader.encoding, XML::Encoding::NONE)
   end
+
+  def test_each_match
+    xml = '<feed xmlns:p="urn:p"><entry id="1"><title>a</title><entry id="1.1"/></entry><p:entry id="2"/><other><entry id="3"/></other></feed>'
+
+    ids = []
+    reader = XML::Reader.string(xml)
+    assert_equal(reader, reader.each_match('entry') {|r| ids << r['id']})
+    assert_equal(['1', '1.1', '3'], ids)
+
+    ids = XML::Reader.string(xml).each_match(['/feed/entry', '//p:entry'], :namespaces => {'p' => 'urn:p'}).map {|r| r['id']}
+    assert_equal(['1', '2'], ids)
+
+    entries = []
+    XML::Reader.string(xml).each_match('entry', :expand => true) do |r, node|
+      entries << [node['id'], node.first && node.first.content]
+    end
+    assert_equal([['1', 'a'], ['3', nil]], entries)
+  end
+
+  def test_each_match_inside
+    xml = '<feed><a k="v"><entry id="x"/></a><entry id="1"/><entry id="2"/></feed>'
+    reader_at_a = lambda do
+      reader = XML::Reader.string(xml)
+      reader.read until reader.name == 'a'
+      assert_equal(1, reader.depth)
+      reader
+    end
+
+    assert_equal([], reader_at_a.call.each_match('/entry').map {|r| r['id']})
+    assert_equal(['1', '2'], reader_at_a.call.each_match('/feed/entry').map {|r| r['id']})
+    assert_equal(['x'], reader_at_a.call.each_match('/feed/a/entry').map {|r| r['id']})
+
+    reader = reader_at_a.call
+    assert(reader.move_to_first_attribute)
+    assert_equal(['x', '1', '2'], reader.each_match('/feed//entry').map {|r| r['id']})
+
+    # Positioned on the end tag of a
+    reader = reader_at_a.call
+    reader.read until reader.node_type == XML::Reader::TYPE_END_ELEMENT
+    assert_equal(['1', '2'], reader.each_match('/feed/entry').map {|r| r['id']})
+  end
+
+  def test_each_match_invalid
+    reader = XML::Reader.string('<feed/>')
+    assert_raises(ArgumentError) do
+      reader.each_match('entry[1]') {}
+    end
+  end
 end
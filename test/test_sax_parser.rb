@@ -187,6 +187,99 @@ class TestSaxParser < Minitest::Test
     verify(parser)
   end
 
+  def test_push
+    xml = File.read(saxtest_file)
+    parser = XML::SaxParser.push
+    parser.callbacks = TestCaseCallbacks.new
+    assert_same(parser, parser.feed(xml))
+    assert_equal(true, parser.finish)
+    verify(parser)
+  end
+
+  def test_push_chunks
+    xml = File.read(saxtest_file)
+
+    parser = XML::SaxParser.string(xml)
+    parser.callbacks = TestCaseCallbacks.new
+    parser.parse
+    expected = parser.callbacks.result.grep(/element/)
+
+    parser = XML::SaxParser.push
+    parser.callbacks = TestCaseCallbacks.new
+    xml.bytes.each_slice(7) do |chunk|
+      parser.feed(chunk.pack('C*'))
+      # Callbacks are generated as the input arrives
+      break if parser.callbacks.result.include?('start_element: title, attr: {"type"=>"html"}')
+    end
+    refute_includes(parser.callbacks.result, 'end_document')
+
+    parser = XML::SaxParser.push
+    parser.callbacks = TestCaseCallbacks.new
+    xml.bytes.each_slice(7) do |chunk|
+      parser.feed(chunk.pack('C*'))
+    end
+    parser.finish
+
+    assert_equal(expected, parser.callbacks.result.grep(/element/))
+    assert_equal('end_document', parser.callbacks.result.last)
+  end
+
+  def test_push_error
+    parser = XML::SaxParser.push
+    parser.callbacks = TestCaseCallbacks.new
+    parser.feed('<Results><a>')
+
+    error = assert_raises(XML::Error) do
+      parser.feed('</b>')
+    end
+    assert_equal(XML::Error::TAG_NAME_MISMATCH, error.code)
+    assert_includes(parser.callbacks.result, 'start_element: a, attr: {}')
+  end
+
+  def test_push_reentrant
+    callbacks = Class.new do
+      include XML::SaxParser::Callbacks
+      attr_accessor :parser, :chunk, :errors
+
+      def on_start_element(name, attributes)
+        @errors = [-> { parser.feed('<b/>') }, -> { parser.finish },
+                   -> { parser.parse }, -> { chunk << '<c/>' }].map do |call|
+          begin
+            call.call
+            nil
+          rescue RuntimeError => e
+            e.message
+          end
+        end
+      end
+    end.new
+
+    parser = XML::SaxParser.push
+    parser.callbacks = callbacks
+    callbacks.parser = parser
+    callbacks.chunk = +'<Results><a/>'
+    parser.feed(callbacks.chunk)
+
+    assert_equal(['The parser context is already being parsed'] * 3, callbacks.errors.first(3))
+    assert_match(/locked/, callbacks.errors.last)
+    assert_equal('<Results><a/>', callbacks.chunk)
+
+    # The parser and chunk are released afterwards
+    callbacks.chunk << '</Results>'
+    callbacks.parser = nil
+    parser.feed('</Results>')
+    assert_equal(true, parser.finish)
+  end
+
+  def test_push_incomplete
+    parser = XML::SaxParser.push
+    parser.feed('<Results><a>')
+
+    assert_raises(XML::Error) do
+      parser.finish
+    end
+  end
+
   def test_nil_string
     error = assert_raises(TypeError) do
       XML::SaxParser.string(nil)
@@ -9,6 +9,7 @@ require './test_attr'
 require './test_attr_decl'
 require './test_attributes'
 require './test_canonicalize'
+require './test_dictionary'
 require './test_document'
 require './test_document_write'
 require './test_dtd'
@@ -28,6 +29,7 @@ require './test_node_write'
 require './test_node_xlink'
 require './test_parser'
 require './test_parser_context'
+require './test_parser_pool'
 require './test_reader'
 require './test_relaxng'
 require './test_sax_parser'
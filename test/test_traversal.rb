@@ -60,7 +60,48 @@ class TestTranversal < Minitest::Test
     
     assert_equal(ROOT_ELEMENTS_LENGTH, nodes.length)
   end
-  
+
+  def test_each_element_named
+    names = @doc.root.each_element('book').map {|node| node.name}
+    assert_equal(ROOT_ELEMENTS_LENGTH, names.length)
+    assert_equal(['book'], names.uniq)
+
+    assert_equal([], @doc.root.each_element('missing').to_a)
+    assert_equal(ROOT_ELEMENTS_LENGTH, @doc.root.each_element.count)
+
+    # The names compared against must survive the block
+    name = 'book'
+    count = 0
+    @doc.root.each_element(:book) {GC.start; count += 1}
+    @doc.root.each_element(name) {name << 'x'; GC.start; count += 1}
+    assert_equal(2 * ROOT_ELEMENTS_LENGTH, count)
+  end
+
+  def test_each_element_namespace
+    doc = XML::Document.string(<<-EOS)
+      <root xmlns:a="http://a.example" xmlns:b="http://b.example">
+        <a:item/><b:item/><item/><a:other/>
+      </root>
+    EOS
+    assert_equal(['<a:item/>', '<a:other/>'],
+                 doc.root.each_element(nil, :ns => 'http://a.example').map {|node| node.to_s})
+    assert_equal(['<b:item/>'],
+                 doc.root.each_element('item', :ns => doc.root.namespaces.find_by_prefix('b')).map {|node| node.to_s})
+  end
+
+  def test_element_children
+    nodes = @doc.root.element_children
+    assert_equal(ROOT_ELEMENTS_LENGTH, nodes.length)
+    assert(nodes.all? {|node| node.element?})
+  end
+
+  def test_children_named
+    nodes = @doc.root.children_named('book')
+    assert_equal(ROOT_ELEMENTS_LENGTH, nodes.length)
+    assert_equal('bk101', nodes.first['id'])
+    assert_equal([], @doc.root.children_named('missing'))
+  end
+
   def test_next
     nodes = []
     
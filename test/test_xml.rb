@@ -259,4 +259,15 @@ class TestXml < Minitest::Test
 
     XML.default_save_no_empty_tags = original
   end
+
+  def test_memory_used
+    GC.start
+    before = XML.memory_used
+    doc = XML::Parser.string('<root>' + '<node attr="value">text</node>' * 10000 + '</root>').parse
+    assert_operator(XML.memory_used, :>, before + 100_000)
+
+    doc = nil
+    GC.start
+    assert_operator(XML.memory_used, :<, before + 100_000)
+  end
 end
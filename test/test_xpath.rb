@@ -194,6 +194,45 @@ class TestXPath < Minitest::Test
     assert_equal(XML::Node::NAMESPACE_DECL, node.node_type)
   end
 
+  def test_xpath_namespace_nodes_gc
+    namespaces = XML::Document.string('<feed xmlns:a="urn:a"><entry/></feed>').root.find('namespace::*').to_a
+    GC.start
+    assert_equal(['http://www.w3.org/XML/1998/namespace', 'urn:a'], namespaces.map {|ns| ns.href}.sort)
+    assert_nil(namespaces.first.next)
+  end
+
+  def test_xpath_freed_nodes_gc
+    doc = XML::Document.string('<a><b>one</b><b>two</b></a>')
+    10.times do
+      result = doc.find('//b/text() | /a/namespace::*')
+      assert_equal(3, result.length)
+      doc.root.content = 'x'
+      doc.root << XML::Node.new('b', 'one') << XML::Node.new('b', 'two')
+      result = nil
+      GC.start
+    end
+  end
+
+  def test_xpath_namespace_nodes_from_values_gc
+    doc = XML::Document.string('<a xmlns:n="urn:n"><b/></a>')
+    context = doc.context
+    context.register_function('namespaces') { doc.root.find('namespace::*') }
+    context['ns'] = doc.root.find('namespace::*')
+    expression = XML::XPath::Expression.new('/a/namespace :: *')
+
+    10.times do
+      results = [context.find('namespaces()'), context.find('$ns'), doc.find(expression)]
+      doc.root.content = 'x'
+      doc.root << XML::Node.new('b')
+      GC.start
+      results.each do |result|
+        assert_equal(['http://www.w3.org/XML/1998/namespace', 'urn:n'], result.map {|ns| ns.href}.sort)
+      end
+      results = nil
+      GC.start
+    end
+  end
+
 	# Test to make sure we don't get nil on empty results.
 	# This is also to test that we don't segfault due to our C code getting a NULL pointer
 	# and not handling it properly.
@@ -241,4 +280,226 @@ class TestXPath < Minitest::Test
     assert_equal(1, nodes.length)
     assert_equal(nodes[0].content, ' my comment ')
   end
+
+  def test_find_cached_context
+    doc = LibXML::XML::Document.string('<root xmlns:a="urn:a"><a:item><child/></a:item><other xmlns:b="urn:b"><b:item/></other></root>')
+    child = doc.find_first('//child')
+
+    assert_equal(1, doc.find('//a:item').length)
+    assert_equal('item', child.find_first('..').name)
+    assert_equal(1, doc.find_first('//other').find('b:item').length)
+
+    # Nested finds do not share the cached context
+    names = doc.find('//a:item').map {|node| node.find_first('child').name}
+    assert_equal(['child'], names)
+  end
+
+  def test_find_cached_context_invalidated
+    doc = LibXML::XML::Document.string('<root><item/></root>')
+    assert_equal(0, doc.find('count(//x:item)', 'x:urn:x').to_i)
+    assert_raises(LibXML::XML::Error) { doc.find('//x:item') }
+
+    LibXML::XML::Namespace.new(doc.root, 'x', 'urn:x')
+    assert_equal(0, doc.find('//x:item').length)
+
+    root = LibXML::XML::Node.new('root')
+    LibXML::XML::Namespace.new(root, 'y', 'urn:y')
+    doc.root = root
+    assert_equal(0, doc.find('//y:item').length)
+    assert_raises(LibXML::XML::Error) { doc.find('//x:item') }
+  end
+
+  def test_find_frozen
+    doc = LibXML::XML::Document.string('<root><a/><a/></root>')
+    assert_equal(2, doc.find('//a').length)
+    doc.freeze
+
+    assert_equal(2, doc.find('//a').length)
+    doc.root << LibXML::XML::Node.new('a')
+    assert_equal(3, doc.find('//a').length)
+  end
+
+  def test_expression_cache
+    size = LibXML::XML::XPath.cache_size
+    LibXML::XML::XPath.clear_cache
+
+    3.times { assert_equal(1, @doc.find('/soap:Envelope/soap:Body').length) }
+    stats = LibXML::XML::XPath.cache_stats
+    assert_equal(1, stats[:misses])
+    assert_equal(2, stats[:hits])
+    assert_equal(1, stats[:entries])
+
+    LibXML::XML::XPath.cache_size = 2
+    @doc.find('/soap:Envelope')
+    @doc.find('//soap:Body')
+    @doc.find('/soap:Envelope')
+    assert_equal(2, LibXML::XML::XPath.cache_stats[:entries])
+
+    # The least recently used expression was evicted
+    @doc.find('/soap:Envelope/soap:Body')
+    assert_equal(4, LibXML::XML::XPath.cache_stats[:misses])
+
+    LibXML::XML::XPath.cache_size = 0
+    assert_equal(0, LibXML::XML::XPath.cache_stats[:entries])
+    assert_equal(1, @doc.find('/soap:Envelope').length)
+    assert_equal(0, LibXML::XML::XPath.cache_stats[:entries])
+  ensure
+    LibXML::XML::XPath.cache_size = size
+  end
+
+  def test_expression_cache_prefixed_function
+    LibXML::XML::XPath.clear_cache
+    @doc.register_xpath_function('local', 'urn:functions') {|nodes| nodes.first.name}
+
+    2.times { assert_equal('Envelope', @doc.find('f:local(/*)', 'f:urn:functions')) }
+    assert_equal(0, LibXML::XML::XPath.cache_stats[:entries])
+
+    # Literals, axes and node tests with prefixes are not function calls
+    @doc.find("/soap:Envelope[name() != 'f:local()']/child::soap:Body")
+    assert_equal(1, LibXML::XML::XPath.cache_stats[:entries])
+  end
+
+  def test_expression_cache_invalid
+    LibXML::XML::XPath.clear_cache
+    2.times do
+      error = assert_raises(LibXML::XML::Error) { @doc.find('//soap:Envelope[') }
+      assert_equal('Error: Invalid expression.', error.to_s)
+    end
+    assert_equal(0, LibXML::XML::XPath.cache_stats[:entries])
+  end
+
+  def test_contents
+    doc = LibXML::XML::Document.string('<root a="1"><b>one</b><b>t<i>w</i>o</b><!--c--></root>')
+    assert_equal(['one', 'two'], doc.find('//b').contents)
+    assert_equal(['1'], doc.find('/root/@a').contents)
+    assert_equal(['c'], doc.find('//comment()').contents)
+    assert_equal([], doc.find('//missing').contents)
+
+    values = doc.find('//b|//b').contents(:freeze => true)
+    assert(values.all?(&:frozen?))
+
+    values = doc.find('//b/text()').contents(:dedup => true)
+    assert_equal(['one', 't', 'o'], values)
+    assert(values.all?(&:frozen?))
+  end
+
+  def test_find_values
+    doc = LibXML::XML::Document.string('<root><b id="x">one</b><b id="x">two</b></root>')
+    assert_equal(['one', 'two'], doc.find_values('//b'))
+    assert_equal([2.0], doc.find_values('count(//b)'))
+
+    ids = doc.find_values('//b/@id', :dedup => true)
+    assert_equal(['x', 'x'], ids)
+    assert_same(ids[0], ids[1])
+
+    assert_equal(['one'], doc.root.find_strings('b[1]'))
+    assert_equal(['2'], doc.root.find_strings('string(count(b))'))
+    assert_equal(['2'], doc.root.find_strings('count(b)'))
+    assert_equal(['true'], doc.root.find_strings('count(b) = 2'))
+  end
+
+  def test_find_vars
+    expression = XML::XPath::Expression.new('//soap:*[local-name() = $name]')
+    assert_equal(1, @doc.find(expression, :vars => {'name' => 'Body'}).length)
+    assert_equal('Envelope', @doc.find_first(expression, :vars => {:name => 'Envelope'}).name)
+
+    # Variables do not outlive the query
+    assert_raises(LibXML::XML::Error) do
+      @doc.find(expression)
+    end
+
+    nodes = @doc.root.find('//ns1:IdAndName[position() > $skip]', 'ns1:http://domain.somewhere.com', :vars => {'skip' => 1})
+    assert_equal(2, nodes.length)
+
+    # Documents without a root
+    assert_equal('x', XML::Document.new.find('$name', :vars => {'name' => 'x'}))
+  end
+
+  def test_find_read_only_threads
+    @doc.read_only = true
+    expected = @doc.find('//ns1:IdAndName', 'ns1:http://domain.somewhere.com').map(&:to_s)
+
+    threads = 4.times.map do
+      Thread.new do
+        50.times.map do
+          @doc.find('//ns1:IdAndName', 'ns1:http://domain.somewhere.com').map(&:to_s)
+        end
+      end
+    end
+
+    threads.each do |thread|
+      thread.value.each {|result| assert_equal(expected, result)}
+    end
+
+    assert_raises(LibXML::XML::Error) do
+      @doc.find('//ns1:IdAndName[')
+    end
+  end
+
+  def test_find_read_only_shared_context
+    @doc.read_only = true
+    context = @doc.context('ns1:http://domain.somewhere.com')
+    context.enable_cache
+    errors = Queue.new
+
+    threads = 4.times.map do
+      Thread.new do
+        200.times do
+          begin
+            assert_equal(3, context.find('//ns1:IdAndName').length)
+          rescue RuntimeError => error
+            errors << error
+          end
+        end
+      end
+    end
+    threads.each(&:join)
+
+    errors.size.times do
+      assert_match(/already evaluating/, errors.pop.message)
+    end
+    assert_equal(3, context.find('//ns1:IdAndName').length)
+  end
+
+  def test_find_context_busy
+    context = XML::XPath::Context.new(@doc)
+    context.register_function('reenter') do
+      assert_raises(RuntimeError) { context.find('1') }
+      assert_raises(RuntimeError) { context['name'] = 'value' }
+      assert_raises(RuntimeError) { context.node = @doc.root }
+      true
+    end
+    assert_equal(true, context.find('reenter()'))
+    assert_equal(1.0, context.find('1'))
+  end
+
+  def test_find_read_only_clear
+    @doc.read_only = true
+    @doc.register_xpath_function('writable') { @doc.read_only = false }
+
+    assert_raises(RuntimeError) do
+      @doc.find('writable()')
+    end
+    assert(@doc.read_only?)
+
+    # The count is back to zero once the evaluation finished
+    @doc.read_only = false
+    refute(@doc.read_only?)
+  end
+
+  def test_find_read_only_error_handler
+    @doc.read_only = true
+    XML::Error.set_handler {|error| raise(ArgumentError, error.message)}
+
+    error = assert_raises(ArgumentError) do
+      @doc.find('//ns1:IdAndName[$nope]', 'ns1:http://domain.somewhere.com')
+    end
+    assert_match(/Undefined variable/, error.message)
+
+    # Nothing is left pending for later evaluations or parses
+    assert_equal(3, @doc.find('//ns1:IdAndName', 'ns1:http://domain.somewhere.com').length)
+    assert_equal('a', XML::Parser.string('<a/>').parse.root.name)
+  ensure
+    XML::Error.set_handler(&XML::Error::VERBOSE_HANDLER)
+  end
 end
@@ -85,4 +85,157 @@ class TestXPathContext < Minitest::Test
     end
     assert_equal("Supplied argument must be a document or node.", error.to_s)
   end
-end
\ No newline at end of file
+
+  def test_register_function
+    @context.register_namespace(SOAP_PREFIX, SOAP_URI)
+    @context.register_namespace('f', 'urn:functions')
+    @context.register_function('named', 'urn:functions') do |nodes, name|
+      nodes.any? {|node| node.name == name}
+    end
+
+    nodes = @context.find("//*[f:named(., 'IdAndName')]")
+    assert_equal(3, nodes.length)
+
+    @context.register_function('answer') { 42 }
+    assert_equal(42.0, @context.find('answer()'))
+
+    @context.register_function('body') { @context.doc.find('//soap:Body') }
+    assert_equal(['Body'], @context.find('body()').map {|node| node.name})
+  end
+
+  def test_register_function_namespaces
+    doc = @context.doc
+    expression = XML::XPath::Expression.new('f:name()')
+
+    2.times do
+      first = XML::XPath::Context.new(doc)
+      first.register_namespace('f', 'urn:first')
+      first.register_function('name', 'urn:first') { 'first' }
+
+      second = XML::XPath::Context.new(doc)
+      second.register_namespace('f', 'urn:second')
+      second.register_function('name', 'urn:second') { 'second' }
+
+      assert_equal('first', first.find('f:name()'))
+      assert_equal('second', second.find('f:name()'))
+      assert_equal('first', first.find(expression))
+      assert_equal('second', second.find(expression))
+
+      # The prefix is bound, but not to the namespace of the function
+      first.register_namespace('f', 'urn:second')
+      assert_raises(LibXML::XML::Error) { first.find('f:name()') }
+      GC.start
+    end
+  end
+
+  def test_register_function_exception
+    @context.register_function('fail') { raise(ArgumentError, 'failed') }
+    error = assert_raises(ArgumentError) do
+      @context.find('//*[fail()]')
+    end
+    assert_equal('failed', error.message)
+
+    # The compiled expression is cached, other contexts do not know the function
+    context = XML::XPath::Context.new(@context.doc)
+    assert_raises(LibXML::XML::Error) do
+      context.find('//*[fail()]')
+    end
+  end
+
+  def test_register_function_foreign_nodes
+    other = XML::Document.string('<other/>')
+    @context.register_function('foreign') { other.root }
+    assert_raises(LibXML::XML::Error) do
+      @context.find('foreign()')
+    end
+
+    @context.register_function('detached') { XML::Node.new('detached', nil) }
+    assert_raises(LibXML::XML::Error) do
+      @context.find('detached()')
+    end
+
+    assert_raises(LibXML::XML::Error) do
+      @context['node'] = other.root
+    end
+
+    @context.register_function('own') { @context.doc.root }
+    assert_equal(1, @context.find('own()').length)
+  end
+
+  def test_register_function_builtin
+    assert_raises(ArgumentError) do
+      @context.register_function('count') {|nodes| 0}
+    end
+  end
+
+  def test_document_function
+    doc = @context.doc
+    doc.register_xpath_function('local', 'urn:functions') {|nodes| nodes.first.name}
+    assert_equal('Envelope', doc.find('f:local(/*)', 'f:urn:functions'))
+
+    context = XML::XPath::Context.new(doc)
+    context.register_namespace('f', 'urn:functions')
+    assert_equal('Envelope', context.find('f:local(/*)'))
+
+    doc.freeze
+    assert_raises(FrozenError) do
+      doc.register_xpath_function('other') {|nodes| nodes.length}
+    end
+    assert_equal('Envelope', doc.find('f:local(/*)', 'f:urn:functions'))
+  end
+
+  def test_variables
+    @context['name'] = 'Envelope'
+    @context['limit'] = 2
+    assert_equal('Envelope', @context['name'])
+    assert_equal(2.0, @context['limit'])
+
+    expression = XML::XPath::Expression.new('//*[local-name() = $name]')
+    assert_equal(1, @context.find(expression).length)
+
+    @context['name'] = 'IdAndName'
+    assert_equal(3, @context.find(expression).length)
+    assert_equal(true, @context.find('count(//*[local-name() = $name]) > $limit'))
+
+    @context['name'] = nil
+    assert_nil(@context['name'])
+    assert_raises(LibXML::XML::Error) do
+      @context.find(expression)
+    end
+  end
+
+  def test_variable_removed_node
+    node = @context.find('//*[local-name() = "IdAndName"]').first
+    @context['node'] = node
+    node.remove!
+    node = nil
+    GC.start
+
+    assert_equal('IdAndName', @context.find('local-name($node)'))
+    assert_equal(2.0, @context.find('count($node/*)'))
+
+    @context['node'] = nil
+    assert_nil(@context['node'])
+  end
+
+  def test_find_all
+    @context.register_namespace('ns1', 'http://domain.somewhere.com')
+    @context.node = @context.find('//ns1:IdAndName').first
+    expressions = [XML::XPath::Expression.new('ns1:id'), 'string(ns1:name)', 'count(*)', 'ns1:missing']
+
+    results = @context.find_all(expressions)
+    assert_equal(4, results.length)
+    assert_instance_of(XML::XPath::Object, results[0])
+    assert_equal('1', results[0].first.content)
+    assert_equal('man1', results[1])
+    assert_equal(2.0, results[2])
+    assert(results[3].empty?)
+
+    assert_equal(['1', 'man1', '2', ''], @context.find_all(expressions, :strings => true))
+    assert_equal([], @context.find_all([]))
+
+    assert_raises(TypeError) do
+      @context.find_all([1])
+    end
+  end
+end